@@ -46,6 +46,12 @@ SPINLOCK_INLINE
 spinlock_data_t spinlock_data_get(volatile spinlock_data_t *sd);
 SPINLOCK_INLINE
 spinlock_data_t spinlock_data_testandset(volatile spinlock_data_t *sd);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_fetchadd(volatile spinlock_data_t *sd,
+				       unsigned val);
+SPINLOCK_INLINE
+spinlock_data_t spinlock_data_cas(volatile spinlock_data_t *sd,
+				  spinlock_data_t old, spinlock_data_t new);
 
 ////////////////////////////////////////////////////////////
 
@@ -118,5 +124,60 @@ spinlock_data_testandset(volatile spinlock_data_t *sd)
 	return x;
 }
 
+/*
+ * Atomically add VAL to a spinlock_data_t and return the old value.
+ * Unlike test-and-set this has to succeed, so retry until the SC
+ * does.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_fetchadd(volatile spinlock_data_t *sd, unsigned val)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%3);"	/*   x = *sd */
+		"addu %1, %0, %2;"	/*   y = x + val */
+		"sc %1, 0(%3);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   retry if the store failed */
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (val), "r" (sd) : "memory");
+	return x;
+}
+
+
+/*
+ * Atomically replace OLD with NEW in a spinlock_data_t. Returns the
+ * value found, which is OLD if and only if the swap happened. A
+ * failed SC with the value still OLD is retried, so a different
+ * return value really means someone else changed it.
+ */
+SPINLOCK_INLINE
+spinlock_data_t
+spinlock_data_cas(volatile spinlock_data_t *sd, spinlock_data_t old,
+		  spinlock_data_t new)
+{
+	spinlock_data_t x;
+	spinlock_data_t y;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		".set volatile;"	/* avoid unwanted optimization */
+		"1: ll %0, 0(%4);"	/*   x = *sd */
+		"bne %0, %2, 2f;"	/*   give up if x != old */
+		"move %1, %3;"		/*   y = new */
+		"sc %1, 0(%4);"		/*   *sd = y; y = success? */
+		"beqz %1, 1b;"		/*   retry if the store failed */
+		"2:"
+		".set pop"		/* restore assembler mode */
+		: "=&r" (x), "=&r" (y) : "r" (old), "r" (new), "r" (sd)
+		: "memory");
+	return x;
+}
 
 #endif /* _MIPS_SPINLOCK_H_ */
@@ -84,18 +84,28 @@
 #define USERSTACK     USERSPACETOP
 
 /*Added to support easy changes to bit-shifter functions in coremap.c*/
-#define CHUNK_SIZE_LEFTBOUND    64
-#define CHUNK_SIZE_RIGHTBOUND   45
+#define REFCOUNT_LEFTBOUND      64
+#define REFCOUNT_RIGHTBOUND     57
+#define CHUNK_SIZE_LEFTBOUND    56
+#define CHUNK_SIZE_RIGHTBOUND   46
+#define IS_MERGED_BIT_POS       45
 #define OWNER_LEFTBOUND         44
-#define OWNER_RIGHTBOUND        37
-#define FREE_BIT_POS            36
-#define CLEAN_BIT_POS           35
-#define	IS_FIRST_CHUNK_BIT_POS	34
-#define IS_FIXED_BIT_POS		33
-#define VADDR_LEFTBOUND			32
+#define OWNER_RIGHTBOUND        30
+#define FREE_BIT_POS            29
+#define CLEAN_BIT_POS           28
+#define	IS_FIRST_CHUNK_BIT_POS	27
+#define IS_FIXED_BIT_POS		26
+#define VADDR_LEFTBOUND			20	/* holds vaddr >> VADDR_SHIFT */
 #define	VADDR_RIGHTBOUND		1
+#define VADDR_SHIFT				12
 #define	TYPE_SIZE				64
 
+/* Largest PID the owner field can hold; has to cover PID_MAX */
+#define OWNER_MAX               ((1 << (OWNER_LEFTBOUND - OWNER_RIGHTBOUND + 1)) - 1)
+
+/* Largest reference count a shared frame can hold */
+#define REFCOUNT_MAX            ((1 << (REFCOUNT_LEFTBOUND - REFCOUNT_RIGHTBOUND + 1)) - 1)
+
 
 /*
  * Interface to the low-level module that looks after the amount of
@@ -122,8 +132,7 @@
 extern paddr_t coremap_paddr;	//Marks starting address of coremap
 extern paddr_t firstpaddr;
 extern uint32_t coremap_size;
-extern uint32_t coremap_used_pages;
-extern uint32_t num_fixed_pages;
+extern uint32_t num_fixed_pages;	/* in use from boot; see coremap_used_bytes */
 
 void ram_bootstrap(void);
 paddr_t ram_stealmem(unsigned long npages);
@@ -131,6 +140,8 @@ paddr_t ram_getsize(void);
 paddr_t ram_getfirstfree(void);
 
 
+uint64_t get_refcount(uint64_t);
+uint64_t set_refcount(uint64_t, uint64_t);
 uint64_t get_chunk_size(uint64_t);
 uint64_t set_chunk_size(uint64_t, uint64_t);
 uint64_t get_owner(uint64_t);
@@ -143,6 +154,8 @@ bool get_is_first_chunk(uint64_t);
 uint64_t set_is_first_chunk(bool, uint64_t);
 bool get_is_fixed(uint64_t);
 uint64_t set_is_fixed(bool, uint64_t);
+bool get_is_merged(uint64_t);
+uint64_t set_is_merged(bool, uint64_t);
 uint64_t get_vaddr(uint64_t);
 uint64_t set_vaddr(uint64_t, uint64_t);
 uint64_t build_page_entry(uint64_t, uint64_t, bool, bool, bool, bool, uint64_t);
@@ -153,11 +166,11 @@ uint64_t build_page_entry(uint64_t, uint64_t, bool, bool, bool, bool, uint64_t);
  * We'll take up to 16 invalidations before just flushing the whole TLB.
  */
 
+struct semaphore;
+
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;		/* page to invalidate */
+	struct semaphore *ts_done;	/* V()ed by each cpu when done */
 };
 
 #define TLBSHOOTDOWN_MAX 16
@@ -114,10 +114,7 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
 	// p_table->table[curproc->pid] = NULL;
 	// lock_release(p_table->pt_lock);			//Added
 
-	curproc->exited = true;
-	curproc->exit_status = _MKWAIT_SIG(sig);
-	V(curproc->exit_sem);
-	thread_exit();
+	uthread_exitproc(_MKWAIT_SIG(sig));
 	/*
 	 * You will probably want to change this.
 	 */
@@ -205,6 +202,22 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+
+		/*
+		 * If another thread of this process is exiting, leave
+		 * now rather than going back to user mode.
+		 */
+		if (!iskern && curproc->p_exiting) {
+			/*
+			 * We came from user mode, so the spl is already
+			 * 0 and only the processor has interrupts off;
+			 * turn them on, since exiting may sleep.
+			 */
+			KASSERT(curthread->t_curspl == 0);
+			cpu_irqon();
+			uthread_checkexit();
+			goto done;
+		}
 		goto done2;
 	}
 
@@ -325,6 +338,11 @@ mips_trap(struct trapframe *tf)
 	panic("I can't handle this... I think I'll just die now...\n");
 
  done:
+	/* Another thread of this process may be exiting; see above. */
+	if (!iskern) {
+		uthread_checkexit();
+	}
+
 	/*
 	 * Turn interrupts off on the processor, without affecting the
 	 * stored interrupt state.
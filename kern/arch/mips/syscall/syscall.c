@@ -34,6 +34,7 @@
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
+#include <counter.h>
 #include <syscall.h>
 #include <file_syscalls.h>
 #include <proc_syscalls.h>
@@ -92,6 +93,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	counter_inc(CTR_SYSCALLS);
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -113,6 +115,10 @@ syscall(struct trapframe *tf)
 			err = sys___time((userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
 			break;
 
+	    case SYS_nanosleep:
+			err = sys_nanosleep((const_userptr_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+			break;
+
 		case SYS_chdir:
 			err = sys_chdir((const char *)tf->tf_a0, &retval);
 			break;
@@ -141,10 +147,39 @@ syscall(struct trapframe *tf)
 			err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
 			break;
 
+		case SYS_mmap:
+			err = sys_mmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1, (int)tf->tf_a2, (int)tf->tf_a3, (const void *)(tf->tf_sp+16), &retval);
+			break;
+
+		case SYS_munmap:
+			err = sys_munmap((vaddr_t)tf->tf_a0, (size_t)tf->tf_a1, &retval);
+			break;
+
+		case SYS_futex:
+			err = sys_futex((userptr_t)tf->tf_a0, (int)tf->tf_a1, (int)tf->tf_a2, &retval);
+			break;
+
+		case SYS___thread_create:
+			err = sys___thread_create(tf, (vaddr_t)tf->tf_a0, (vaddr_t)tf->tf_a1, (vaddr_t)tf->tf_a2, &retval);
+			break;
+
+		case SYS_thread_exit:
+			sys_thread_exit();
+			break;
+
+		case SYS_thread_join:
+			err = sys_thread_join((int)tf->tf_a0, &retval);
+			break;
+
 		case SYS_waitpid:
 			err = sys_waitpid((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, &retval);
 			break;
 
+		case SYS_wait4:
+			err = sys_wait4((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2,
+					(userptr_t)tf->tf_a3, &retval);
+			break;
+
 		case SYS_lseek:
 			is64 = true;
 			pos |= tf->tf_a2;
@@ -169,6 +204,14 @@ syscall(struct trapframe *tf)
     		sys_getpid(&retval);
     		break;
 
+    	case SYS_getpriority:
+    		err = sys_getpriority((int)tf->tf_a0, (pid_t)tf->tf_a1, &retval);
+    		break;
+
+    	case SYS_setpriority:
+    		err = sys_setpriority((int)tf->tf_a0, (pid_t)tf->tf_a1, (int)tf->tf_a2, &retval);
+    		break;
+
     	case SYS_execv:
     		err = sys_execv((const char *)tf->tf_a0, (char **)tf->tf_a1, &retval);
     		break;
@@ -180,6 +223,10 @@ syscall(struct trapframe *tf)
 	}
 
 
+	if (err || err64) {
+		counter_inc(CTR_SYSCALL_ERRORS);
+	}
+
 	if (err) {
 		/*
 		 * Return the error code. This gets converted at
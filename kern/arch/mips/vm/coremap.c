@@ -30,6 +30,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <limits.h>
 #include <spl.h>
 #include <cpu.h>
 #include <spinlock.h>
@@ -44,15 +45,45 @@
 /*
 Current structure of page-entry:
 
-[Chunksize, owner(PID), free_bit, clean_bit, is_first_chunk_bit, is_fixed_bit, owner VADDR]
+[Refcount, Chunksize, is_merged_bit, owner(PID), free_bit, clean_bit, is_first_chunk_bit, is_fixed_bit, (unused), owner VADDR]
+
+The owner field is wide enough for any PID up to PID_MAX. VADDR is
+always page aligned, so only its page number is kept.
+
+Refcount is zero for ordinary pages. Shared frames have no owner and
+are freed when their refcount drops to zero. Merged frames are shared
+frames made by the same-page merging scanner; they are mapped
+read-only everywhere.
 
 */
 
+/*Takes 64-bit page entry and returns refcount*/
+uint64_t
+get_refcount(uint64_t page_entry)
+{
+	page_entry >>= REFCOUNT_RIGHTBOUND -1; //rightshifts by num bits to the right of refcount
+	return page_entry;
+}
+
+/*Sets refcount onto existing page_entry*/
+uint64_t
+set_refcount(uint64_t refcount, uint64_t page_entry)
+{
+	refcount <<= (REFCOUNT_RIGHTBOUND-1);
+	page_entry <<= (REFCOUNT_LEFTBOUND - REFCOUNT_RIGHTBOUND +1);
+	page_entry >>= (REFCOUNT_LEFTBOUND - REFCOUNT_RIGHTBOUND +1);
+	page_entry |= refcount;
+	return page_entry;
+}
+
 /*Takes 64-bit page entry and returns chunk size*/
 uint64_t
 get_chunk_size(uint64_t page_entry)
 {
-	page_entry >>= CHUNK_SIZE_RIGHTBOUND -1; //rightshifts by num bits to the right of chunk_size
+	//Leftshift to get rid of refcount bits
+	page_entry <<= TYPE_SIZE - CHUNK_SIZE_LEFTBOUND;
+	//Rightshift to place chunk_size bits in rightmost bit positions
+	page_entry >>= TYPE_SIZE - (CHUNK_SIZE_LEFTBOUND - CHUNK_SIZE_RIGHTBOUND +1);
 	return page_entry;
 }
 
@@ -60,13 +91,66 @@ get_chunk_size(uint64_t page_entry)
 uint64_t
 set_chunk_size(uint64_t chunk_size, uint64_t page_entry)
 {
-	chunk_size <<= (CHUNK_SIZE_RIGHTBOUND-1);
-	page_entry <<= (CHUNK_SIZE_LEFTBOUND - CHUNK_SIZE_RIGHTBOUND +1);
-	page_entry >>= (CHUNK_SIZE_LEFTBOUND - CHUNK_SIZE_RIGHTBOUND +1);
+	//Leftshift chunk_size to correct bit positions
+	chunk_size <<= CHUNK_SIZE_RIGHTBOUND-1;
+
+	//Make copy of bits left of chunk_size
+	uint64_t left_bits = page_entry;
+	left_bits >>= CHUNK_SIZE_LEFTBOUND;
+	left_bits <<= CHUNK_SIZE_LEFTBOUND;
+
+	//Remove original chunk_size bits and all bits left of it from page_entry
+	page_entry <<= TYPE_SIZE - (CHUNK_SIZE_RIGHTBOUND - 1);
+	page_entry >>= TYPE_SIZE - (CHUNK_SIZE_RIGHTBOUND - 1);
+
+	page_entry |= left_bits;
 	page_entry |= chunk_size;
 	return page_entry;
 }
 
+/*Takes 64-bit page entry and returns is_merged_bit*/
+bool
+get_is_merged(uint64_t page_entry)
+{
+	//Leftshift to get rid of all bits to the left of is_merged_bit
+	page_entry <<= TYPE_SIZE - IS_MERGED_BIT_POS;
+
+	//Rightshift to place is_merged_bit at right-most bit position
+	page_entry >>= TYPE_SIZE - 1;
+
+	//Check value of bit
+	if((uint64_t)page_entry == 1){
+		return true;
+	}
+	return false;
+}
+
+/*Sets is_merged_bit onto existing page_entry*/
+uint64_t
+set_is_merged(bool is_merged, uint64_t page_entry)
+{
+	//Make copy of bits left of is_merged_bit
+	uint64_t left_bits = page_entry;
+	left_bits >>= IS_MERGED_BIT_POS;
+	left_bits <<= IS_MERGED_BIT_POS;
+
+	//Remove original is_merged_bit and all bits to its left
+	page_entry <<= TYPE_SIZE - (IS_MERGED_BIT_POS - 1);
+	page_entry >>= TYPE_SIZE - (IS_MERGED_BIT_POS - 1);
+
+	//OR in left_bits
+	page_entry |= left_bits;
+
+	//If page is merged, shift a 1 into the IS_MERGED_BIT_POS and OR into page_entry
+	if(is_merged){
+		uint64_t is_merged_bit = 1;
+		is_merged_bit <<= IS_MERGED_BIT_POS-1;
+		page_entry |= is_merged_bit;
+	}
+
+	return page_entry;
+}
+
 /*Takes TYPE_SIZE-bit page entry and returns owner (PID)*/
 uint64_t
 get_owner(uint64_t page_entry){
@@ -288,7 +372,7 @@ get_vaddr(uint64_t page_entry)
 	//Rightshift to place vaddr bits in rightmost bit positions
 	page_entry >>= TYPE_SIZE - (VADDR_LEFTBOUND - VADDR_RIGHTBOUND +1);
 
-	return page_entry;
+	return page_entry << VADDR_SHIFT;
 }
 
 /*Sets next_chunk index onto existing page_entry*/
@@ -303,14 +387,16 @@ set_vaddr(uint64_t vaddr, uint64_t page_entry)
 	// left_bits >>= VADDR_LEFTBOUND;
 	// left_bits <<= VADDR_LEFTBOUND;
 
+	KASSERT(vaddr % PAGE_SIZE == 0);
+
 	//Remove original vaddr bits and all bits left of it from page_entry
-	page_entry >>= 32;
-	page_entry <<= 32;
+	page_entry >>= VADDR_LEFTBOUND;
+	page_entry <<= VADDR_LEFTBOUND;
 	// //OR left_bits back into page_entry
 	// page_entry |= left_bits;
 
 	//OR new vaddr into page_entry
-	page_entry |= vaddr;
+	page_entry |= vaddr >> VADDR_SHIFT;
 
 	return page_entry;
 
@@ -322,6 +408,11 @@ build_page_entry(uint64_t chunk_size, uint64_t owner, bool is_free, bool is_clea
 {
 	uint64_t page_entry = 0;
 
+	COMPILE_ASSERT(PID_MAX <= OWNER_MAX);
+	KASSERT(chunk_size < (1ULL << (CHUNK_SIZE_LEFTBOUND - CHUNK_SIZE_RIGHTBOUND + 1)));
+	KASSERT(owner <= OWNER_MAX);
+	KASSERT(vaddr % PAGE_SIZE == 0);
+
 	//Move chunk_size and owner parameter values into correct bit positions
 	chunk_size <<= CHUNK_SIZE_RIGHTBOUND-1;
 	owner <<= OWNER_RIGHTBOUND-1;
@@ -358,7 +449,7 @@ build_page_entry(uint64_t chunk_size, uint64_t owner, bool is_free, bool is_clea
 		page_entry |= is_fixed_bit;
 	}
 
-	page_entry |= vaddr;
+	page_entry |= vaddr >> VADDR_SHIFT;
 
 	return page_entry;
 }
@@ -39,19 +39,32 @@
 #include <addrspace.h>
 #include <proc_syscalls.h>
 #include <signal.h>
+#include <synch.h>
 #include <vm.h>
+#include <vmtrace.h>
+#include <counter.h>
 
 struct lock *exec_lock;
-static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+static struct qspinlock coremap_lock = QSPINLOCK_INITIALIZER;
 static bool debug_mode = false;
 
-uint32_t coremap_used_pages; // Also protected from coremap_lock
 uint32_t num_fixed_pages;	// number of pages used by coremap/kernel/exception handler
+static uint32_t coremap_merged_saved;	// extra mappings of merged frames; coremap_lock
+
+/* One shootdown at a time; shootdown_sem counts the cpus that are done. */
+static struct lock *shootdown_lock;
+static struct semaphore *shootdown_sem;
 
 void
 vm_bootstrap(void)
 {
 	exec_lock = lock_create("execv_lock");
+	shootdown_lock = lock_create("shootdown");
+	shootdown_sem = sem_create("shootdown", 0);
+	if(exec_lock == NULL || shootdown_lock == NULL || shootdown_sem == NULL) {
+		panic("vm_bootstrap: Out of memory\n");
+	}
+	futex_bootstrap();
 }
 
 static
@@ -59,6 +72,24 @@ paddr_t
 get_ppn(struct addrspace *as, vaddr_t vaddr, paddr_t *ppn) {
 	
 	int32_t err;
+	struct shm_mapping *map;
+	struct pt_entry *pte;
+
+	// Shared pages come from the segment, so every mapping of it
+	// sees the same frame.
+	map = shm_lookup(as->shm, vaddr);
+	if(map != NULL) {
+		pte = pt_get_pte(as->pt, vaddr);
+		if(pte != NULL) {
+			*ppn = pte->ppn;
+			return 0;
+		}
+		err = shm_segment_getpage(map->seg, (get_vpn(vaddr) - map->start) / PAGE_SIZE, ppn);
+		if(err) {
+			return err;
+		}
+		return pt_add_frame(as, vaddr, *ppn);
+	}
 	
 	err = pt_add(as, vaddr, ppn);
 	if(err) {
@@ -81,15 +112,6 @@ tlb_set_valid(unsigned int *entry)
 	*entry |= TLBLO_VALID;
 }
 
-static
-void
-tlb_set_bitflags(unsigned int *vpn, unsigned int *ppn) {
-	tlb_set_dirty(vpn);
-	tlb_set_valid(vpn);
-	tlb_set_dirty(ppn);
-	tlb_set_valid(ppn);
-}
-
 void
 tlb_null_entry(vaddr_t vpn)
 {
@@ -110,45 +132,93 @@ tlb_null_entry(vaddr_t vpn)
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
-	(void)faulttype;
+	uint64_t trace_start;
+	bool valid;
+	int result;
+
+	trace_start = VMTRACE_FAULT_ENTER(faulttype, faultaddress);
+	counter_inc(CTR_VM_FAULTS);
 
 	struct addrspace *as = proc_getas();
 
 	if(as == NULL) {
-		return ENOMEM;
+		result = ENOMEM;
+		goto done;
 	}
 
 	int spl;
 
-	if(vaddr_in_segment(as, faultaddress)) {
+	lock_acquire(as->as_lock);
+
+	valid = vaddr_in_segment(as, faultaddress);
+	VMTRACE(VMT_REGION_LOOKUP, faultaddress, valid);
+
+	if(valid) {
 		
 		paddr_t ppn;
 		int32_t err;
+		bool writeable;
+		int index;
 
 		err = get_ppn(as, faultaddress, &ppn);
 		if(err) {
-			// kprintf("ERROR: get_ppn failed in vm_fault!\n");
-			return ENOMEM;
+			result = ENOMEM;
+			goto unlock;
+		}
+
+		// Merged pages are mapped read-only; a write gets its own copy.
+		writeable = !page_is_merged(ppn);
+		if(!writeable && faulttype != VM_FAULT_READ) {
+			err = pt_break_cow(as, faultaddress, &ppn);
+			if(err) {
+				result = ENOMEM;
+				goto unlock;
+			}
+			writeable = true;
 		}
 
 		vaddr_t vpn = get_vpn(faultaddress);
-		tlb_set_bitflags(&vpn, &ppn);
+		tlb_set_valid(&vpn);
+		tlb_set_dirty(&vpn);
+		tlb_set_valid(&ppn);
+		if(writeable) {
+			tlb_set_dirty(&ppn);
+		}
 
 		spl = splhigh();
-		// Might want to put an else here to replace the old with the new,
-		// but why would a vm_fault be triggered if the vpn was already
-		// in the TLB?
-		if(tlb_probe(vpn, 0) < 0) {
+		// Replace any existing (read-only) entry for this page
+		index = tlb_probe(vpn, 0);
+		if(index >= 0) {
+			tlb_write(vpn, ppn, index);
+		} else {
 			tlb_random(vpn, ppn);
 		}
 		splx(spl);
+		VMTRACE(VMT_TLB_INSERT, get_vpn(faultaddress), faulttype);
 
 	} else {
-		// kprintf("ERROR: SEGFAULT in vm_fault! faultaddress: %x\n", faultaddress);
-		return EFAULT;
+		result = EFAULT;
+		goto unlock;
 	}
 
-	return 0;
+	result = 0;
+ unlock:
+	lock_release(as->as_lock);
+ done:
+	VMTRACE_FAULT_EXIT(faulttype, faultaddress, trace_start, result);
+	return result;
+}
+
+/*
+ * Pages in use: the ones set up at boot, plus the count of
+ * allocations less frees since. The count is per-cpu, so this
+ * needn't take coremap_lock, and may be a little stale.
+ */
+static
+uint32_t
+coremap_pages_used(void)
+{
+	return num_fixed_pages + (uint32_t)counter_read(CTR_PAGES_USED);
 }
 
 /*
@@ -158,7 +228,7 @@ static
 void
 print_coremap(void) 
 {
-	kprintf("\nPrinting coremap, num_pages used = %u :\n", coremap_used_pages);
+	kprintf("\nPrinting coremap, num_pages used = %u :\n", coremap_pages_used());
 	
 	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
 	for(uint32_t offset = 0; offset < coremap_size; offset++) {
@@ -245,8 +315,8 @@ alloc_pages(unsigned npages, bool is_fixed, paddr_t *ppn, vaddr_t vpn, pid_t own
 	uint32_t first_index = 0;
 	bool found_pages = false;
 
-	spinlock_acquire(&coremap_lock);
-	if(debug_mode && coremap_used_pages > 75) {
+	qspinlock_acquire(&coremap_lock);
+	if(debug_mode && coremap_pages_used() > 75) {
 		kprintf("Entering alloc_kpages.\n");
 		print_coremap();
 	}
@@ -254,7 +324,7 @@ alloc_pages(unsigned npages, bool is_fixed, paddr_t *ppn, vaddr_t vpn, pid_t own
 	found_pages = find_pages(&first_index, coremap, npages);
 
 	if(!found_pages) {
-		spinlock_release(&coremap_lock);
+		qspinlock_release(&coremap_lock);
 		return 0;
 	}
 
@@ -269,20 +339,19 @@ alloc_pages(unsigned npages, bool is_fixed, paddr_t *ppn, vaddr_t vpn, pid_t own
 
 	uint64_t first_entry = build_page_entry(npages, own_pid, false, false, true, is_fixed, virtual_address);
 	coremap[first_index] = first_entry;
-	coremap_used_pages++;
 
 	// Set additional coremap entries (if more than one)
 	uint64_t mid_entry = build_page_entry(npages, own_pid, false, false, false, is_fixed, virtual_address);
 	for(uint64_t entry = 1; entry < npages; entry++) {
 		coremap[first_index + entry] = mid_entry;
-		coremap_used_pages++;
 	}
+	counter_add(CTR_PAGES_USED, npages);
 
-	if(debug_mode && coremap_used_pages > 75) {
+	if(debug_mode && coremap_pages_used() > 75) {
 		kprintf("\nLeaving alloc_kpages\n");
 	}
 	
-	spinlock_release(&coremap_lock);
+	qspinlock_release(&coremap_lock);
 
 	return virtual_address;
 }
@@ -305,6 +374,206 @@ alloc_upages(unsigned npages, vaddr_t vpn, pid_t own_pid)
 	return ppn;
 }
 
+/*
+ * Allocate a zeroed frame that belongs to no single process. It
+ * starts with one reference, held by the caller.
+ */
+paddr_t
+alloc_shared_page(void)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	paddr_t ppn = 0;
+	vaddr_t ret;
+
+	ret = alloc_pages(1, false, &ppn, 0, 0);
+	if(ret == 0) {
+		return 0;
+	}
+
+	/* Nobody else can see the frame yet, so this can't race. */
+	qspinlock_acquire(&coremap_lock);
+	coremap[ppn / PAGE_SIZE] = set_refcount(1, coremap[ppn / PAGE_SIZE]);
+	qspinlock_release(&coremap_lock);
+
+	bzero((void *)PADDR_TO_KVADDR(ppn), PAGE_SIZE);
+	return ppn;
+}
+
+bool
+page_is_shared(paddr_t ppn)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	uint32_t index = ppn / PAGE_SIZE;
+	bool shared;
+
+	KASSERT(ppn % PAGE_SIZE == 0);
+	KASSERT(index < coremap_size);
+
+	qspinlock_acquire(&coremap_lock);
+	shared = get_refcount(coremap[index]) > 0;
+	qspinlock_release(&coremap_lock);
+
+	return shared;
+}
+
+/*
+ * Take another reference to a shared frame. Fails if the count would
+ * overflow.
+ */
+int
+page_incref(paddr_t ppn)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	uint32_t index = ppn / PAGE_SIZE;
+	uint64_t refcount;
+
+	KASSERT(ppn % PAGE_SIZE == 0);
+	KASSERT(index < coremap_size);
+
+	qspinlock_acquire(&coremap_lock);
+	refcount = get_refcount(coremap[index]);
+	KASSERT(refcount > 0);
+	if(refcount == REFCOUNT_MAX) {
+		qspinlock_release(&coremap_lock);
+		return ENOMEM;
+	}
+	coremap[index] = set_refcount(refcount + 1, coremap[index]);
+	if(get_is_merged(coremap[index])) {
+		coremap_merged_saved++;
+	}
+	qspinlock_release(&coremap_lock);
+
+	return 0;
+}
+
+/*
+ * Drop a reference to a shared frame, freeing it with the last one.
+ */
+void
+page_decref(paddr_t ppn)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	uint32_t index = ppn / PAGE_SIZE;
+	uint64_t refcount;
+
+	KASSERT(ppn % PAGE_SIZE == 0);
+	KASSERT(index < coremap_size);
+
+	qspinlock_acquire(&coremap_lock);
+	refcount = get_refcount(coremap[index]);
+	KASSERT(refcount > 0);
+	KASSERT(!get_is_fixed(coremap[index]));
+	if(refcount == 1) {
+		coremap[index] = 0;
+		counter_add(CTR_PAGES_USED, -1);
+	} else {
+		coremap[index] = set_refcount(refcount - 1, coremap[index]);
+		if(get_is_merged(coremap[index])) {
+			coremap_merged_saved--;
+		}
+	}
+	qspinlock_release(&coremap_lock);
+}
+
+bool
+page_is_merged(paddr_t ppn)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	uint32_t index = ppn / PAGE_SIZE;
+	bool merged;
+
+	KASSERT(ppn % PAGE_SIZE == 0);
+	KASSERT(index < coremap_size);
+
+	qspinlock_acquire(&coremap_lock);
+	merged = get_is_merged(coremap[index]);
+	qspinlock_release(&coremap_lock);
+
+	return merged;
+}
+
+/*
+ * Take a reference to ppn if it is (still) a merged frame with room
+ * for another reference. Used by the scanner, whose pointers to
+ * merged frames don't hold references.
+ */
+bool
+page_ref_if_merged(paddr_t ppn)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	uint32_t index = ppn / PAGE_SIZE;
+	uint64_t refcount;
+	bool ret = false;
+
+	KASSERT(ppn % PAGE_SIZE == 0);
+	KASSERT(index < coremap_size);
+
+	qspinlock_acquire(&coremap_lock);
+	refcount = get_refcount(coremap[index]);
+	if(get_is_merged(coremap[index]) && refcount > 0 && refcount < REFCOUNT_MAX) {
+		coremap[index] = set_refcount(refcount + 1, coremap[index]);
+		coremap_merged_saved++;
+		ret = true;
+	}
+	qspinlock_release(&coremap_lock);
+
+	return ret;
+}
+
+/*
+ * Turn a private frame into a merged frame with one reference (the
+ * owner's existing mapping). Other identical pages can then be
+ * pointed at it with page_incref.
+ */
+void
+page_make_merged(paddr_t ppn, pid_t owner, vaddr_t vpn)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	uint32_t index = ppn / PAGE_SIZE;
+	uint64_t entry;
+
+	KASSERT(ppn % PAGE_SIZE == 0);
+	KASSERT(index < coremap_size);
+
+	qspinlock_acquire(&coremap_lock);
+	entry = coremap[index];
+	KASSERT(get_refcount(entry) == 0);
+	KASSERT((pid_t)get_owner(entry) == owner);
+	KASSERT((vaddr_t)get_vaddr(entry) == vpn);
+
+	entry = build_page_entry(1, 0, false, false, true, false, PADDR_TO_KVADDR(ppn));
+	entry = set_refcount(1, entry);
+	entry = set_is_merged(true, entry);
+	coremap[index] = entry;
+	qspinlock_release(&coremap_lock);
+}
+
+/*
+ * If the caller holds the only reference to a merged frame, give it
+ * back to the caller as an ordinary private frame and return true.
+ * Otherwise return false and leave the frame alone.
+ */
+bool
+page_unmerge(paddr_t ppn, pid_t owner, vaddr_t vpn)
+{
+	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
+	uint32_t index = ppn / PAGE_SIZE;
+	bool ret = false;
+
+	KASSERT(ppn % PAGE_SIZE == 0);
+	KASSERT(index < coremap_size);
+
+	qspinlock_acquire(&coremap_lock);
+	KASSERT(get_is_merged(coremap[index]));
+	if(get_refcount(coremap[index]) == 1) {
+		coremap[index] = build_page_entry(1, owner, false, false, true, false, vpn);
+		ret = true;
+	}
+	qspinlock_release(&coremap_lock);
+
+	return ret;
+}
+
 static
 void
 free_pages(vaddr_t addr, pid_t owner)
@@ -313,10 +582,10 @@ free_pages(vaddr_t addr, pid_t owner)
 	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
 	bool not_found = false;
 
-	spinlock_acquire(&coremap_lock);
+	qspinlock_acquire(&coremap_lock);
 
-	if(debug_mode && coremap_used_pages > 75) {
-		kprintf("Entering free_kpages.\ncoremap_used_pages: %u\n", coremap_used_pages);
+	if(debug_mode && coremap_pages_used() > 75) {
+		kprintf("Entering free_kpages.\ncoremap pages used: %u\n", coremap_pages_used());
 	}
 
 	for(uint32_t entry = num_fixed_pages; entry < coremap_size; entry++) {
@@ -330,8 +599,8 @@ free_pages(vaddr_t addr, pid_t owner)
 
 			for(uint32_t chunk = 0; chunk < chunk_size; chunk++) {
 				coremap[entry + chunk] = 0;
-				coremap_used_pages--;
 			}
+			counter_add(CTR_PAGES_USED, -(int64_t)chunk_size);
 
 			break;
 		}
@@ -341,11 +610,11 @@ free_pages(vaddr_t addr, pid_t owner)
 		}
 	}
 
-	if(debug_mode && coremap_used_pages > 75) {
-		kprintf("Leaving free_kpages.\ncoremap_used_pages: %u\n", coremap_used_pages);
+	if(debug_mode && coremap_pages_used() > 75) {
+		kprintf("Leaving free_kpages.\ncoremap pages used: %u\n", coremap_pages_used());
 	}
 
-	spinlock_release(&coremap_lock);
+	qspinlock_release(&coremap_lock);
 	
 	if(not_found) {
 		panic("free_pages was unable to find the address passed!\n");
@@ -358,7 +627,7 @@ free_page_at_index(size_t index, pid_t owner, vaddr_t vpn)
 	KASSERT(coremap_paddr % PAGE_SIZE == 0);
 	uint64_t *coremap = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
 
-	spinlock_acquire(&coremap_lock);
+	qspinlock_acquire(&coremap_lock);
 
 	uint64_t entry = coremap[index];
 
@@ -371,9 +640,9 @@ free_page_at_index(size_t index, pid_t owner, vaddr_t vpn)
 	KASSERT((pid_t)get_owner(entry) != 0);
 
 	coremap[index] = 0;
-	coremap_used_pages--;
+	counter_add(CTR_PAGES_USED, -1);
 
-	spinlock_release(&coremap_lock);
+	qspinlock_release(&coremap_lock);
 }
 
 
@@ -392,15 +661,72 @@ free_upages(vaddr_t addr, pid_t owner)
 unsigned
 int
 coremap_used_bytes() {
-	spinlock_acquire(&coremap_lock);
-	unsigned int bytes = coremap_used_pages * PAGE_SIZE;
-	spinlock_release(&coremap_lock);
-	return bytes;
+	return coremap_pages_used() * PAGE_SIZE;
+}
+
+/*
+ * Print VM statistics.
+ */
+void
+vm_printstats(void)
+{
+	uint32_t used, saved;
+
+	used = coremap_pages_used();
+	qspinlock_acquire(&coremap_lock);
+	saved = coremap_merged_saved;
+	qspinlock_release(&coremap_lock);
+
+	kprintf("Physical pages: %u total, %u in use, %u fixed\n",
+		coremap_size, used, num_fixed_pages);
+	kprintf("Same-page merging: %s, %u pages merged, %u pages (%u bytes) saved\n",
+		ksm_enabled ? "on" : "off", ksm_pages_merged,
+		saved, saved * PAGE_SIZE);
 }
 
 void
 vm_tlbshootdown(const struct tlbshootdown *ts)
 {
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+	counter_inc(CTR_TLB_SHOOTDOWNS);
+	tlb_null_entry(ts->ts_vaddr);
+	V(ts->ts_done);
+}
+
+/*
+ * Invalidate a page's translation on every cpu, and wait until it's
+ * done. The caller should hold the address space lock so the page
+ * can't be faulted back in behind its back.
+ *
+ * Interrupts stay off while the requests go out so we can't migrate
+ * and miss the cpu we started on.
+ */
+void
+vm_tlbshootdown_all(vaddr_t vpn)
+{
+	struct tlbshootdown ts;
+	struct cpu *c;
+	unsigned i, sent = 0;
+	int spl;
+
+	lock_acquire(shootdown_lock);
+
+	ts.ts_vaddr = vpn;
+	ts.ts_done = shootdown_sem;
+
+	spl = splhigh();
+	tlb_null_entry(vpn);
+	for(i = 0; i < num_cpus; i++) {
+		c = cpu_lookup(i);
+		if(c != curcpu->c_self) {
+			ipi_tlbshootdown(c, &ts);
+			sent++;
+		}
+	}
+	splx(spl);
+
+	for(; sent > 0; sent--) {
+		P(shootdown_sem);
+	}
+
+	lock_release(shootdown_lock);
 }
\ No newline at end of file
@@ -40,7 +40,6 @@ static paddr_t lastpaddr;   /* one past end of last free physical page */
 
 paddr_t coremap_paddr;		//Marks starting address of coremap. Should never change after first assignment.
 uint32_t coremap_size;
-uint32_t coremap_used_pages;
 uint32_t num_fixed_pages;
 
 static
@@ -65,11 +64,9 @@ setup_coremap(void)
 
 	uint64_t *cm_addr = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr);
 	cm_addr[0] = first_entry;
-	coremap_used_pages++;
 
 	for(uint64_t entry = 1; entry < num_kern_pages; entry++) {
 		cm_addr[entry] = mid_entry;
-		coremap_used_pages++;
 	}
 
 	/*
@@ -87,11 +84,9 @@ setup_coremap(void)
 
 	cm_addr = (uint64_t *) PADDR_TO_KVADDR(coremap_paddr + ((uint32_t)num_kern_pages) * sizeof(uint64_t));
 	cm_addr[0] = first_entry;
-	coremap_used_pages++;
 
 	for(uint64_t entry = 1; entry < num_cm_pages; entry++) {
 		cm_addr[entry] = mid_entry;
-		coremap_used_pages++;
 	}
 }
 
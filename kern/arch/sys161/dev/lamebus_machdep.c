@@ -53,12 +53,21 @@
  */
 #define CPU_FREQUENCY 25000000 /* 25 MHz */
 
+/* CPU cycles per hardclock */
+#define TIMER_PERIOD (CPU_FREQUENCY / HZ)
+
+/* Wiring of LAMEbus interrupts to bits in the cause register */
+#define LAMEBUS_IRQ_BIT  0x00000400	/* all system bus slots */
+#define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
+#define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
+
 /*
  * Access to the on-chip timer.
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted and c0_count starts over from 0. Writing to c0_compare
+ * again clears the interrupt.
  */
 static
 void
@@ -76,6 +85,51 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/* Read c0_count ($9). */
+static
+uint32_t
+mips_timer_getcount(void)
+{
+	uint32_t count;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
+/* Write c0_count ($9). */
+static
+void
+mips_timer_setcount(uint32_t count)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mtc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		:: "r" (count));
+}
+
+/* Read c0_cause ($13), to see what interrupts are pending. */
+static
+uint32_t
+mips_getcause(void)
+{
+	uint32_t cause;
+
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $13;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (cause));
+	return cause;
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -116,7 +170,7 @@ mainbus_bootstrap(void)
 	/*
 	 * Configure the MIPS on-chip timer to interrupt HZ times a second.
 	 */
-	mips_timer_set(CPU_FREQUENCY / HZ);
+	mips_timer_set(TIMER_PERIOD);
 }
 
 /*
@@ -276,6 +330,49 @@ mainbus_send_ipi(struct cpu *target)
 	lamebus_assert_ipi(lamebus, target);
 }
 
+/*
+ * Tickless idle: push this cpu's next timer interrupt out to the
+ * end of the TICKS'th hardclock period from the last one, keeping the
+ * phase. Fails if a timer interrupt is already pending, since
+ * writing c0_compare would lose it. Interrupts must be off.
+ */
+bool
+mainbus_timer_stretch(unsigned ticks)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(ticks > 0 && ticks <= 0xffffffffU / TIMER_PERIOD);
+
+	if (mips_getcause() & MIPS_TIMER_BIT) {
+		return false;
+	}
+	mips_timer_set(ticks * TIMER_PERIOD);
+	return true;
+}
+
+/*
+ * Undo mainbus_timer_stretch(TICKS) and go back to one interrupt per
+ * hardclock, in the same phase. Returns the number of hardclock
+ * periods that ended in the meantime. If the stretched interrupt
+ * came due but hasn't been taken, that's all TICKS of them and then
+ * some; rewriting c0_compare clears it, since it's accounted for.
+ */
+unsigned
+mainbus_timer_restore(unsigned ticks)
+{
+	uint32_t count;
+	unsigned passed;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	count = mips_timer_getcount();
+	passed = (mips_getcause() & MIPS_TIMER_BIT) ? ticks : 0;
+	passed += count / TIMER_PERIOD;
+
+	mips_timer_setcount(count % TIMER_PERIOD);
+	mips_timer_set(TIMER_PERIOD);
+	return passed;
+}
+
 /*
  * Trigger the debugger.
  */
@@ -289,11 +386,6 @@ mainbus_debugger(void)
  * Interrupt dispatcher.
  */
 
-/* Wiring of LAMEbus interrupts to bits in the cause register */
-#define LAMEBUS_IRQ_BIT  0x00000400	/* all system bus slots */
-#define LAMEBUS_IPI_BIT  0x00000800	/* inter-processor interrupt */
-#define MIPS_TIMER_BIT   0x00008000	/* on-chip timer */
-
 void
 mainbus_interrupt(struct trapframe *tf)
 {
@@ -309,13 +401,18 @@ mainbus_interrupt(struct trapframe *tf)
 		seen = true;
 	}
 	if (cause & LAMEBUS_IPI_BIT) {
-		interprocessor_interrupt();
+		/*
+		 * Clear first: ipi_send only raises the interrupt when
+		 * nothing is pending, so one raised while we handle
+		 * this one must not be cleared after the fact.
+		 */
 		lamebus_clear_ipi(lamebus, curcpu);
+		interprocessor_interrupt();
 		seen = true;
 	}
 	if (cause & MIPS_TIMER_BIT) {
 		/* Reset the timer (this clears the interrupt) */
-		mips_timer_set(CPU_FREQUENCY / HZ);
+		mips_timer_set(TIMER_PERIOD);
 		/* and call hardclock */
 		hardclock();
 		seen = true;
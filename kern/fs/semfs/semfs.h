@@ -55,6 +55,7 @@ struct semfs_sem {
 	struct lock *sems_lock;			/* Lock to protect count */
 	struct cv *sems_cv;			/* CV to wait */
 	unsigned sems_count;			/* Semaphore count */
+	unsigned sems_waiters;			/* Unsignaled sleepers */
 	bool sems_hasvnode;			/* The vnode exists */
 	bool sems_linked;			/* In the directory */
 };
@@ -89,7 +90,7 @@ struct semfs_vnode {
 struct semfs {
 	struct fs semfs_absfs;			/* Abstract fs object */
 
-	struct lock *semfs_tablelock;		/* Lock for following */
+	struct brlock *semfs_tablelock;		/* Lock for following */
 	struct vnodearray *semfs_vnodes;	/* Currently extant vnodes */
 	struct semfs_semarray *semfs_sems;	/* Semaphores */
 
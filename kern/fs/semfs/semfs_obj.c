@@ -63,6 +63,7 @@ semfs_sem_create(const char *name)
 		goto fail_lock;
 	}
 	sem->sems_count = 0;
+	sem->sems_waiters = 0;
 	sem->sems_hasvnode = false;
 	sem->sems_linked = false;
 	return sem;
@@ -94,7 +95,7 @@ semfs_sem_insert(struct semfs *semfs, struct semfs_sem *sem, unsigned *ret)
 {
 	unsigned i, num;
 
-	KASSERT(lock_do_i_hold(semfs->semfs_tablelock));
+	KASSERT(brlock_do_i_hold_write(semfs->semfs_tablelock));
 	num = semfs_semarray_num(semfs->semfs_sems);
 	if (num == SEMFS_ROOTDIR) {
 		/* Too many */
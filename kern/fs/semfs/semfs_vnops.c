@@ -116,9 +116,10 @@ semfs_getsembynum(struct semfs *semfs, unsigned semnum)
 {
 	struct semfs_sem *sem;
 
-	lock_acquire(semfs->semfs_tablelock);
+	/* Every P and V comes through here, so only read-lock. */
+	brlock_acquire_read(semfs->semfs_tablelock);
 	sem = semfs_semarray_get(semfs->semfs_sems, semnum);
-	lock_release(semfs->semfs_tablelock);
+	brlock_release_read(semfs->semfs_tablelock);
 
 	return sem;
 }
@@ -133,23 +134,24 @@ semfs_getsem(struct semfs_vnode *semv)
 }
 
 /*
- * Wakeup helper. We only need to wake up if there are sleepers, which
- * should only be the case if the old count is 0; and we only
- * potentially need to wake more than one sleeper if the new count
- * will be more than 1.
+ * Wakeup helper. Each unit the count goes up by lets one more sleeper
+ * proceed, so signal that many, or as many as are sleeping if fewer.
+ * Waking any more would only send them back to sleep.
  */
 static
 void
 semfs_wakeup(struct semfs_sem *sem, unsigned newcount)
 {
-	if (sem->sems_count > 0 || newcount == 0) {
+	unsigned n;
+
+	if (newcount <= sem->sems_count) {
 		return;
 	}
-	if (newcount == 1) {
+	n = newcount - sem->sems_count;
+	while (n > 0 && sem->sems_waiters > 0) {
 		cv_signal(sem->sems_cv, sem->sems_lock);
-	}
-	else {
-		cv_broadcast(sem->sems_cv, sem->sems_lock);
+		sem->sems_waiters--;
+		n--;
 	}
 }
 
@@ -215,6 +217,7 @@ semfs_read(struct vnode *vn, struct uio *uio)
 		if (sem->sems_count == 0) {
 			DEBUG(DB_SEMFS, "semfs: sem%u: blocking\n",
 			      semv->semv_semnum);
+			sem->sems_waiters++;
 			cv_wait(sem->sems_cv, sem->sems_lock);
 		}
 	}
@@ -416,9 +419,9 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
 		result = ENOMEM;
 		goto fail_unlock;
 	}
-	lock_acquire(semfs->semfs_tablelock);
+	brlock_acquire_write(semfs->semfs_tablelock);
 	result = semfs_sem_insert(semfs, sem, &semnum);
-	lock_release(semfs->semfs_tablelock);
+	brlock_release_write(semfs->semfs_tablelock);
 	if (result) {
 		goto fail_uncreate;
 	}
@@ -453,9 +456,9 @@ semfs_creat(struct vnode *dirvn, const char *name, bool excl, mode_t mode,
  fail_undent:
 	semfs_direntry_destroy(dent);
  fail_uninsert:
-	lock_acquire(semfs->semfs_tablelock);
+	brlock_acquire_write(semfs->semfs_tablelock);
 	semfs_semarray_set(semfs->semfs_sems, semnum, NULL);
-	lock_release(semfs->semfs_tablelock);
+	brlock_release_write(semfs->semfs_tablelock);
  fail_uncreate:
 	semfs_sem_destroy(sem);
  fail_unlock:
@@ -496,10 +499,10 @@ semfs_remove(struct vnode *dirvn, const char *name)
 			KASSERT(sem->sems_linked);
 			sem->sems_linked = false;
 			if (sem->sems_hasvnode == false) {
-				lock_acquire(semfs->semfs_tablelock);
+				brlock_acquire_write(semfs->semfs_tablelock);
 				semfs_semarray_set(semfs->semfs_sems,
 						   dent->semd_semnum, NULL);
-				lock_release(semfs->semfs_tablelock);
+				brlock_release_write(semfs->semfs_tablelock);
 				lock_release(sem->sems_lock);
 				semfs_sem_destroy(sem);
 			}
@@ -601,7 +604,7 @@ semfs_reclaim(struct vnode *vn)
 	struct semfs_sem *sem;
 	unsigned i, num;
 
-	lock_acquire(semfs->semfs_tablelock);
+	brlock_acquire_write(semfs->semfs_tablelock);
 
 	/* vnode refcount is protected by the vnode's ->vn_countlock */
 	spinlock_acquire(&vn->vn_countlock);
@@ -610,7 +613,7 @@ semfs_reclaim(struct vnode *vn)
 		vn->vn_refcount--;
 
 		spinlock_release(&vn->vn_countlock);
-		lock_release(semfs->semfs_tablelock);
+		brlock_release_write(semfs->semfs_tablelock);
 		return EBUSY;
 	}
 
@@ -638,7 +641,7 @@ semfs_reclaim(struct vnode *vn)
 	}
 
 	/* done with the table */
-	lock_release(semfs->semfs_tablelock);
+	brlock_release_write(semfs->semfs_tablelock);
 
 	/* destroy it */
 	semfs_vnode_destroy(semv);
@@ -759,7 +762,7 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 	int result;
 
 	/* Lock the vnode table */
-	lock_acquire(semfs->semfs_tablelock);
+	brlock_acquire_write(semfs->semfs_tablelock);
 
 	/* Look for it */
 	num = vnodearray_num(semfs->semfs_vnodes);
@@ -768,7 +771,7 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		semv = vn->vn_data;
 		if (semv->semv_semnum == semnum) {
 			VOP_INCREF(vn);
-			lock_release(semfs->semfs_tablelock);
+			brlock_release_write(semfs->semfs_tablelock);
 			*ret = vn;
 			return 0;
 		}
@@ -777,13 +780,13 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 	/* Make it */
 	semv = semfs_vnode_create(semfs, semnum);
 	if (semv == NULL) {
-		lock_release(semfs->semfs_tablelock);
+		brlock_release_write(semfs->semfs_tablelock);
 		return ENOMEM;
 	}
 	result = vnodearray_add(semfs->semfs_vnodes, &semv->semv_absvn, NULL);
 	if (result) {
 		semfs_vnode_destroy(semv);
-		lock_release(semfs->semfs_tablelock);
+		brlock_release_write(semfs->semfs_tablelock);
 		return ENOMEM;
 	}
 	if (semnum != SEMFS_ROOTDIR) {
@@ -792,7 +795,7 @@ semfs_getvnode(struct semfs *semfs, unsigned semnum, struct vnode **ret)
 		KASSERT(sem->sems_hasvnode == false);
 		sem->sems_hasvnode = true;
 	}
-	lock_release(semfs->semfs_tablelock);
+	brlock_release_write(semfs->semfs_tablelock);
 
 	*ret = &semv->semv_absvn;
 	return 0;
@@ -35,7 +35,9 @@
  */
 
 
+#include <spinlock.h>
 #include <vm.h>
+#include <uthread.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
@@ -57,13 +59,25 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
+        struct lock *as_lock;           /* protects pt and shm */
+        unsigned as_refcount;           /* see as_incref */
         struct pagetable *pt;
         struct region_list *regions;
         vaddr_t heap_start;
         size_t heap_size;
         vaddr_t stack_start;
         size_t stack_size;
+        uint32_t as_tstacks;            /* thread stack slots in use */
+        struct shm_list *shm;           /* MAP_SHARED mappings */
+        vaddr_t shm_bottom;             /* lowest shared mapping */
         pid_t as_pid;
+
+        /* TLB working set, saved at switch-out; see as_tlbsave */
+        struct spinlock as_tlblock;     /* protects the fields below */
+        unsigned as_tlbfrozen;          /* shootdowns in progress */
+        unsigned as_ntlbsaved;
+        uint32_t as_tlbhi[TLBWS_MAX];
+        uint32_t as_tlblo[TLBWS_MAX];
 #endif
 };
 
@@ -83,13 +97,25 @@ struct addrspace {
  *    as_activate - make curproc's address space the one currently
  *                "seen" by the processor.
  *
+ *    as_tlbsave - remember the translations of curproc's address space
+ *                that are in the TLB, so as_activate can load them
+ *                back when the process next runs.
+ *
+ *    as_shootdown - remove a page's translation from every cpu's TLB
+ *                and from the saved working set.
+ *
  *    as_deactivate - unload curproc's address space so it isn't
  *                currently "seen" by the processor. This is used to
  *                avoid potentially "seeing" it while it's being
  *                destroyed.
  *
- *    as_destroy - dispose of an address space. You may need to change
- *                the way this works if implementing user-level threads.
+ *    as_destroy - drop a reference to an address space, disposing of
+ *                it with the last one. The creator holds the first
+ *                reference.
+ *
+ *    as_incref - take another reference, so an address space can be
+ *                used from another thread (e.g. the page merging
+ *                scanner) without it going away underneath.
  *
  *    as_define_region - set up a region of memory within the address
  *                space.
@@ -104,6 +130,11 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_define_tstack - set up the stack for user thread SLOT, and
+ *                hand back its initial stack pointer.
+ *
+ *    as_release_tstack - throw away the stack of user thread SLOT.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -111,8 +142,11 @@ struct addrspace {
 struct addrspace *as_create(void);
 int               as_copy(struct addrspace *src, struct addrspace **ret, pid_t new_pid);
 void              as_activate(void);
+void              as_tlbsave(void);
+void              as_shootdown(struct addrspace *as, vaddr_t vpn);
 void              as_deactivate(void);
 void              as_destroy(struct addrspace *);
+void              as_incref(struct addrspace *);
 
 int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
@@ -122,9 +156,25 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_tstack(struct addrspace *as, unsigned slot,
+                                   vaddr_t *initstackptr);
+void              as_release_tstack(struct addrspace *as, unsigned slot);
 bool              vaddr_in_segment(struct addrspace *as, vaddr_t vaddr);
 bool              page_still_needed(struct addrspace *as, vaddr_t vaddr);
 int               as_clean_segments(struct addrspace *as);
+int               as_map_shared(struct addrspace *as, size_t len,
+                                vaddr_t *ret);
+int               as_unmap_shared(struct addrspace *as, vaddr_t vaddr,
+                                  size_t len);
+
+/*
+ *  User thread stacks. Below the first thread's stack is room for
+ *  UTHREAD_MAX-1 more, TSTACK_PAGES each, slot 1 highest. The bottom
+ *  page of each is never mapped, so running off the end faults
+ *  instead of scribbling on the next one. Shared mappings go below.
+ */
+#define TSTACK_PAGES 64
+#define TSTACK_SIZE  (TSTACK_PAGES * PAGE_SIZE)
 
 /*
  *  Supporting structure for addrspace struct. Essentially a LinkedList to
@@ -158,6 +208,45 @@ struct mem_region *mem_region_create(void);
 void mem_region_destroy(struct mem_region *);
 int region_copy(struct mem_region *, struct mem_region **);
 
+/*
+ *  Shared anonymous memory (mmap with MAP_SHARED|MAP_ANON).
+ *
+ *  A shm_segment is a run of pages that may be mapped into several
+ *  address spaces; fork gives the child another mapping of the same
+ *  segment. The segment holds a reference to each of its frames
+ *  (allocated on first touch), each page table entry that maps one
+ *  holds another, and each mapping holds a reference to the segment.
+ */
+struct shm_segment {
+  struct lock *seg_lock;
+  unsigned seg_refcount;      /* protected by seg_lock */
+  size_t seg_npages;
+  paddr_t *seg_frames;        /* 0 until first touched */
+};
+
+struct shm_mapping {
+  struct shm_mapping *next;
+  vaddr_t start;
+  size_t npages;
+  struct shm_segment *seg;
+};
+
+struct shm_list {
+  struct shm_mapping *head;
+};
+
+struct shm_segment *shm_segment_create(size_t npages);
+void shm_segment_incref(struct shm_segment *);
+void shm_segment_decref(struct shm_segment *);
+int shm_segment_getpage(struct shm_segment *, size_t index, paddr_t *ret);
+
+struct shm_list *shm_list_create(void);
+void shm_list_destroy(struct shm_list *);
+int shm_list_copy(struct shm_list *old, struct shm_list *newlist);
+int shm_list_add(struct shm_list *, vaddr_t start, struct shm_segment *);
+struct shm_mapping *shm_lookup(struct shm_list *, vaddr_t);
+struct shm_mapping *shm_list_remove(struct shm_list *, vaddr_t start);
+
 /*
  *  Supporting virtual memory structure for addrspace struct. Essentially a LinkedList to
  *  keep track of virtual pages allocated.
@@ -172,6 +261,8 @@ struct pagetable *pt_create(void);
 int32_t pt_destroy(struct addrspace *);
 int32_t pt_copy(struct addrspace *, struct addrspace *);
 int32_t pt_add(struct addrspace *, vaddr_t, paddr_t *);
+int32_t pt_add_frame(struct addrspace *, vaddr_t, paddr_t);
+int32_t pt_break_cow(struct addrspace *, vaddr_t, paddr_t *);
 int32_t pt_create_region(struct addrspace *, struct mem_region *);
 int32_t pt_remove(struct addrspace *, vaddr_t);
 struct pt_entry *pt_get_pte(struct pagetable *, vaddr_t);
@@ -184,6 +275,7 @@ struct pt_entry
   struct pt_entry *next_entry;
   vaddr_t vpn;
   paddr_t ppn;
+  uint32_t checksum;          /* contents hash from last merge scan */
 };
 
 struct pt_entry *pte_create(void);
@@ -38,8 +38,10 @@
 
 
 /*
- * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * hardclock() is called on every CPU HZ times a second, for
+ * scheduling, except while the CPU is idle: the idle loop calls
+ * hardclock_idle() before it waits and hardclock_unidle() after, and
+ * in between the timer only interrupts when something is due.
  */
 
 /* hardclocks per second */
@@ -47,6 +49,8 @@
 
 void hardclock_bootstrap(void);
 void hardclock(void);
+void hardclock_idle(void);
+void hardclock_unidle(void);
 
 /*
  * timerclock() is called on one CPU once a second to allow simple
@@ -59,6 +63,14 @@ void timerclock(void);
  */
 void gettime(struct timespec *ret);
 
+/*
+ * clock_nsecs() returns the current time as a single count of
+ * nanoseconds. It reads the same hardware clock as gettime(), so
+ * values are comparable across CPUs; it is meant for timing
+ * measurements rather than for the time of day.
+ */
+uint64_t clock_nsecs(void);
+
 /*
  * arithmetic on times
  *
@@ -79,5 +91,43 @@ void timespec_sub(const struct timespec *t1,
  */
 void clocksleep(int seconds);
 
+/*
+ * Timeouts: call a function after a number of hardclock ticks.
+ *
+ * The caller owns the struct timeout, which must stay around until it
+ * fires or is cancelled. The function is called from the timer
+ * interrupt on cpu 0, so it must not sleep.
+ *
+ *    timeout_init - set up TO to call FN(ARG).
+ *    timeout      - arm TO to fire in TICKS ticks (at least 1). TO
+ *                   must not already be pending.
+ *    untimeout    - cancel TO. Returns true if it was still pending,
+ *                   false if it had fired (or was never armed). If
+ *                   it fired and FN is still running, waits for FN
+ *                   to return, so TO and ARG may be freed after.
+ *
+ * timeout_sleep() puts the current thread to sleep for TICKS ticks.
+ * timeout_tick() advances the timer wheel; hardclock calls it.
+ * timeout_idle() returns how many ticks cpu 0 can skip, at most MAX,
+ * before the wheel needs it, and timeout_unidle() says it's back;
+ * arming a timeout that's due sooner in between wakes it up.
+ */
+struct timeout {
+	struct timeout *to_next;	/* Link in timer wheel slot */
+	struct timeout **to_pprev;	/* Pointer to the link to us */
+	uint64_t to_expire;		/* Tick to fire at */
+	void (*to_fn)(void *);		/* Function to call */
+	void *to_arg;			/* Argument for to_fn */
+};
+
+void timeout_bootstrap(void);
+void timeout_init(struct timeout *to, void (*fn)(void *), void *arg);
+void timeout(struct timeout *to, unsigned ticks);
+bool untimeout(struct timeout *to);
+void timeout_sleep(unsigned ticks);
+void timeout_tick(void);
+unsigned timeout_idle(unsigned max);
+void timeout_unidle(void);
+
 
 #endif /* _CLOCK_H_ */
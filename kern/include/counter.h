@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _COUNTER_H_
+#define _COUNTER_H_
+
+/*
+ * Per-cpu statistics counters.
+ *
+ * Every cpu has a slot for each counter in its c_counters array. A
+ * cpu only adds to its own slots, with interrupts off for the few
+ * instructions it takes, so counting needs no lock or atomic
+ * instruction and the counters' cache lines never move between cpus.
+ * Reading a counter adds up all the cpus' slots; the total may be a
+ * little stale while other cpus are counting.
+ *
+ * A 64-bit slot takes two stores to update on a 32-bit machine, so a
+ * cpu bumps its c_countergen before and after, and readers try again
+ * if it changed (or was odd) while they were reading.
+ *
+ * Slots are signed, so a count that goes up on one cpu and down on
+ * another (pages in use, say) still adds up right.
+ *
+ * To add a counter, add it to the list below and give it a name in
+ * counter.c. The "counters" menu command prints them all.
+ *
+ *    counter_add   - add N to counter CTR on this cpu.
+ *    counter_inc   - add 1.
+ *    counter_local - this cpu's count only.
+ *    counter_cpu   - cpu C's count only.
+ *    counter_read  - the total over all cpus.
+ *    counter_print - print the totals, or cpu CPUNUM's counts if
+ *                    CPUNUM isn't -1.
+ */
+
+struct cpu;
+
+enum {
+	/* Scheduler */
+	CTR_HARDCLOCKS,			/* hardclock() calls */
+	CTR_TICKS_SKIPPED,		/* hardclocks skipped while idle */
+	CTR_SWITCHES,			/* context switches */
+	CTR_WAKEUPS,			/* woken threads run */
+	CTR_WAKEUP_NS,			/* total wakeup-to-run time */
+	CTR_PREEMPTS,			/* yields forced by hardclock */
+	CTR_MIGRATIONS,			/* threads pushed to other cpus */
+	CTR_STEALS,			/* threads pulled from other cpus */
+	CTR_REMOTE_WAKEUPS,		/* wakeups queued to other cpus */
+	CTR_WAKEQ_DRAINS,		/* nonempty wake queues emptied */
+	CTR_IPIS,			/* interprocessor interrupts sent */
+
+	/* VM */
+	CTR_PAGES_USED,			/* coremap pages in use past boot */
+	CTR_VM_FAULTS,			/* vm_fault calls */
+	CTR_TLB_SHOOTDOWNS,		/* shootdowns handled */
+
+	/* System calls */
+	CTR_SYSCALLS,			/* system calls made */
+	CTR_SYSCALL_ERRORS,		/* ...that failed */
+
+	NCOUNTERS
+};
+
+void counter_add(unsigned ctr, int64_t n);
+#define counter_inc(ctr) counter_add(ctr, 1)
+int64_t counter_local(unsigned ctr);
+int64_t counter_cpu(struct cpu *c, unsigned ctr);
+int64_t counter_read(unsigned ctr);
+void counter_print(int cpunum);
+
+#endif /* _COUNTER_H_ */
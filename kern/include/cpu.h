@@ -34,9 +34,14 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <vmtrace.h>
+#include <counter.h>
 
 extern unsigned num_cpus;
 
+/* Number of scheduler priority levels; see schedule() in thread.c */
+#define SCHED_NLEVELS	8
+
 /*
  * Per-cpu structure
  *
@@ -60,16 +65,40 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
-	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	uint64_t c_wakeup_max_ns;	/* Worst wakeup-to-run time */
+	unsigned c_tickless;		/* Ticks the idle timer skips, or 0 */
+
+	/*
+	 * Written only by this cpu, read by anyone. See counter.h.
+	 */
+	int64_t c_counters[NCOUNTERS];	/* Statistics counters */
+	volatile unsigned c_countergen;	/* Odd while a counter changes */
+
+	/*
+	 * Written by this cpu, read by the menu. Has its own lock.
+	 */
+	struct vmtrace_cpu c_vmtrace;	/* VM tracepoint records */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
-	struct spinlock c_runqueue_lock;
+	struct threadlist c_runqueue[SCHED_NLEVELS]; /* One per priority */
+	struct qspinlock c_runqueue_lock;
+
+	/*
+	 * Accessed by other cpus, without a lock.
+	 *
+	 * Threads woken by other cpus for this one are pushed onto
+	 * c_wakeq, linked through t_wakenext, with a compare-and-swap.
+	 * This cpu takes the whole list at once, under its runqueue
+	 * lock, and moves it to the run queue. A waker only interrupts
+	 * this cpu if the list was empty and the cpu idle; otherwise
+	 * someone already has, or the cpu will look on its own.
+	 */
+	struct thread *volatile c_wakeq;
 
 	/*
 	 * Accessed by other cpus.
@@ -113,6 +142,12 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Look up a cpu by software number (0 to num_cpus-1). For code that
+ * reports or resets per-cpu state.
+ */
+struct cpu *cpu_lookup(unsigned software_number);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _EPOCH_H_
+#define _EPOCH_H_
+
+/*
+ * Epochs: deferred freeing for data read without locks.
+ *
+ * A reader brackets its accesses with epoch_enter and epoch_exit.
+ * That only turns interrupts off on the current cpu, so it is cheap
+ * and doesn't touch anything shared, but the reader must not sleep
+ * in between.
+ *
+ * A writer (which still needs its own lock against other writers)
+ * unlinks an object so no new reader can find it, records
+ * epoch_current(), and frees the object once epoch_expired() of that
+ * value is true. Until then a reader that found it before the unlink
+ * may still be looking at it.
+ *
+ *    epoch_enter   - start a read section; returns a value for
+ *                    epoch_exit. Sections nest.
+ *    epoch_exit    - end it.
+ *    epoch_current - the epoch to record for an object just unlinked.
+ *    epoch_expired - true if no reader can still have an object
+ *                    unlinked in epoch E.
+ *    epoch_tick    - note that this cpu is outside any read section
+ *                    and advance the epoch if everyone has; hardclock
+ *                    calls it.
+ *    epoch_idle    - this cpu is going idle without ticks; count it
+ *                    as outside until epoch_unidle.
+ *    epoch_unidle  - it's back.
+ */
+
+int epoch_enter(void);
+void epoch_exit(int);
+unsigned epoch_current(void);
+bool epoch_expired(unsigned e);
+void epoch_tick(void);
+void epoch_idle(void);
+void epoch_unidle(void);
+
+#endif /* _EPOCH_H_ */
@@ -85,14 +85,14 @@
 #define SYS_sigreturn    32
 //#define SYS_sigaltstack 33
 //                              (resource tracking and usage)
-//#define SYS_wait4      34
+#define SYS_wait4        34
 //#define SYS_getrusage  35
 //                              (resource limits)
 //#define SYS_getrlimit  36
 //#define SYS_setrlimit  37
 //                              (process priority control)
-//#define SYS_getpriority 38
-//#define SYS_setpriority 39
+#define SYS_getpriority 38
+#define SYS_setpriority 39
 //                              (process groups, sessions, and job control)
 //#define SYS_getpgid    40
 //#define SYS_setpgid    41
@@ -196,6 +196,12 @@
 #define SYS_sync         118
 #define SYS_reboot       119
 //#define SYS___sysctl   120
+//                              (user-level synchronization)
+#define SYS_futex        121
+//                              (user-level threads)
+#define SYS___thread_create 122
+#define SYS_thread_exit  123
+#define SYS_thread_join  124
 
 /*CALLEND*/
 
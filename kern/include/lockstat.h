@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef LOCKSTAT_H
+#define LOCKSTAT_H
+
+/*
+ * Lock contention profiler. Enable with "options lockstat" in the
+ * kernel config, then turn collection on with the "lockstat on" menu
+ * command.
+ *
+ * Statistics are kept per lock class: sleep locks, semaphores and CVs
+ * are grouped by name, spinlocks by the address spinlock_acquire was
+ * called from. For each class we count acquisitions, how many of them
+ * had to wait, the total and worst wait, and the total time held.
+ * Times are in nanoseconds from clock_nsecs(), which is cycle
+ * accurate on sys161.
+ *
+ * With the option off all the hooks compile to nothing.
+ */
+
+#include "opt-lockstat.h"
+
+/* Lock kinds */
+#define LOCKSTAT_SPINLOCK	0
+#define LOCKSTAT_LOCK		1
+#define LOCKSTAT_SEM		2
+#define LOCKSTAT_CV		3
+
+#if OPT_LOCKSTAT
+
+struct lockstat_class;
+
+/*
+ * Per-lock hook: which class the current holder is charged to, and
+ * when it got the lock.
+ */
+struct lockstat_lockable {
+	struct lockstat_class *ll_class;
+	uint64_t ll_start;
+};
+
+extern volatile bool lockstat_enabled;
+
+uint64_t lockstat_now(void);
+void lockstat_acquire(struct lockstat_lockable *ll, unsigned kind,
+		      const char *name, const void *site, uint64_t waitstart);
+void lockstat_release(struct lockstat_lockable *ll);
+void lockstat_wait(unsigned kind, const char *name, uint64_t waitstart);
+
+/* Menu hooks */
+void lockstat_setenabled(bool on);
+void lockstat_reset(void);
+void lockstat_print(unsigned topn);
+
+#define LOCKSTAT_LOCKABLE(sym)	struct lockstat_lockable sym
+
+#define LOCKSTAT_LOCKABLEINIT(ll) ((ll)->ll_class = NULL, (ll)->ll_start = 0)
+
+/* Note the trailing comma; it is meant to precede the hangman hook. */
+#define LOCKSTAT_LOCKABLE_INITIALIZER	{ NULL, 0 },
+
+/*
+ * Timestamp for the start of a wait, or 0 if we aren't collecting.
+ * Pass it to LOCKSTAT_ACQUIRE or LOCKSTAT_WAIT; 0 means there was no
+ * wait.
+ */
+#define LOCKSTAT_NOW()		(lockstat_enabled ? lockstat_now() : 0)
+
+#define LOCKSTAT_ACQUIRE(ll, kind, name, site, waitstart) \
+	do { \
+		if (lockstat_enabled) { \
+			lockstat_acquire(ll, kind, name, site, waitstart); \
+		} \
+	} while (0)
+
+/* Checks ll_class rather than lockstat_enabled to match the acquire. */
+#define LOCKSTAT_RELEASE(ll) \
+	do { \
+		if ((ll)->ll_class != NULL) { \
+			lockstat_release(ll); \
+		} \
+	} while (0)
+
+#define LOCKSTAT_WAIT(kind, name, waitstart) \
+	do { \
+		if (lockstat_enabled) { \
+			lockstat_wait(kind, name, waitstart); \
+		} \
+	} while (0)
+
+#else
+
+#define LOCKSTAT_LOCKABLE(sym)
+
+#define LOCKSTAT_LOCKABLEINIT(ll)
+
+#define LOCKSTAT_LOCKABLE_INITIALIZER
+
+#define LOCKSTAT_NOW()		((uint64_t)0)
+
+/* Use waitstart so callers' timestamps don't draw unused warnings. */
+#define LOCKSTAT_ACQUIRE(ll, kind, name, site, waitstart) ((void)(waitstart))
+#define LOCKSTAT_RELEASE(ll)
+#define LOCKSTAT_WAIT(kind, name, waitstart)	((void)(waitstart))
+
+#endif
+
+#endif /* LOCKSTAT_H */
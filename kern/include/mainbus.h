@@ -55,6 +55,14 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/*
+ * Make this cpu's next timer interrupt come TICKS hardclocks from the
+ * last one instead of one, for tickless idle; false if one is already
+ * pending. Restore returns how many hardclocks went by since. (Low-level.)
+ */
+bool mainbus_timer_stretch(unsigned ticks);
+unsigned mainbus_timer_restore(unsigned ticks);
+
 /* Request breaking into the debugger, where available. */
 void mainbus_debugger(void);
 
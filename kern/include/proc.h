@@ -39,6 +39,7 @@
 #include <spinlock.h>
 #include <limits.h>
 #include <synch.h>
+#include <uthread.h>
 #include <mips/trapframe.h>
 
 struct addrspace;
@@ -61,31 +62,67 @@ void filehandle_destroy(struct filehandle *);
 /*
  * Process table structure.
  *
- * Max size is set to be the limit of the max PID defined by PID_MAX in limits.h
+ * PIDs go up to PID_MAX (see limits.h). The table is a two-level radix
+ * tree: pt_leaves[pid >> PROC_LEAF_SHIFT] is an array of the procs for
+ * PROC_LEAF_SIZE PIDs in a row. A leaf is allocated the first time one
+ * of its PIDs is handed out, and stays until the table is destroyed,
+ * so a lookup never sees one go away.
+ *
+ * pt_inuse has a bit for each PID that's taken. PIDs are handed out
+ * round robin below pt_limit, searching the bitmap a word at a time
+ * from pt_next; pt_limit doubles whenever more than 3/4 of the PIDs
+ * below it are taken. So the search stays short, and the table only
+ * grows as far as the load needs.
+ *
+ * Lookups don't lock: do them between epoch_enter and epoch_exit
+ * (see epoch.h), with proc_table_lookup, and don't sleep before you're
+ * done with the proc. Inserts and removals take pt_lock, and go
+ * through proc_table_insert and proc_table_remove. A removed proc
+ * waits on pt_retired until no lookup can still have it, and is freed
+ * by a later removal, or by proc_table_drain.
  */
 extern struct proc_table* p_table;
-extern volatile pid_t pid_counter;
+
+#define PROC_LEAF_SHIFT	8
+#define PROC_LEAF_SIZE	(1 << PROC_LEAF_SHIFT)
+#define PROC_NLEAVES	(PID_MAX / PROC_LEAF_SIZE + 1)
+#define PROC_NPIDS	(PROC_NLEAVES * PROC_LEAF_SIZE)
 
 struct proc_table {
-	struct proc* table[256];
-	struct lock* pt_lock;
+	struct proc *volatile *volatile pt_leaves[PROC_NLEAVES];
+	uint32_t pt_inuse[PROC_NPIDS / 32];	/* one bit per PID */
+	unsigned pt_count;		/* PIDs taken */
+	unsigned pt_limit;		/* PIDs are handed out below this */
+	pid_t pt_next;			/* where the next search starts */
+	struct lock *pt_lock;		/* serializes inserts and removals */
+	struct proc *pt_retired;	/* removed, oldest first */
+	struct proc **pt_retired_tail;
 };
 
 int32_t next_pid(void);
 struct proc_table *proc_table_create(void);
 void proc_table_destroy(struct proc_table *);
+int proc_table_insert(struct proc *proc);
+void proc_table_remove(struct proc *proc);
+void proc_table_drain(void);
+
+/* Find PID's process, or NULL; call inside an epoch (see above). */
+struct proc *proc_table_lookup(pid_t pid);
+
+/*
+ * Return the lowest PID above PID that's taken, or -1 if there isn't
+ * one; for walking the table. Only a hint: the process may be gone
+ * (or another one there) by the time you look it up.
+ */
+pid_t proc_table_next(pid_t pid);
 
 
 /*
  * Process structure.
  *
- * Note that we only count the number of threads in each process.
- * (And, unless you implement multithreaded user processes, this
- * number will not exceed 1 except in kproc.) If you want to know
- * exactly which threads are in the process, e.g. for debugging, add
- * an array and a sleeplock to protect it. (You can't use a spinlock
- * to protect an array because arrays need to be able to call
- * kmalloc.)
+ * p_numthreads counts every thread attached to the process. The
+ * user threads are also kept track of, by slot, in p_uthreads; see
+ * uthread.h.
  *
  * You will most likely be adding stuff to this structure, so you may
  * find you need a sleeplock in here for other reasons as well.
@@ -99,27 +136,64 @@ struct proc {
 	pid_t ppid;
 
 	struct lock *fork_lock;
-	struct semaphore *exit_sem;  /* Semaphore used by waitpid()/exit() */
 	struct spinlock p_lock;		/* Lock for this structure */
 	unsigned p_numthreads;		/* Number of threads in this process */
 
 	bool exited;
 	int exit_status;
+	bool p_waited;			/* a parent thread is reaping us */
+
+	/*
+	 * Family, under proc_family_lock. A child is on its parent's
+	 * p_children until it exits, then on p_zombies until it is
+	 * reaped; p_siblingp points at whatever points at us, so it
+	 * can unlink itself. A process whose parent exits first is
+	 * left with no parent, and reaps itself when it exits (see
+	 * proc_exited).
+	 */
+	struct proc *p_parent;
+	struct proc *p_children;	/* live children */
+	struct proc *p_zombies;		/* exited, not yet reaped */
+	struct proc *p_sibling;
+	struct proc **p_siblingp;
+	struct cv *p_childcv;		/* a child exited */
+
+	/* Process table removal (see proc_table_remove) */
+	struct proc *p_retired_next;
+	unsigned p_retired_epoch;
+
+	int p_nice;			/* setpriority value, PRIO_MIN..PRIO_MAX */
 
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
 
+	/* User threads */
+	struct lock *p_threadlock;	/* protects the fields below */
+	struct cv *p_threadcv;		/* a thread left */
+	uthread_state_t p_uthreads[UTHREAD_MAX];
+	unsigned p_nuthreads;		/* slots UT_RUNNING */
+	volatile bool p_exiting;	/* other threads should leave */
+	struct thread *p_exiter;	/* the thread that said so */
+
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
 
-	/* Since we have single threaded processes, no need to lock */
-	/* Something to keep in mind, though! */
+	/*
+	 * Open files. Threads of the process share the table, so
+	 * p_ftlock protects the slots; a thread using a handle holds
+	 * a reference to it (see filetable_get) so it can't be closed
+	 * underneath.
+	 */
+	struct lock *p_ftlock;
 	struct filehandle *filetable[64];
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
 
+/* Protects the family fields of every process. */
+extern struct lock *proc_family_lock;
+
 /* Call once during system startup to allocate data structures. */
 void proc_bootstrap(void);
 
@@ -132,6 +206,21 @@ struct proc *proc_create_child(const char *name);
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/* Make CHILD a child of PARENT. */
+void proc_addchild(struct proc *parent, struct proc *child);
+
+/* Tell the parent that PROC has exited, or reap it if there's none. */
+void proc_exited(struct proc *proc);
+
+/*
+ * Claim an exited child of the current process for reaping: PID, or
+ * any child for WAIT_ANY or WAIT_MYPGRP. Waits for one to exit unless
+ * NOHANG, in which case *RET may come back NULL. A claimed child can
+ * be given back with proc_unclaimchild.
+ */
+int proc_claimchild(pid_t pid, bool nohang, struct proc **ret);
+void proc_unclaimchild(struct proc *child);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -144,7 +233,19 @@ struct addrspace *proc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *proc_setas(struct addrspace *);
 
+/*
+ * Get a reference to the address space of process PID, if it exists
+ * and has one. Release it with as_destroy().
+ */
+struct addrspace *proc_holdas(pid_t pid);
+
 /* Copy the filetable pointers from a src process to a dest process. */
 int filetable_copy(struct proc *, struct proc *);
 
+/*
+ * Get a reference to the handle open as FD in PROC, or NULL if there
+ * isn't one. Drop it with filehandle_destroy().
+ */
+struct filehandle *filetable_get(struct proc *, int fd);
+
 #endif /* _PROC_H_ */
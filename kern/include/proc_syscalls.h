@@ -9,10 +9,19 @@ extern struct lock *exec_lock;
 void enter_forked_process(struct trapframe *, unsigned long);
 pid_t sys_fork(struct trapframe *, int32_t *);
 pid_t sys_waitpid(pid_t, userptr_t, int, int32_t *);
+int sys_wait4(pid_t, userptr_t, int, userptr_t, int32_t *);
 int sys_sbrk(intptr_t, int32_t *);
+int sys_mmap(vaddr_t, size_t, int, int, const void *, int32_t *);
+int sys_munmap(vaddr_t, size_t, int32_t *);
+int sys_futex(userptr_t, int, int, int32_t *);
+int sys___thread_create(struct trapframe *, vaddr_t, vaddr_t, vaddr_t, int32_t *);
+void sys_thread_exit(void);
+int sys_thread_join(int, int32_t *);
 void sys_exit(int);
 struct trapframe *trapframe_copy(struct trapframe *);
 void sys_getpid(int32_t *);
+int sys_getpriority(int, pid_t, int32_t *);
+int sys_setpriority(int, pid_t, int, int32_t *);
 int sys_execv(const char *, char **, int32_t *);
 int build_user_stack(char*, size_t *, size_t, userptr_t, size_t);
 
@@ -37,6 +37,7 @@
 
 #include <cdefs.h>
 #include <hangman.h>
+#include <lockstat.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -58,6 +59,7 @@
 struct spinlock {
 	volatile spinlock_data_t splk_lock; /* Memory word where we spin. */
 	struct cpu *splk_holder;	    /* CPU holding this lock. */
+	LOCKSTAT_LOCKABLE(splk_lockstat);   /* Contention profiler hook. */
 	HANGMAN_LOCKABLE(splk_hangman);     /* Deadlock detector hook. */
 };
 
@@ -66,9 +68,11 @@ struct spinlock {
  */
 #ifdef OPT_HANGMAN
 #define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKSTAT_LOCKABLE_INITIALIZER \
 				  HANGMAN_LOCKABLE_INITIALIZER }
 #else
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKSTAT_LOCKABLE_INITIALIZER }
 #endif
 
 /*
@@ -92,4 +96,41 @@ void spinlock_release(struct spinlock *lk);
 bool spinlock_do_i_hold(struct spinlock *lk);
 
 
+/*
+ * Queued (ticket) spinlock.
+ *
+ * Same rules and interface as the basic spinlock, but waiters are
+ * served in arrival order: each takes a ticket and waits until it is
+ * called. While waiting a cpu only reads the lock, and backs off in
+ * proportion to how many are ahead of it, so a contended lock costs
+ * much less bus traffic and no cpu starves. Use it for hot locks.
+ */
+struct qspinlock {
+	volatile spinlock_data_t qsl_next;    /* Next ticket to hand out. */
+	volatile spinlock_data_t qsl_serving; /* Ticket now holding the lock. */
+	struct cpu *qsl_holder;		      /* CPU holding this lock. */
+	LOCKSTAT_LOCKABLE(qsl_lockstat);      /* Contention profiler hook. */
+	HANGMAN_LOCKABLE(qsl_hangman);	      /* Deadlock detector hook. */
+};
+
+#ifdef OPT_HANGMAN
+#define QSPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKSTAT_LOCKABLE_INITIALIZER \
+				  HANGMAN_LOCKABLE_INITIALIZER }
+#else
+#define QSPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, \
+				  LOCKSTAT_LOCKABLE_INITIALIZER }
+#endif
+
+void qspinlock_init(struct qspinlock *lk);
+void qspinlock_cleanup(struct qspinlock *lk);
+
+void qspinlock_acquire(struct qspinlock *lk);
+void qspinlock_release(struct qspinlock *lk);
+
+bool qspinlock_do_i_hold(struct qspinlock *lk);
+
+
 #endif /* _SPINLOCK_H_ */
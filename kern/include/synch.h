@@ -36,12 +36,16 @@
 
 
 #include <spinlock.h>
+#include <platform/maxcpus.h>
 
 /*
  * Dijkstra-style semaphore.
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * P and V change sem_count with compare-and-swap, and only take
+ * sem_lock when P has to sleep or V might have to wake someone.
  */
 struct semaphore {
 	char *sem_name;
@@ -77,11 +81,40 @@ void V(struct semaphore *);
 struct lock {
     char *lk_name;
     HANGMAN_LOCKABLE(lk_hangman);   /* Deadlock detector hook. */
+	LOCKSTAT_LOCKABLE(lk_lockstat); /* Contention profiler hook. */
 	struct wchan *lk_wchan;
 	struct spinlock lk_spinlock;
-	struct thread *lk_thread;
+	volatile spinlock_data_t lk_owner;	/* holder | LOCK_WAITERS */
+
+	/* Priority inheritance; protected by lock_pi_lock in synch.c. */
+	struct thread *lk_piholder;	/* Whose t_pilocks it's on, or NULL */
+	struct lock *lk_pinext;		/* Next on that list */
+	unsigned lk_pilevel;		/* Best level lent through it */
 };
 
+/*
+ * lk_owner is the holding thread's address, or 0, with LOCK_WAITERS
+ * or'd in while threads are asleep in lk_wchan. An uncontended
+ * acquire or release is one compare-and-swap on it; the set bit
+ * makes release fail that and take lk_spinlock to wake someone.
+ */
+#define LOCK_WAITERS	0x1
+#define LOCK_HOLDER(lock) \
+	((struct thread *)(uintptr_t)((lock)->lk_owner & ~LOCK_WAITERS))
+
+/*
+ * If true (the default), lock_acquire spins for a while instead of
+ * sleeping when the lock's holder is running on another cpu.
+ */
+extern bool lock_spin_enabled;
+
+/*
+ * If true (the default), lock_release passes the lock straight to the
+ * thread that has waited longest, instead of freeing it and letting
+ * the woken thread race for it.
+ */
+extern bool lock_handoff_enabled;
+
 struct lock *lock_create(const char *name);
 void lock_destroy(struct lock *);
 
@@ -120,6 +153,8 @@ struct cv {
 	char *cv_name;
     struct wchan *cv_wchan;
 	struct spinlock cv_spinlock;
+	unsigned cv_nwaiters;		/* threads in cv_wchan */
+	struct lock *cv_waitlock;	/* their lock; NULL if they differ */
 };
 
 struct cv *cv_create(const char *name);
@@ -134,7 +169,10 @@ void cv_destroy(struct cv *);
  *
  * For all three operations, the current thread must hold the lock passed
  * in. Note that under normal circumstances the same lock should be used
- * on all operations with any particular CV.
+ * on all operations with any particular CV. When it is, signal and
+ * broadcast don't wake the waiters but move them to the lock's queue,
+ * since they couldn't run until it is released anyway; they then get
+ * the lock handed over one at a time.
  *
  * These operations must be atomic. You get to write them.
  */
@@ -160,11 +198,23 @@ struct rwlock {
 	bool w_exec;
 	bool w_wait;
 	volatile int r_count;
+	unsigned r_waiting;		/* readers asleep in r_wchan */
+	unsigned r_batch;		/* how many of them may pass w_wait */
+	bool rw_writerpref;
 };
 
 struct rwlock * rwlock_create(const char *);
 void rwlock_destroy(struct rwlock *);
 
+/*
+ * Preference. With writer preference (the default) new readers wait
+ * behind a waiting writer, so a stream of readers can't keep writers
+ * out. Readers aren't starved either: when a writer is done, the
+ * readers already waiting all go next, ahead of the next writer.
+ * With it off, readers only wait for a writer that holds the lock.
+ */
+void rwlock_set_writerpref(struct rwlock *, bool);
+
 /*
  * Operations:
  *    rwlock_acquire_read  - Get the lock for reading. Multiple threads can
@@ -182,4 +232,49 @@ void rwlock_release_read(struct rwlock *);
 void rwlock_acquire_write(struct rwlock *);
 void rwlock_release_write(struct rwlock *);
 
+/*
+ * Big-reader lock.
+ *
+ * A reader-writer lock for data that is read far more often than it
+ * is written. Each cpu counts its own readers in its own cache line,
+ * so readers on different cpus don't touch any shared memory that
+ * changes and read throughput scales with the number of cpus. The
+ * price is paid by writers, which have to sum the counts of every
+ * cpu and wait for the total to drain to zero.
+ *
+ * A reader may be moved to another cpu while holding the lock, and
+ * release it there; the counts are signed and only their sum means
+ * anything.
+ *
+ * Writers exclude each other with br_wlock and take priority over
+ * new readers, which back out and wait while a writer is in.
+ */
+struct brlock_cpu {
+	volatile int bc_readers;
+	char bc_pad[60];		/* one per cache line */
+};
+
+struct brlock {
+	char *br_name;
+	struct lock *br_wlock;		/* serializes writers */
+	volatile bool br_writer;	/* a writer is in or coming */
+	struct spinlock br_spinlock;	/* for the wchans */
+	struct wchan *br_rwchan;	/* readers waiting for the writer */
+	struct wchan *br_wwchan;	/* writer waiting for readers */
+	struct brlock_cpu br_cpus[MAXCPUS];
+};
+
+struct brlock *brlock_create(const char *name);
+void brlock_destroy(struct brlock *);
+
+/*
+ * Operations, as for rwlocks. The read operations only touch the
+ * current cpu's count unless a writer is about.
+ */
+void brlock_acquire_read(struct brlock *);
+void brlock_release_read(struct brlock *);
+void brlock_acquire_write(struct brlock *);
+void brlock_release_write(struct brlock *);
+bool brlock_do_i_hold_write(struct brlock *);
+
 #endif /* _SYNCH_H_ */
@@ -51,6 +51,7 @@
 int arraytest(int, char **);
 int arraytest2(int, char **);
 int bitmaptest(int, char **);
+int pidtest(int, char **);
 int threadlisttest(int, char **);
 
 /* thread tests */
@@ -63,6 +64,7 @@ int locktest2(int, char **);
 int locktest3(int, char **);
 int locktest4(int, char **);
 int locktest5(int, char **);
+int locktest6(int, char **);
 int cvtest(int, char **);
 int cvtest2(int, char **);
 int cvtest3(int, char **);
@@ -74,6 +76,12 @@ int rwtest3(int, char **);
 int rwtest4(int, char **);
 int rwtest5(int, char **);
 
+/* lock benchmarks */
+int lockbench(int, char **);
+int spinlockbench(int, char **);
+int lockhandoffbench(int, char **);
+int uncontendedlockbench(int, char **);
+
 /* semaphore unit tests */
 int semu1(int, char **);
 int semu2(int, char **);
@@ -117,6 +125,8 @@ int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int kmalloctest5(int, char **);
 int nettest(int, char **);
+int orphantest(int, char **);
+int ksmtest(int, char **);
 
 /* Pagetable test */
 int pagetabletest(int, char**);
@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -89,12 +90,32 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct thread *t_wakenext;	/* Link for a cpu's c_wakeq */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_uslot;		/* User thread id in t_proc */
 	HANGMAN_ACTOR(t_hangman);	/* Deadlock detector hook */
 
+	/*
+	 * Scheduler fields. Changed by the thread itself, or by
+	 * schedule() with the thread's run queue locked.
+	 */
+	unsigned t_priority;		/* Run queue level; 0 is highest */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	uint64_t t_lastran;		/* clock_nsecs() at last switch-out */
+	uint64_t t_wakeup;		/* clock_nsecs() at wakeup, or 0 */
+	unsigned t_rqlevel;		/* Run queue it's on, or SCHED_NLEVELS */
+
+	/*
+	 * Priority inheritance (see synch.c). Protected by
+	 * lock_pi_lock; t_inherited is also read by the scheduler.
+	 */
+	unsigned t_inherited;		/* Level lent by waiters, or SCHED_NLEVELS */
+	struct lock *t_blockedon;	/* Lock we're asleep waiting for */
+	struct lock *t_pilocks;		/* Held locks with sleepers */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -173,12 +194,38 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Charge the current thread for a hardclock. Returns true if it should
+ * yield: either a thread of higher priority is waiting, or its time
+ * slice is used up and another thread of the same priority is waiting.
+ * Called from the timer interrupt.
+ */
+bool thread_tick(void);
+
+/*
+ * Move the current thread to the base level for its process's nice
+ * value; used after setpriority.
+ */
+void thread_renice(void);
+
+/*
+ * Priority inheritance hooks for synch.c. thread_level returns the
+ * run queue level T gets: its own, or a better one lent to it by
+ * threads waiting for a lock it holds. thread_inherit sets the lent
+ * level (SCHED_NLEVELS for none), moving T if it's on a run queue.
+ */
+unsigned thread_level(struct thread *t);
+void thread_inherit(struct thread *t, unsigned level);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
  */
 void thread_consider_migration(void);
 
+/* Print per-cpu scheduler statistics. */
+void thread_printstats(void);
+
 extern unsigned thread_count;
 void thread_wait_for_count(unsigned);
 
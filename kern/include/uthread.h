@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _UTHREAD_H_
+#define _UTHREAD_H_
+
+/*
+ * User threads: more than one thread running in a user process.
+ *
+ * Each process has a table of UTHREAD_MAX slots, indexed by thread
+ * id. Slot 0 is the thread the process started with, which runs on
+ * the usual user stack; the others each get a stack of their own
+ * carved out of the address space below it (see as_define_tstack).
+ * A slot stays taken after its thread exits until some other thread
+ * joins it, which also gives the stack back.
+ *
+ * Exiting (_exit, or a fatal fault) takes the whole process down.
+ * The other threads are told to go through p_exiting; each one
+ * checks on its way back to user mode (uthread_checkexit) and leaves
+ * instead. Threads sleeping in thread_join or on a futex are woken up
+ * so they notice. execv does the same to everyone but the caller.
+ *
+ * The table, p_nuthreads and p_exiting are protected by
+ * p_threadlock; p_threadcv is signalled whenever a thread leaves.
+ */
+
+struct proc;
+
+#define UTHREAD_MAX	32	/* threads per process, including the first */
+
+typedef enum {
+	UT_FREE,		/* slot not in use */
+	UT_RUNNING,		/* thread alive */
+	UT_EXITED,		/* thread gone, not joined yet */
+	UT_STACK,		/* not a thread, but its stack is in use */
+} uthread_state_t;
+
+int uthread_procinit(struct proc *);
+void uthread_proccleanup(struct proc *);
+
+int uthread_alloc(struct proc *, unsigned *slot);
+void uthread_unalloc(struct proc *, unsigned slot);
+int uthread_join(unsigned slot);
+__DEAD void uthread_exit(void);
+__DEAD void uthread_exitproc(int status);
+void uthread_checkexit(void);
+void uthread_fork(struct proc *newproc);
+int uthread_killothers(void);
+void uthread_execdone(void);
+
+#endif /* _UTHREAD_H_ */
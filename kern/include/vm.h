@@ -59,6 +59,39 @@ void free_kpages(vaddr_t addr);
 void free_upages(vaddr_t addr, pid_t owner);
 void free_page_at_index(size_t, pid_t, vaddr_t);
 
+/*
+ * Reference-counted frames, for pages mapped by more than one address
+ * space. alloc_shared_page returns a zeroed frame holding one
+ * reference; the frame is freed when page_decref drops the last one.
+ */
+paddr_t alloc_shared_page(void);
+bool page_is_shared(paddr_t ppn);
+int page_incref(paddr_t ppn);
+void page_decref(paddr_t ppn);
+
+/*
+ * Merged frames are shared frames holding identical page contents
+ * found by the same-page merging scanner (vm/ksm.c). They are mapped
+ * read-only; vm_fault breaks the sharing on a write.
+ */
+bool page_is_merged(paddr_t ppn);
+bool page_ref_if_merged(paddr_t ppn);
+void page_make_merged(paddr_t ppn, pid_t owner, vaddr_t vpn);
+bool page_unmerge(paddr_t ppn, pid_t owner, vaddr_t vpn);
+
+/* Same-page merging scanner, in ksm.c */
+extern volatile bool ksm_enabled;
+extern uint32_t ksm_pages_merged;
+void ksm_bootstrap(void);
+
+/* Futex wait queues, in futex.c */
+struct proc;
+void futex_bootstrap(void);
+void futex_wakeproc(struct proc *);
+
+/* Print coremap and merging statistics */
+void vm_printstats(void);
+
 
 /*
  * Return amount of memory (in bytes) used by allocated coremap pages.  If
@@ -70,5 +103,15 @@ unsigned int coremap_used_bytes(void);
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Invalidate a page on all cpus and wait for it to finish */
+void vm_tlbshootdown_all(vaddr_t vpn);
+
+/*
+ * Number of TLB entries saved per address space at context switch and
+ * loaded again when it next runs (see as_tlbsave). 0 turns it off.
+ */
+#define TLBWS_MAX	64	/* NUM_TLB */
+extern unsigned tlb_working_set;
+
 
 #endif /* _VM_H_ */
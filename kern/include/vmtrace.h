@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#ifndef _VMTRACE_H_
+#define _VMTRACE_H_
+
+/*
+ * VM tracepoints.
+ *
+ * Each tracepoint appends a timestamped record to a ring buffer
+ * belonging to the current CPU. The time since the previous record
+ * on the same CPU is charged to the event, so the per-event totals
+ * show where fault time goes. Fault exit also folds the whole
+ * fault's latency into a log2 histogram for its fault type.
+ *
+ * Tracing is off by default. When it is off a tracepoint costs one
+ * test of vmtrace_enabled.
+ */
+
+#include <spinlock.h>
+
+/* Tracepoint events */
+#define VMT_FAULT_ENTER		0	/* vm_fault() called */
+#define VMT_REGION_LOOKUP	1	/* faulting address checked */
+#define VMT_FRAME_ALLOC		2	/* physical page allocated */
+#define VMT_FRAME_ZERO		3	/* new page zeroed */
+#define VMT_TLB_INSERT		4	/* translation loaded into TLB */
+#define VMT_FAULT_EXIT		5	/* vm_fault() returning */
+#define VMT_NEVENTS		6
+
+/* Fault types (VM_FAULT_*) that get their own histogram */
+#define VMT_NFAULTTYPES		3
+
+#define VMTRACE_RINGSIZE	128	/* records per cpu; power of 2 */
+#define VMTRACE_NBUCKETS	32	/* histogram bucket i: [2^i, 2^(i+1)) ns */
+
+struct vmtrace_rec {
+	uint64_t vr_time;		/* clock_nsecs() at the tracepoint */
+	vaddr_t vr_addr;		/* faulting address or page */
+	uint16_t vr_event;		/* VMT_* */
+	uint16_t vr_arg;		/* fault type, or result at exit */
+};
+
+/*
+ * Per-cpu trace state; lives in struct cpu. Only the owning cpu
+ * records into it, but the menu reads and resets it from elsewhere,
+ * hence the lock.
+ */
+struct vmtrace_cpu {
+	struct spinlock vt_lock;
+	unsigned vt_next;			/* next ring slot */
+	uint64_t vt_last;			/* time of last record */
+	struct vmtrace_rec vt_ring[VMTRACE_RINGSIZE];
+	uint32_t vt_count[VMT_NEVENTS];
+	uint64_t vt_phase_ns[VMT_NEVENTS];	/* time leading up to event */
+	uint32_t vt_hist[VMT_NFAULTTYPES][VMTRACE_NBUCKETS];
+};
+
+extern volatile bool vmtrace_enabled;
+
+void vmtrace_cpu_init(struct vmtrace_cpu *vt);
+uint64_t vmtrace_record(unsigned event, vaddr_t addr, unsigned arg);
+void vmtrace_fault_done(int faulttype, vaddr_t addr, uint64_t start,
+			int result);
+
+/*
+ * Tracepoints. VMTRACE_FAULT_ENTER evaluates to the start timestamp
+ * (0 when tracing is off) to be handed back to VMTRACE_FAULT_EXIT.
+ */
+#define VMTRACE(ev, addr, arg) \
+	do { \
+		if (vmtrace_enabled) { \
+			vmtrace_record(ev, addr, arg); \
+		} \
+	} while (0)
+
+#define VMTRACE_FAULT_ENTER(type, addr) \
+	(vmtrace_enabled ? vmtrace_record(VMT_FAULT_ENTER, addr, type) : 0)
+
+#define VMTRACE_FAULT_EXIT(type, addr, start, result) \
+	do { \
+		if (vmtrace_enabled) { \
+			vmtrace_fault_done(type, addr, start, result); \
+		} \
+	} while (0)
+
+/* Menu hooks */
+void vmtrace_setenabled(bool on);
+void vmtrace_reset(void);
+void vmtrace_dump(bool showring);
+
+
+#endif /* _VMTRACE_H_ */
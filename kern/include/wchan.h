@@ -36,6 +36,7 @@
 
 
 struct spinlock; /* in spinlock.h */
+struct thread; /* in thread.h */
 struct wchan; /* Opaque */
 
 /*
@@ -56,6 +57,13 @@ void wchan_destroy(struct wchan *wc);
  */
 bool wchan_isempty(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Return the best (lowest) run queue level among the threads sleeping
+ * on the channel, or SCHED_NLEVELS if there are none. Used for
+ * priority inheritance.
+ */
+unsigned wchan_toplevel(struct wchan *wc, struct spinlock *lk);
+
 /*
  * Go to sleep on a wait channel. The current thread is suspended
  * until awakened by someone else, at which point this function
@@ -70,11 +78,34 @@ void wchan_sleep(struct wchan *wc, struct spinlock *lk);
  * Wake up one thread, or all threads, sleeping on a wait channel.
  * The associated spinlock should be locked.
  *
+ * wchan_wakeone returns the thread it woke, or NULL if there was
+ * none, so the caller can hand that thread whatever it was waiting
+ * for.
+ *
  * The current implementation is FIFO but this is not promised by the
  * interface.
  */
-void wchan_wakeone(struct wchan *wc, struct spinlock *lk);
+struct thread *wchan_wakeone(struct wchan *wc, struct spinlock *lk);
 void wchan_wakeall(struct wchan *wc, struct spinlock *lk);
 
+/*
+ * Wake up thread T if it is sleeping on the wait channel, and return
+ * whether it was. The associated spinlock should be locked.
+ */
+bool wchan_wakethread(struct wchan *wc, struct spinlock *lk,
+		      struct thread *t);
+
+/*
+ * Move one thread, or all threads, sleeping on wait channel FROM over
+ * to wait channel TO, without waking them. Both spinlocks must be
+ * locked. They will wake from wchan_sleep as usual, relocking the lock
+ * they slept with, when TO is woken. wchan_requeueone returns false
+ * if there was nobody to move.
+ */
+bool wchan_requeueone(struct wchan *from, struct spinlock *fromlk,
+		      struct wchan *to, struct spinlock *tolk);
+void wchan_requeueall(struct wchan *from, struct spinlock *fromlk,
+		      struct wchan *to, struct spinlock *tolk);
+
 
 #endif /* _WCHAN_H_ */
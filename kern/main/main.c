@@ -128,6 +128,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	ksm_bootstrap();
 	test161_bootstrap();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
@@ -210,7 +211,6 @@ sys_reboot(int code)
 void
 kmain(char *arguments)
 {
-	pid_counter = 0;
 	boot();
 	menu(arguments);
 	/* Should not get here */
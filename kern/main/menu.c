@@ -45,6 +45,10 @@
 #include <test.h>
 #include <prompt.h>
 #include <proc_syscalls.h>
+#include <vm.h>
+#include <vmtrace.h>
+#include <counter.h>
+#include <lockstat.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-synchprobs.h"
@@ -136,7 +140,7 @@ common_prog(int nargs, char **args)
 			args /* thread arg */, nargs /* thread arg */);
 	if (result) {
 		kprintf("thread_fork failed: %s\n", strerror(result));
-		proc_destroy(proc);
+		proc_table_remove(proc);
 		return result;
 	}
 
@@ -153,6 +157,7 @@ common_prog(int nargs, char **args)
 	// Wait for all threads to finish cleanup, otherwise khu be a bit behind,
 	// especially once swapping is enabled.
 	thread_wait_for_count(tc);
+	proc_table_drain();
 
 	return 0;
 }
@@ -488,6 +493,8 @@ cmd_kheapused(int nargs, char **args)
 	(void)nargs;
 	(void)args;
 
+	/* Dead procs waiting out their grace period aren't in use. */
+	proc_table_drain();
 	kheap_printused();
 
 	return 0;
@@ -522,6 +529,164 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_schedstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+
+/*
+ * Command to print the statistics counters, totalled or for one cpu.
+ */
+static
+int
+cmd_counters(int nargs, char **args)
+{
+	if (nargs == 1) {
+		counter_print(-1);
+	}
+	else if (nargs == 2) {
+		counter_print(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: counters [cpu]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Command to turn same-page merging on and off.
+ */
+static
+int
+cmd_ksm(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		ksm_enabled = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		ksm_enabled = false;
+	}
+	else {
+		kprintf("Usage: ksm on|off\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ * Command to show or set how many TLB entries are kept per process
+ * across context switches.
+ */
+static
+int
+cmd_tlbws(int nargs, char **args)
+{
+	int n;
+
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n < 0 || n > TLBWS_MAX) {
+			kprintf("tlbws: size must be 0-%d\n", TLBWS_MAX);
+			return EINVAL;
+		}
+		tlb_working_set = n;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: tlbws [entries]\n");
+		return EINVAL;
+	}
+
+	kprintf("TLB working set: %u entries\n", tlb_working_set);
+
+	return 0;
+}
+
+/*
+ * Command to control the VM tracepoints.
+ */
+static
+int
+cmd_vmtrace(int nargs, char **args)
+{
+	if (nargs == 1) {
+		vmtrace_dump(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "on")) {
+		vmtrace_setenabled(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		vmtrace_setenabled(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		vmtrace_reset();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "ring")) {
+		vmtrace_dump(true);
+	}
+	else {
+		kprintf("Usage: vmtrace [on|off|reset|ring]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+/*
+ * Command to control the lock contention profiler.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	int n;
+
+	if (nargs == 1) {
+		lockstat_print(10);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "on")) {
+		lockstat_setenabled(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		lockstat_setenabled(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockstat_reset();
+	}
+	else if (nargs == 2 && (n = atoi(args[1])) > 0) {
+		lockstat_print(n);
+	}
+	else {
+		kprintf("Usage: lockstat [on|off|reset|count]\n");
+		return EINVAL;
+	}
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -583,6 +748,9 @@ static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[at2] Large array test              ",
 	"[bt]  Bitmap test                   ",
+	"[pidt] PID table test               ",
+	"[orpht] Orphan reaping test         ",
+	"[ksmt] Same-page merging test       ",
 	"[tlt] Threadlist test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
@@ -604,6 +772,11 @@ static const char *testmenu[] = {
 	"[lt3]  Lock test 3           (1*)   ",
 	"[lt4]  Lock test 4           (1*)   ",
 	"[lt5]  Lock test 5           (1*)   ",
+	"[lt6]  Priority inversion    (1)    ",
+	"[lkb]  Lock throughput benchmark    ",
+	"[slb]  Spinlock contention benchmark",
+	"[lhb]  Lock handoff benchmark       ",
+	"[ulb]  Uncontended lock benchmark   ",
 	"[cvt1] CV test 1             (1)    ",
 	"[cvt2] CV test 2             (1)    ",
 	"[cvt3] CV test 3             (1*)   ",
@@ -676,6 +849,15 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[schedstat] Scheduler stats         ",
+	"[vmstat] VM stats                   ",
+	"[counters] Per-cpu counters         ",
+	"[ksm] Same-page merging on/off      ",
+	"[tlbws] TLB working set size        ",
+	"[vmtrace] VM fault trace/histograms ",
+#if OPT_LOCKSTAT
+	"[lockstat] Lock contention profile  ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -731,11 +913,23 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "schedstat",  cmd_schedstat },
+	{ "vmstat",     cmd_vmstat },
+	{ "counters",   cmd_counters },
+	{ "ksm",        cmd_ksm },
+	{ "tlbws",      cmd_tlbws },
+	{ "vmtrace",    cmd_vmtrace },
+#if OPT_LOCKSTAT
+	{ "lockstat",   cmd_lockstat },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "at2",	arraytest2 },
 	{ "bt",		bitmaptest },
+	{ "pidt",	pidtest },
+	{ "orpht",	orphantest },
+	{ "ksmt",	ksmtest },
 	{ "tlt",	threadlisttest },
 	{ "km1",	kmalloctest },
 	{ "km2",	kmallocstress },
@@ -761,6 +955,11 @@ static struct {
 	{ "lt3",	locktest3 },
 	{ "lt4", 	locktest4 },
 	{ "lt5", 	locktest5 },
+	{ "lt6",	locktest6 },
+	{ "lkb",	lockbench },
+	{ "slb",	spinlockbench },
+	{ "lhb",	lockhandoffbench },
+	{ "ulb",	uncontendedlockbench },
 	{ "cvt1",	cvtest },
 	{ "cvt2",	cvtest2 },
 	{ "cvt3",	cvtest3 },
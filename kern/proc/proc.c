@@ -49,8 +49,13 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <synch.h>
+#include <epoch.h>
+#include <membar.h>
 #include <vfs.h>
+#include <clock.h>
+#include <kern/errno.h>
 #include <kern/unistd.h>
+#include <kern/wait.h>
 #include <proc_syscalls.h>
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -59,10 +64,13 @@ struct proc *kproc;
 
 struct proc_table *p_table;
 
-volatile pid_t pid_counter;
+struct lock *proc_family_lock;
 
 bool is_kproc = true;
 
+static void proc_release(struct proc *proc);
+static void proc_unlink(struct proc *proc);
+
 /* NOTE: proc_table is a singleton struct and should only ever be init'd once */
 struct proc_table *
 proc_table_create(void) 
@@ -73,15 +81,22 @@ proc_table_create(void)
 		return NULL;
 	}
 
-	for(int i = 0; i < 256; i++) {
-		new_ptable->table[i] = NULL;
+	for(int i = 0; i < PROC_NLEAVES; i++) {
+		new_ptable->pt_leaves[i] = NULL;
 	}
+	bzero(new_ptable->pt_inuse, sizeof(new_ptable->pt_inuse));
+	new_ptable->pt_count = 0;
+	new_ptable->pt_limit = PROC_LEAF_SIZE;
+	/* This makes sure the kproc is assigned PID of 1 */
+	new_ptable->pt_next = 1;
 
 	new_ptable->pt_lock = lock_create("ptable_lock");
 	if(new_ptable->pt_lock == NULL) {
 		kfree(new_ptable);
 		return NULL;
 	}
+	new_ptable->pt_retired = NULL;
+	new_ptable->pt_retired_tail = &new_ptable->pt_retired;
 
 	return new_ptable;
 }
@@ -89,15 +104,68 @@ proc_table_create(void)
 void 
 proc_table_destroy(struct proc_table *table) 
 {	
-	for(int i = 0; i < 256; i++) {
-		if(table->table[i] != NULL) {
-			proc_destroy(table->table[i]);
+	for(int i = 0; i < PROC_NLEAVES; i++) {
+		if(table->pt_leaves[i] == NULL) {
+			continue;
+		}
+		for(int j = 0; j < PROC_LEAF_SIZE; j++) {
+			if(table->pt_leaves[i][j] != NULL) {
+				proc_destroy(table->pt_leaves[i][j]);
+			}
 		}
+		kfree((void *)table->pt_leaves[i]);
+	}
+	while(table->pt_retired != NULL) {
+		struct proc *proc = table->pt_retired;
+		table->pt_retired = proc->p_retired_next;
+		proc_destroy(proc);
 	}
 	lock_destroy(table->pt_lock);
 	kfree(table);
 }
 
+/*
+ * Find the lowest PID at or above FROM and below TO whose pt_inuse bit
+ * is clear (or set, if FLIP is all ones), a word at a time. Returns -1
+ * if there isn't one.
+ */
+static
+pid_t
+pid_find(struct proc_table *pt, unsigned from, unsigned to, uint32_t flip)
+{
+	unsigned ix, bit;
+	uint32_t word;
+
+	KASSERT(to <= PROC_NPIDS);
+	if(from >= to) {
+		return -1;
+	}
+	ix = from / 32;
+	/* Treat the bits below FROM as not wanted. */
+	word = (pt->pt_inuse[ix] ^ flip) | ((1U << (from % 32)) - 1);
+	while(word == 0xffffffff) {
+		ix++;
+		if(ix * 32 >= to) {
+			return -1;
+		}
+		word = pt->pt_inuse[ix] ^ flip;
+	}
+	for(bit = 0; word & (1U << bit); bit++) {
+		/* nothing */
+	}
+	bit += ix * 32;
+	return bit < to ? (pid_t)bit : -1;
+}
+
+static
+void
+pid_free(struct proc_table *pt, pid_t pid)
+{
+	KASSERT(pt->pt_inuse[pid / 32] & (1U << (pid % 32)));
+	pt->pt_inuse[pid / 32] &= ~(1U << (pid % 32));
+	pt->pt_count--;
+}
+
 /*
  * Assign next available PID. Be sure the caller uses the p_table lock!
  */
@@ -105,41 +173,216 @@ proc_table_destroy(struct proc_table *table)
 int32_t
 next_pid(void)
 {
-	// This makes sure the kproc is assigned PID of 1
-	if(pid_counter < PID_MIN) {
-		pid_counter = 1;
+	struct proc_table *pt = p_table;
+	pid_t pid;
+
+	/* Keep the search short: grow before the table gets full. */
+	if(pt->pt_count >= pt->pt_limit / 4 * 3 && pt->pt_limit < PROC_NPIDS) {
+		pt->pt_limit *= 2;
 	}
 
-	pid_t pid;
-	bool pid_found = false;
+	pid = pid_find(pt, pt->pt_next, pt->pt_limit, 0);
+	if(pid < 0) {
+		pid = pid_find(pt, PID_MIN, pt->pt_next, 0);
+	}
+	if(pid < 0) {
+		kprintf("next_pid(): ERROR! No free PID was available in the process table!\n");
+		return -1;
+	}
+
+	pt->pt_inuse[pid / 32] |= 1U << (pid % 32);
+	pt->pt_count++;
+	pt->pt_next = (unsigned)pid + 1 < pt->pt_limit ? pid + 1 : PID_MIN;
 
-	if(pid_counter > 255) {
-		pid_counter = PID_MIN;
+	return pid;
+}
+
+/*
+ * Give PROC a PID and make it visible to lookups. Everything a lookup
+ * looks at has to be set up first. Returns ENPROC if there's no PID
+ * free.
+ */
+int
+proc_table_insert(struct proc *proc)
+{
+	struct proc *volatile *leaf;
+	int32_t pid;
+
+	if(!is_kproc) {
+		lock_acquire(p_table->pt_lock);
 	}
 
-	for(pid = pid_counter; pid < 256; pid++) {
-		if(p_table->table[pid] == NULL) {
-			pid_found = true;
-			break;
-		} else {
-			pid_counter++;
+	pid = next_pid();
+	if(pid < 0) {
+		if(!is_kproc) {
+			lock_release(p_table->pt_lock);
+		}
+		return ENPROC;
+	}
+	proc->pid = (pid_t) pid;
+
+	leaf = p_table->pt_leaves[pid >> PROC_LEAF_SHIFT];
+	if(leaf == NULL) {
+		leaf = kmalloc(PROC_LEAF_SIZE * sizeof(*leaf));
+		if(leaf == NULL) {
+			pid_free(p_table, pid);
+			if(!is_kproc) {
+				lock_release(p_table->pt_lock);
+			}
+			return ENOMEM;
 		}
-		if(pid == 255) {
-			pid = PID_MIN;
+		for(int i = 0; i < PROC_LEAF_SIZE; i++) {
+			leaf[i] = NULL;
 		}
+		/* Publish: the empty slots before the pointer to them. */
+		membar_store_store();
+		p_table->pt_leaves[pid >> PROC_LEAF_SHIFT] = leaf;
 	}
 
-	if(!pid_found) {
-		kprintf("next_pid(): ERROR! No free PID was available in the process table!\n");
-		return -1;
+	/* Publish: the proc's fields before the pointer to it. */
+	membar_store_store();
+	KASSERT(leaf[pid & (PROC_LEAF_SIZE - 1)] == NULL);
+	leaf[pid & (PROC_LEAF_SIZE - 1)] = proc;
+
+	if(!is_kproc) {
+		lock_release(p_table->pt_lock);
 	}
-	
-	KASSERT(p_table->table[pid] == NULL);
+	return 0;
+}
 
-	pid_counter++;
+struct proc *
+proc_table_lookup(pid_t pid)
+{
+	struct proc *volatile *leaf;
 
-	return pid;
+	if(pid < PID_MIN || pid > PID_MAX) {
+		return NULL;
+	}
+	leaf = p_table->pt_leaves[pid >> PROC_LEAF_SHIFT];
+	if(leaf == NULL) {
+		return NULL;
+	}
+	membar_load_load();
+	return leaf[pid & (PROC_LEAF_SIZE - 1)];
+}
+
+pid_t
+proc_table_next(pid_t pid)
+{
+	if(pid < PID_MIN - 1) {
+		pid = PID_MIN - 1;
+	}
+	return pid_find(p_table, pid + 1, p_table->pt_limit, 0xffffffff);
+}
+
+/*
+ * Destroy a list of retired procs, chained through p_retired_next.
+ */
+static
+void
+proc_table_free(struct proc *done)
+{
+	struct proc *proc;
+
+	while(done != NULL) {
+		proc = done;
+		done = proc->p_retired_next;
+		proc_destroy(proc);
+	}
+}
+
+/*
+ * Take PROC out of the process table and destroy it. The PID can be
+ * reused right away, and the process's resources are released now,
+ * but a lookup that started before the removal may still be looking
+ * at the proc itself. So it goes on pt_retired, and gets freed by
+ * whichever removal comes along after its grace period is over (see
+ * epoch.h), or by proc_table_drain. That costs a few struct procs
+ * sitting around, but no lookup ever waits for a removal.
+ */
+void
+proc_table_remove(struct proc *proc)
+{
+	struct proc *done, **donetail;
+
+	KASSERT(proc != kproc);
+	KASSERT(proc->p_numthreads == 0);
+
+	lock_acquire(proc_family_lock);
+	if(proc->p_siblingp != NULL) {
+		/* A failed fork; a waiter may be looking for it. */
+		if(proc->p_parent != NULL) {
+			cv_broadcast(proc->p_parent->p_childcv, proc_family_lock);
+		}
+		proc_unlink(proc);
+	}
+	proc->p_parent = NULL;
+	lock_release(proc_family_lock);
+
+	proc_release(proc);
+
+	lock_acquire(p_table->pt_lock);
+
+	KASSERT(proc_table_lookup(proc->pid) == proc);
+	p_table->pt_leaves[proc->pid >> PROC_LEAF_SHIFT]
+		[proc->pid & (PROC_LEAF_SIZE - 1)] = NULL;
+	pid_free(p_table, proc->pid);
+
+	proc->p_retired_epoch = epoch_current();
+	proc->p_retired_next = NULL;
+	*p_table->pt_retired_tail = proc;
+	p_table->pt_retired_tail = &proc->p_retired_next;
+
+	/* The list is oldest first, so the expired ones are a prefix. */
+	done = p_table->pt_retired;
+	donetail = &p_table->pt_retired;
+	while(*donetail != NULL && epoch_expired((*donetail)->p_retired_epoch)) {
+		donetail = &(*donetail)->p_retired_next;
+	}
+	p_table->pt_retired = *donetail;
+	if(p_table->pt_retired == NULL) {
+		p_table->pt_retired_tail = &p_table->pt_retired;
+	}
+	*donetail = NULL;
+
+	lock_release(p_table->pt_lock);
+
+	proc_table_free(done);
 }
+
+/*
+ * Free every proc waiting on pt_retired, sleeping until no lookup can
+ * still have them. Removals only free the ones that have expired by
+ * then, so the last few to go would otherwise wait for the next
+ * removal; call this before measuring the heap.
+ */
+void
+proc_table_drain(void)
+{
+	struct proc *done, *proc;
+
+	lock_acquire(p_table->pt_lock);
+	done = p_table->pt_retired;
+	p_table->pt_retired = NULL;
+	p_table->pt_retired_tail = &p_table->pt_retired;
+	lock_release(p_table->pt_lock);
+
+	if(done == NULL) {
+		return;
+	}
+
+	/* The list is oldest first, so wait for the last one. */
+	for(proc = done; proc->p_retired_next != NULL;
+	    proc = proc->p_retired_next) {
+		/* nothing */
+	}
+	while(!epoch_expired(proc->p_retired_epoch)) {
+		timeout_sleep(1);
+	}
+
+	proc_table_free(done);
+}
+
 /*
  * Create a proc structure.
  */
@@ -162,9 +405,8 @@ proc_create(const char *name)
 	proc->p_numthreads = 0;
 	spinlock_init(&proc->p_lock);
 
-	proc->exit_sem = NULL;
-	proc->exit_sem = sem_create("process_exit_sem", 0);
-	if(proc->exit_sem == NULL) {
+	proc->p_childcv = cv_create("p_childcv");
+	if(proc->p_childcv == NULL) {
 		kfree(proc->p_name);
 		spinlock_cleanup(&proc->p_lock);
 		kfree(proc);
@@ -176,39 +418,36 @@ proc_create(const char *name)
 	if(proc->fork_lock == NULL) {
 		kfree(proc->p_name);
 		spinlock_cleanup(&proc->p_lock);
-		sem_destroy(proc->exit_sem);
+		cv_destroy(proc->p_childcv);
 		kfree(proc);
 		return NULL;
 	}
 
-	/* VM fields */
-	proc->p_addrspace = NULL;
-
-	/* VFS fields */
-	proc->p_cwd = NULL;
-
-	if(!is_kproc) {
-		lock_acquire(p_table->pt_lock);
+	proc->p_ftlock = lock_create("filetable_lock");
+	if(proc->p_ftlock == NULL) {
+		kfree(proc->p_name);
+		spinlock_cleanup(&proc->p_lock);
+		cv_destroy(proc->p_childcv);
+		lock_destroy(proc->fork_lock);
+		kfree(proc);
+		return NULL;
 	}
 
-	int32_t new_pid = next_pid();	
-	if(new_pid < 0) {
-		kprintf("proc_create: Error! next_pid() unable to find available PID in process table\n");
+	if(uthread_procinit(proc)) {
 		kfree(proc->p_name);
 		spinlock_cleanup(&proc->p_lock);
-		sem_destroy(proc->exit_sem);
+		cv_destroy(proc->p_childcv);
+		lock_destroy(proc->fork_lock);
+		lock_destroy(proc->p_ftlock);
 		kfree(proc);
 		return NULL;
 	}
 
-	proc->pid = (pid_t) new_pid;
-	KASSERT(p_table->table[proc->pid] == NULL);
-	p_table->table[proc->pid] = proc;
-	
-	if(!is_kproc) {
-		lock_release(p_table->pt_lock);
-	}
+	/* VM fields */
+	proc->p_addrspace = NULL;
 
+	/* VFS fields */
+	proc->p_cwd = NULL;
 
 	/* First process has no parent, shouldn't 
 	   be valid index into process table. 
@@ -217,11 +456,26 @@ proc_create(const char *name)
 
 	proc->exited = false;
 	proc->exit_status = 0;
+	proc->p_waited = false;
+	proc->p_nice = 0;
+
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_zombies = NULL;
+	proc->p_sibling = NULL;
+	proc->p_siblingp = NULL;
 
 	for(int i = 0; i < 64; i++) {
 		proc->filetable[i] = NULL;
 	}
 
+	/* Last, so lookups never see it half made. */
+	if(proc_table_insert(proc)) {
+		kprintf("proc_create: Error! next_pid() unable to find available PID in process table\n");
+		proc_destroy(proc);
+		return NULL;
+	}
+
 	return proc;
 }
 
@@ -247,21 +501,40 @@ proc_create_child(const char *name)
 	proc->p_numthreads = 0;
 	spinlock_init(&proc->p_lock);
 
-	proc->exit_sem = NULL;
-	proc->exit_sem = sem_create("process_exit_sem", 0);
-	if(proc->exit_sem == NULL) {
+	proc->p_childcv = cv_create("p_childcv");
+	if(proc->p_childcv == NULL) {
 		kfree(proc->p_name);
 		spinlock_cleanup(&proc->p_lock);
 		kfree(proc);
 		return NULL;
-	}	
+	}
 
 	proc->fork_lock = NULL;
 	proc->fork_lock = lock_create("fork_lock");
 	if(proc->fork_lock == NULL) {
 		kfree(proc->p_name);
 		spinlock_cleanup(&proc->p_lock);
-		sem_destroy(proc->exit_sem);
+		cv_destroy(proc->p_childcv);
+		kfree(proc);
+		return NULL;
+	}
+
+	proc->p_ftlock = lock_create("filetable_lock");
+	if(proc->p_ftlock == NULL) {
+		kfree(proc->p_name);
+		spinlock_cleanup(&proc->p_lock);
+		cv_destroy(proc->p_childcv);
+		lock_destroy(proc->fork_lock);
+		kfree(proc);
+		return NULL;
+	}
+
+	if(uthread_procinit(proc)) {
+		kfree(proc->p_name);
+		spinlock_cleanup(&proc->p_lock);
+		cv_destroy(proc->p_childcv);
+		lock_destroy(proc->fork_lock);
+		lock_destroy(proc->p_ftlock);
 		kfree(proc);
 		return NULL;
 	}
@@ -280,6 +553,14 @@ proc_create_child(const char *name)
 
 	proc->exited = false;
 	proc->exit_status = 0;
+	proc->p_waited = false;
+	proc->p_nice = 0;
+
+	proc->p_parent = NULL;
+	proc->p_children = NULL;
+	proc->p_zombies = NULL;
+	proc->p_sibling = NULL;
+	proc->p_siblingp = NULL;
 
 	for(int i = 0; i < 64; i++) {
 		proc->filetable[i] = NULL;
@@ -289,31 +570,15 @@ proc_create_child(const char *name)
 }
 
 /*
- * Destroy a proc structure.
- *
- * Note: nothing currently calls this. Your wait/exit code will
- * probably want to do so.
+ * Drop the resources a process holds: its current directory, address
+ * space and open files. Lookups through the process table can still
+ * find PROC while this runs, but of these they only look at
+ * p_addrspace, under p_lock.
  */
+static
 void
-proc_destroy(struct proc *proc)
+proc_release(struct proc *proc)
 {
-	/*
-	 * You probably want to destroy and null out much of the
-	 * process (particularly the address space) at exit time if
-	 * your wait/exit design calls for the process structure to
-	 * hang around beyond process exit. Some wait/exit designs
-	 * do, some don't.
-	 */
-
-	KASSERT(proc != NULL);
-	KASSERT(proc != kproc);
-
-	/*
-	 * We don't take p_lock in here because we must have the only
-	 * reference to this structure. (Otherwise it would be
-	 * incorrect to destroy it.)
-	 */
-
 	/* VFS fields */
 	if (proc->p_cwd) {
 		VOP_DECREF(proc->p_cwd);
@@ -362,29 +627,64 @@ proc_destroy(struct proc *proc)
 			as_deactivate();
 		}
 		else {
+			spinlock_acquire(&proc->p_lock);
 			as = proc->p_addrspace;
 			proc->p_addrspace = NULL;
+			spinlock_release(&proc->p_lock);
 		}
 		as_destroy(as);
 	}
 
-
-	KASSERT(proc->p_numthreads == 0);
-	spinlock_cleanup(&proc->p_lock);
-
-	lock_destroy(proc->fork_lock);
-	
-	//Clean up semaphore, filehandles, name, thread
-	sem_destroy(proc->exit_sem);
-
 	/*
 	 *Need to destroy all file handles with not in use
 	 */
 	for(size_t i=0; i<64; i++){
 		if(proc->filetable[i] != NULL){
 			filehandle_destroy(proc->filetable[i]);	
+			proc->filetable[i] = NULL;
 		}	
 	}
+}
+
+/*
+ * Destroy a proc structure.
+ *
+ * Once a process has been in the process table, use
+ * proc_table_remove instead, which calls this when it's safe.
+ */
+void
+proc_destroy(struct proc *proc)
+{
+	/*
+	 * You probably want to destroy and null out much of the
+	 * process (particularly the address space) at exit time if
+	 * your wait/exit design calls for the process structure to
+	 * hang around beyond process exit. Some wait/exit designs
+	 * do, some don't.
+	 */
+
+	KASSERT(proc != NULL);
+	KASSERT(proc != kproc);
+
+	/*
+	 * We don't take p_lock in here because we must have the only
+	 * reference to this structure. (Otherwise it would be
+	 * incorrect to destroy it.)
+	 */
+
+	proc_release(proc);
+
+	KASSERT(proc->p_numthreads == 0);
+	spinlock_cleanup(&proc->p_lock);
+
+	lock_destroy(proc->fork_lock);
+	
+	KASSERT(proc->p_siblingp == NULL);
+	KASSERT(proc->p_children == NULL && proc->p_zombies == NULL);
+	cv_destroy(proc->p_childcv);
+
+	lock_destroy(proc->p_ftlock);
+	uthread_proccleanup(proc);
 
 
 	kfree(proc->p_name);
@@ -399,6 +699,10 @@ void
 proc_bootstrap(void)
 {
 	p_table = proc_table_create();
+	proc_family_lock = lock_create("proc_family");
+	if (proc_family_lock == NULL) {
+		panic("proc_bootstrap: lock_create failed\n");
+	}
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
@@ -447,49 +751,222 @@ proc_create_runprogram(const char *name)
 	/* Add elements to file table */
 	newproc->filetable[0] = filehandle_create("con:", STDIN_FILENO); 
 	if(newproc->filetable[0] == NULL){
-		proc_destroy(newproc);	
+		proc_table_remove(newproc);
 		return NULL;
 	}
 	result = vfs_open(newproc->filetable[0]->fh_name, STDIN_FILENO, 0, &newproc->filetable[0]->fh_vnode);
 	if(result) {
-		filehandle_destroy(newproc->filetable[0]);
-		proc_destroy(newproc);	 
+		proc_table_remove(newproc);
 		return NULL;
 	}
 
 	newproc->filetable[1] = filehandle_create("con:", STDOUT_FILENO); 
 	if(newproc->filetable[1] == NULL){
-		filehandle_destroy(newproc->filetable[0]);
-		proc_destroy(newproc);	
+		proc_table_remove(newproc);
 		return NULL;
 	}
 	
 	result = vfs_open(newproc->filetable[1]->fh_name, STDOUT_FILENO, 0, &newproc->filetable[1]->fh_vnode);
 	if(result) {
-		filehandle_destroy(newproc->filetable[0]);
-		filehandle_destroy(newproc->filetable[1]);
-		proc_destroy(newproc);	 
+		proc_table_remove(newproc);
 		return NULL;
 	}
 
 	newproc->filetable[2] = filehandle_create("con:", STDERR_FILENO); 
 	if(newproc->filetable[2] == NULL){
-		filehandle_destroy(newproc->filetable[0]);
-		filehandle_destroy(newproc->filetable[1]);
-		proc_destroy(newproc);		
+		proc_table_remove(newproc);
 		return NULL;
 	}
 	result = vfs_open(newproc->filetable[2]->fh_name, STDERR_FILENO, 0, &newproc->filetable[2]->fh_vnode);
 	if(result) {
-		filehandle_destroy(newproc->filetable[0]);
-		filehandle_destroy(newproc->filetable[1]);
-		filehandle_destroy(newproc->filetable[2]);
-		proc_destroy(newproc);	 
+		proc_table_remove(newproc);
 		return NULL;
 	}
+
+	/* The menu thread reaps it with waitpid. */
+	proc_addchild(curproc, newproc);
 	return newproc;
 }
 
+/*
+ * Process families.
+ *
+ * proc_family_lock covers the family fields of every process; it's
+ * only held for list surgery, and to sleep on a parent's p_childcv.
+ * A process is never on more than one list: its parent's p_children
+ * while it runs, p_zombies once it exits, and neither after it's
+ * reaped or orphaned.
+ */
+
+static
+void
+proc_link(struct proc **list, struct proc *proc)
+{
+	KASSERT(lock_do_i_hold(proc_family_lock));
+	KASSERT(proc->p_siblingp == NULL);
+
+	proc->p_sibling = *list;
+	if(*list != NULL) {
+		(*list)->p_siblingp = &proc->p_sibling;
+	}
+	proc->p_siblingp = list;
+	*list = proc;
+}
+
+static
+void
+proc_unlink(struct proc *proc)
+{
+	KASSERT(lock_do_i_hold(proc_family_lock));
+	KASSERT(proc->p_siblingp != NULL);
+
+	*proc->p_siblingp = proc->p_sibling;
+	if(proc->p_sibling != NULL) {
+		proc->p_sibling->p_siblingp = proc->p_siblingp;
+	}
+	proc->p_sibling = NULL;
+	proc->p_siblingp = NULL;
+}
+
+void
+proc_addchild(struct proc *parent, struct proc *child)
+{
+	lock_acquire(proc_family_lock);
+	KASSERT(child->p_parent == NULL);
+	child->p_parent = parent;
+	proc_link(&parent->p_children, child);
+	lock_release(proc_family_lock);
+}
+
+/*
+ * Called by the last thread of PROC on its way out, after it has left
+ * the process. Once this releases the lock the parent may reap PROC,
+ * so don't touch it afterwards.
+ *
+ * Nobody is left to wait for PROC's children: running ones lose their
+ * parent, and exited ones are reaped here. Likewise if PROC has lost
+ * its own parent, it reaps itself; it has no threads left, so nothing
+ * is using it but this one.
+ */
+void
+proc_exited(struct proc *proc)
+{
+	struct proc *child, *zombies;
+	bool orphan;
+
+	lock_acquire(proc_family_lock);
+
+	while((child = proc->p_children) != NULL) {
+		proc_unlink(child);
+		child->p_parent = NULL;
+	}
+
+	/* Keep the zombies chained through p_sibling to reap below. */
+	zombies = proc->p_zombies;
+	proc->p_zombies = NULL;
+	for(child = zombies; child != NULL; child = child->p_sibling) {
+		KASSERT(!child->p_waited);
+		child->p_siblingp = NULL;
+		child->p_parent = NULL;
+	}
+
+	proc->exited = true;
+	orphan = (proc->p_parent == NULL);
+	if(!orphan) {
+		proc_unlink(proc);
+		proc_link(&proc->p_parent->p_zombies, proc);
+		cv_broadcast(proc->p_parent->p_childcv, proc_family_lock);
+	}
+
+	lock_release(proc_family_lock);
+
+	while(zombies != NULL) {
+		child = zombies;
+		zombies = child->p_sibling;
+		child->p_sibling = NULL;
+		proc_table_remove(child);
+	}
+	if(orphan) {
+		proc_table_remove(proc);
+	}
+}
+
+int
+proc_claimchild(pid_t pid, bool nohang, struct proc **ret)
+{
+	struct proc *child;
+	int spl;
+
+	lock_acquire(proc_family_lock);
+	while(1) {
+		if(pid > 0) {
+			spl = epoch_enter();
+			child = proc_table_lookup(pid);
+			if(child == NULL) {
+				epoch_exit(spl);
+				lock_release(proc_family_lock);
+				return ESRCH;
+			}
+			/*
+			 * Someone else's process may be removed as we look;
+			 * ours can't go away while we hold the lock.
+			 */
+			if(child->p_parent != curproc || child->p_waited) {
+				epoch_exit(spl);
+				lock_release(proc_family_lock);
+				return ECHILD;
+			}
+			epoch_exit(spl);
+			if(!child->exited) {
+				child = NULL;
+			}
+		}
+		else if(pid == WAIT_ANY || pid == WAIT_MYPGRP) {
+			/* No process groups, so WAIT_MYPGRP is everyone. */
+			if(curproc->p_children == NULL &&
+			   curproc->p_zombies == NULL) {
+				lock_release(proc_family_lock);
+				return ECHILD;
+			}
+			child = curproc->p_zombies;
+		}
+		else {
+			lock_release(proc_family_lock);
+			return ECHILD;
+		}
+
+		if(child != NULL || nohang) {
+			break;
+		}
+		cv_wait(curproc->p_childcv, proc_family_lock);
+	}
+
+	if(child != NULL) {
+		KASSERT(child->exited);
+		child->p_waited = true;
+		proc_unlink(child);
+	}
+	lock_release(proc_family_lock);
+
+	*ret = child;
+	return 0;
+}
+
+/*
+ * Put back a child claimed by proc_claimchild, because it couldn't be
+ * reaped after all.
+ */
+void
+proc_unclaimchild(struct proc *child)
+{
+	lock_acquire(proc_family_lock);
+	KASSERT(child->p_waited && child->p_parent == curproc);
+	child->p_waited = false;
+	proc_link(&curproc->p_zombies, child);
+	cv_broadcast(curproc->p_childcv, proc_family_lock);
+	lock_release(proc_family_lock);
+}
+
 /*
  * Add a thread to a process. Either the thread or the process might
  * or might not be current.
@@ -592,6 +1069,28 @@ proc_setas(struct addrspace *newas)
 }
 
 
+struct addrspace *
+proc_holdas(pid_t pid)
+{
+	struct proc *proc;
+	struct addrspace *as = NULL;
+	int spl;
+
+	spl = epoch_enter();
+	proc = proc_table_lookup(pid);
+	if(proc != NULL) {
+		spinlock_acquire(&proc->p_lock);
+		as = proc->p_addrspace;
+		if(as != NULL) {
+			as_incref(as);
+		}
+		spinlock_release(&proc->p_lock);
+	}
+	epoch_exit(spl);
+
+	return as;
+}
+
 struct filehandle *
 filehandle_create(const char *name, int fh_perm)
 {
@@ -654,6 +1153,7 @@ filetable_copy(struct proc *src, struct proc *dest)
 	}
 	int size = 64;
 	int i;
+	lock_acquire(src->p_ftlock);
 	for(i = 0; i < size; i++) {
 		if(src->filetable[i] != NULL) { 
 			lock_acquire(src->filetable[i]->fh_lock);
@@ -664,6 +1164,33 @@ filetable_copy(struct proc *src, struct proc *dest)
 			dest->filetable[i] = NULL;
 		}
 	}
+	lock_release(src->p_ftlock);
 	return 0;
 }
 
+/*
+ * Look up FD and take a reference to its handle, so another thread
+ * closing FD can't free it while we use it. The reference counts as
+ * one more open, and filehandle_destroy() drops it.
+ */
+struct filehandle *
+filetable_get(struct proc *proc, int fd)
+{
+	struct filehandle *fh;
+
+	if(fd < 0 || fd > 63) {
+		return NULL;
+	}
+
+	lock_acquire(proc->p_ftlock);
+	fh = proc->filetable[fd];
+	if(fh != NULL) {
+		lock_acquire(fh->fh_lock);
+		fh->num_open_proc++;
+		lock_release(fh->fh_lock);
+	}
+	lock_release(proc->p_ftlock);
+
+	return fh;
+}
+
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * User thread bookkeeping for a process: thread slots, joining, and
+ * getting every thread out when the process exits or execs. See
+ * uthread.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <uthread.h>
+
+/*
+ * Set up the user thread fields of a new process. It starts out with
+ * one thread, in slot 0.
+ */
+int
+uthread_procinit(struct proc *proc)
+{
+	unsigned i;
+
+	proc->p_threadlock = lock_create("uthread_lock");
+	if (proc->p_threadlock == NULL) {
+		return ENOMEM;
+	}
+	proc->p_threadcv = cv_create("uthread_cv");
+	if (proc->p_threadcv == NULL) {
+		lock_destroy(proc->p_threadlock);
+		return ENOMEM;
+	}
+
+	proc->p_uthreads[0] = UT_RUNNING;
+	for (i=1; i<UTHREAD_MAX; i++) {
+		proc->p_uthreads[i] = UT_FREE;
+	}
+	proc->p_nuthreads = 1;
+	proc->p_exiting = false;
+	proc->p_exiter = NULL;
+
+	return 0;
+}
+
+void
+uthread_proccleanup(struct proc *proc)
+{
+	cv_destroy(proc->p_threadcv);
+	lock_destroy(proc->p_threadlock);
+}
+
+/*
+ * Take a free slot for a new thread in PROC.
+ */
+int
+uthread_alloc(struct proc *proc, unsigned *slot)
+{
+	unsigned i;
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_exiting) {
+		/* We're about to be got rid of anyway. */
+		lock_release(proc->p_threadlock);
+		return EINTR;
+	}
+	for (i=1; i<UTHREAD_MAX; i++) {
+		if (proc->p_uthreads[i] == UT_FREE) {
+			proc->p_uthreads[i] = UT_RUNNING;
+			proc->p_nuthreads++;
+			lock_release(proc->p_threadlock);
+			*slot = i;
+			return 0;
+		}
+	}
+	lock_release(proc->p_threadlock);
+	return EAGAIN;
+}
+
+/*
+ * Give back a slot from uthread_alloc whose thread never started.
+ */
+void
+uthread_unalloc(struct proc *proc, unsigned slot)
+{
+	lock_acquire(proc->p_threadlock);
+	KASSERT(proc->p_uthreads[slot] == UT_RUNNING);
+	proc->p_uthreads[slot] = UT_FREE;
+	proc->p_nuthreads--;
+	cv_broadcast(proc->p_threadcv, proc->p_threadlock);
+	lock_release(proc->p_threadlock);
+}
+
+/*
+ * Wait for thread SLOT of the current process to exit, and free its
+ * slot and stack.
+ */
+int
+uthread_join(unsigned slot)
+{
+	struct proc *proc = curproc;
+	int err = 0;
+
+	if (slot >= UTHREAD_MAX) {
+		return ESRCH;
+	}
+	if (slot == curthread->t_uslot) {
+		return EINVAL;
+	}
+
+	lock_acquire(proc->p_threadlock);
+	while (proc->p_uthreads[slot] == UT_RUNNING && !proc->p_exiting) {
+		cv_wait(proc->p_threadcv, proc->p_threadlock);
+	}
+	switch (proc->p_uthreads[slot]) {
+	    case UT_EXITED:
+		proc->p_uthreads[slot] = UT_FREE;
+		if (slot != 0) {
+			as_release_tstack(proc_getas(), slot);
+		}
+		break;
+	    case UT_RUNNING:
+		/* The process is exiting; so are we. */
+		err = EINTR;
+		break;
+	    default:
+		err = ESRCH;
+		break;
+	}
+	lock_release(proc->p_threadlock);
+
+	return err;
+}
+
+/*
+ * Take the current thread out of its process and tell anyone waiting.
+ * Called with p_threadlock held, and releases it. The process may be
+ * destroyed as soon as the lock is let go, so we detach from it
+ * first; the caller must not touch it again.
+ */
+static
+void
+uthread_leave(struct proc *proc)
+{
+	unsigned slot = curthread->t_uslot;
+
+	KASSERT(lock_do_i_hold(proc->p_threadlock));
+	KASSERT(proc->p_uthreads[slot] == UT_RUNNING);
+
+	proc->p_uthreads[slot] = UT_EXITED;
+	proc->p_nuthreads--;
+	proc_remthread(curthread);
+	cv_broadcast(proc->p_threadcv, proc->p_threadlock);
+	lock_release(proc->p_threadlock);
+}
+
+/*
+ * Tell every other thread to leave, and wait until they have. Threads
+ * asleep in thread_join or on a futex are woken so they notice; the
+ * rest notice on their way back to user mode.
+ */
+static
+void
+uthread_waitothers(struct proc *proc)
+{
+	KASSERT(lock_do_i_hold(proc->p_threadlock));
+	KASSERT(proc->p_exiting && proc->p_exiter == curthread);
+
+	if (proc->p_nuthreads > 1) {
+		futex_wakeproc(proc);
+		cv_broadcast(proc->p_threadcv, proc->p_threadlock);
+		while (proc->p_nuthreads > 1) {
+			cv_wait(proc->p_threadcv, proc->p_threadlock);
+		}
+	}
+}
+
+/*
+ * thread_exit: end the current thread. The last one out ends the
+ * process, with status 0.
+ */
+void
+uthread_exit(void)
+{
+	struct proc *proc = curproc;
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_nuthreads == 1 && !proc->p_exiting) {
+		lock_release(proc->p_threadlock);
+		uthread_exitproc(_MKWAIT_EXIT(0));
+	}
+	uthread_leave(proc);
+	thread_exit();
+}
+
+/*
+ * End the current process with STATUS (already encoded for waitpid),
+ * taking down any other threads it has first.
+ */
+void
+uthread_exitproc(int status)
+{
+	struct proc *proc = curproc;
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_exiting) {
+		/* Someone else is exiting or execing; let them. */
+		KASSERT(proc->p_exiter != curthread);
+		uthread_leave(proc);
+		thread_exit();
+	}
+	proc->p_exiting = true;
+	proc->p_exiter = curthread;
+	uthread_waitothers(proc);
+
+	proc->p_uthreads[curthread->t_uslot] = UT_EXITED;
+	proc->p_nuthreads--;
+	proc->exit_status = status;
+	lock_release(proc->p_threadlock);
+
+	/* Detach before the parent can destroy the process. */
+	proc_remthread(curthread);
+	proc_exited(proc);
+	thread_exit();
+}
+
+/*
+ * On the way back to user mode: if another thread is taking the
+ * process down, go away instead.
+ */
+void
+uthread_checkexit(void)
+{
+	struct proc *proc = curproc;
+
+	if (!proc->p_exiting || proc->p_exiter == curthread) {
+		return;
+	}
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_exiting && proc->p_exiter != curthread) {
+		uthread_leave(proc);
+		thread_exit();
+	}
+	lock_release(proc->p_threadlock);
+}
+
+/*
+ * fork: NEWPROC gets a copy of our address space and one thread,
+ * which starts out on the same stack as we are on. If that is a
+ * thread stack rather than the first thread's, keep its slot from
+ * being handed out in the child.
+ */
+void
+uthread_fork(struct proc *newproc)
+{
+	unsigned slot = curthread->t_uslot;
+
+	if (slot != 0) {
+		newproc->p_uthreads[slot] = UT_STACK;
+	}
+}
+
+/*
+ * execv: get rid of every other thread before the address space is
+ * replaced. Afterwards the caller is the only thread; if the exec
+ * fails it carries on as such. Fails if someone else is already
+ * taking the process down, in which case the caller is one of the
+ * threads that has to go.
+ */
+int
+uthread_killothers(void)
+{
+	struct proc *proc = curproc;
+	unsigned i;
+
+	lock_acquire(proc->p_threadlock);
+	if (proc->p_exiting) {
+		lock_release(proc->p_threadlock);
+		return EINTR;
+	}
+	proc->p_exiting = true;
+	proc->p_exiter = curthread;
+	uthread_waitothers(proc);
+
+	/* Nobody is left to join them. */
+	for (i=0; i<UTHREAD_MAX; i++) {
+		if (proc->p_uthreads[i] == UT_EXITED) {
+			proc->p_uthreads[i] = UT_FREE;
+			if (i != 0) {
+				as_release_tstack(proc_getas(), i);
+			}
+		}
+	}
+
+	proc->p_exiting = false;
+	proc->p_exiter = NULL;
+	lock_release(proc->p_threadlock);
+	return 0;
+}
+
+/*
+ * execv succeeded: the caller is now the first thread of a new
+ * program, running on the usual stack.
+ */
+void
+uthread_execdone(void)
+{
+	struct proc *proc = curproc;
+	unsigned i;
+
+	lock_acquire(proc->p_threadlock);
+	KASSERT(proc->p_nuthreads == 1);
+	proc->p_uthreads[0] = UT_RUNNING;
+	for (i=1; i<UTHREAD_MAX; i++) {
+		proc->p_uthreads[i] = UT_FREE;
+	}
+	curthread->t_uslot = 0;
+	lock_release(proc->p_threadlock);
+}
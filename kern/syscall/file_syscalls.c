@@ -61,30 +61,32 @@ sys_write(int fd, const void *buf, size_t buflen, int32_t *retval)
 
 	int result = 0;
 
-	if(fd < 0 || fd > 63 || curproc->filetable[fd] == NULL) {
+	struct filehandle *fh = filetable_get(curproc, fd);
+	if(fh == NULL) {
 		*retval = EBADF;
 		return EBADF;
 	}
 	
-	int fh_flags = curproc->filetable[fd]->fh_perm;
+	int fh_flags = fh->fh_perm;
 	if(fh_flags == O_RDONLY || 
 		fh_flags == O_RDONLY+O_CREAT || 
 		fh_flags == O_RDONLY+O_EXCL || 
 		fh_flags == O_RDONLY+O_TRUNC || 
 		fh_flags == O_RDONLY+O_APPEND){
 
+		filehandle_destroy(fh);
 		*retval = EBADF;
 		return EBADF;
 	}
 	
 	if(fh_flags==3 || fh_flags >= O_NOCTTY){
+		filehandle_destroy(fh);
 		*retval = EINVAL;
 		return EINVAL;
 	}
 
-	lock_acquire(curproc->filetable[fd]->fh_lock);
+	lock_acquire(fh->fh_lock);
 	
-	struct filehandle *fh = curproc->filetable[fd];	
 	struct iovec iov;
 	struct uio u;
 	
@@ -102,6 +104,7 @@ sys_write(int fd, const void *buf, size_t buflen, int32_t *retval)
 	if(result) {
 		*retval = result;
 		lock_release(fh->fh_lock);
+		filehandle_destroy(fh);
 		return result;
 	}
 	fh->fh_offset_value = u.uio_offset;
@@ -109,6 +112,7 @@ sys_write(int fd, const void *buf, size_t buflen, int32_t *retval)
 	*retval = buflen - u.uio_resid;
 
 	lock_release(fh->fh_lock);
+	filehandle_destroy(fh);
 
 	return 0;
 }
@@ -128,27 +132,29 @@ sys_read(int fd, void *buf, size_t buflen, int32_t *retval)
 
 	int result = 0;
 
-	if(fd < 0 || fd > 63 || curproc->filetable[fd] == NULL) {
+	struct filehandle *fh = filetable_get(curproc, fd);
+	if(fh == NULL) {
 		*retval = -1;
 		return EBADF;
 	}
 
-	int fh_flags = curproc->filetable[fd]->fh_perm;
+	int fh_flags = fh->fh_perm;
 	if(fh_flags == O_WRONLY || 
 		fh_flags == O_WRONLY+O_CREAT || 
 		fh_flags == O_WRONLY+O_EXCL || 
 		fh_flags == O_WRONLY+O_TRUNC || 
 		fh_flags == O_WRONLY+O_APPEND){
+		filehandle_destroy(fh);
 		*retval = -1;
 		return EBADF;
 	}
 
 	if(fh_flags==3 || fh_flags >= O_NOCTTY){
+		filehandle_destroy(fh);
 		*retval = -1;
 		return EINVAL;
 	}
 
-	struct filehandle *fh = curproc->filetable[fd];
 	struct iovec iov;
 	struct uio u;
 
@@ -167,12 +173,14 @@ sys_read(int fd, void *buf, size_t buflen, int32_t *retval)
 	result = VOP_READ(fh->fh_vnode, &u);
 	if(result) {
 		lock_release(fh->fh_lock);
+		filehandle_destroy(fh);
 		*retval = result;
 		return result;
 	}
 
 	fh->fh_offset_value = u.uio_offset;
 	lock_release(fh->fh_lock);
+	filehandle_destroy(fh);
 
 	*retval = buflen - u.uio_resid;
 	return 0;
@@ -216,16 +224,8 @@ sys_open(const char *filename, int flags, int32_t *retval)
 		return 1;
 	}
 
-	//No one should be able to mess with the file handles while I'm checking for a free space
 	int i;
-	int free_index = 63;
-
-	for(i=3; i<64;i++){
-		if(curproc->filetable[i] == NULL) {
-			free_index = i < free_index ? i : free_index;
-			break;
-		}
-	}
+	int free_index = -1;
 
 	//Make copy of pathname here and provide as argument to open
 	char *k_filename_copy = kstrdup(k_filename);
@@ -240,8 +240,25 @@ sys_open(const char *filename, int flags, int32_t *retval)
 		return result;
 	}
 
-	curproc->filetable[free_index] = new_fh;
 	kfree(k_filename_copy);
+
+	//No one should be able to mess with the file handles while I'm checking for a free space
+	lock_acquire(curproc->p_ftlock);
+	for(i=3; i<64;i++){
+		if(curproc->filetable[i] == NULL) {
+			free_index = i;
+			break;
+		}
+	}
+	if(free_index < 0) {
+		lock_release(curproc->p_ftlock);
+		filehandle_destroy(new_fh);
+		*retval = EMFILE;
+		return EMFILE;
+	}
+	curproc->filetable[free_index] = new_fh;
+	lock_release(curproc->p_ftlock);
+
 	*retval = free_index;
 
 	return 0;
@@ -250,61 +267,63 @@ sys_open(const char *filename, int flags, int32_t *retval)
 int 
 sys_close(int fd, int32_t *retval)
 {
-	if(fd < 0 || fd > 63 || curproc->filetable[fd] == NULL) {
+	struct filehandle *fh;
+
+	if(fd < 0 || fd > 63) {
 		*retval = EBADF;
 		return EBADF;
 	}
 
-	struct filehandle *fh = curproc->filetable[fd];
-	lock_acquire(fh->fh_lock);
-	sys_close_helper(fh, fd); // releases lock
+	lock_acquire(curproc->p_ftlock);
+	fh = curproc->filetable[fd];
+	if(fh == NULL) {
+		lock_release(curproc->p_ftlock);
+		*retval = EBADF;
+		return EBADF;
+	}
+	curproc->filetable[fd] = NULL;
+	lock_release(curproc->p_ftlock);
+
+	// Another thread may still be using it; the last one out closes it.
+	filehandle_destroy(fh);
 	*retval = 0;
 	return 0;
 }
 
-void
-sys_close_helper(struct filehandle *fh, int fd) {
-	/* Must acquire fh_lock before calling! */
-	KASSERT(fh != NULL);
-	fh->num_open_proc--;
-	if(fh->num_open_proc < 1) {
-		// vfs_close cannot fail. See vfspath.c:119 for details.
-		curproc->filetable[fd] = NULL;
-		lock_release(fh->fh_lock);
-		filehandle_destroy(fh);
-	} else {
-		curproc->filetable[fd] = NULL;
-		lock_release(fh->fh_lock);
-	}
-}
-
 int
 sys_dup2(int fdold, int fdnew, int32_t *retval)
 {
+	struct filehandle *fh_old, *fh_new;
+
 	if(fdold < 0 || fdold > 63 || 
 		fdnew < 0 || fdnew > 63 ||
-		fdold == fdnew || 
-		curproc->filetable[fdold] == NULL) 
+		fdold == fdnew) 
 	{
 		*retval = EBADF;
 		return EBADF;
 	}
 
-	lock_acquire(curproc->filetable[fdold]->fh_lock);
+	lock_acquire(curproc->p_ftlock);
+
+	fh_old = curproc->filetable[fdold];
+	if(fh_old == NULL) {
+		lock_release(curproc->p_ftlock);
+		*retval = EBADF;
+		return EBADF;
+	}
+
+	fh_new = curproc->filetable[fdnew];
 
-	if(curproc->filetable[fdnew] != NULL) {
+	lock_acquire(fh_old->fh_lock);
+	fh_old->num_open_proc++;
+	lock_release(fh_old->fh_lock);
+	curproc->filetable[fdnew] = fh_old;
 
-		struct filehandle *fh_new = curproc->filetable[fdnew];
+	lock_release(curproc->p_ftlock);
 
-		KASSERT(fh_new != NULL);
-		
-		curproc->filetable[fdnew] = NULL;
+	if(fh_new != NULL) {
 		filehandle_destroy(fh_new);
 	}
-
-	curproc->filetable[fdold]->num_open_proc++;
-	curproc->filetable[fdnew] = curproc->filetable[fdold];
-	lock_release(curproc->filetable[fdold]->fh_lock);
 	
 	*retval = fdnew;
 	return 0;
@@ -361,16 +380,21 @@ sys_lseek(int fd, off_t pos, const void * whence, off_t * retval)
 
 
 
-	if(fd < 1 || fd > 63 || curproc->filetable[fd] == NULL) {
+	if(fd < 1) {
 		*retval = (off_t)EBADF;
 		return (off_t)EBADF;
 	}
 
+	struct filehandle * fh = filetable_get(curproc, fd);
+	if(fh == NULL) {
+		*retval = (off_t)EBADF;
+		return (off_t)EBADF;
+	}
 
-	struct filehandle * fh = curproc->filetable[fd];
 	lock_acquire(fh->fh_lock);
 	if(!VOP_ISSEEKABLE(fh->fh_vnode)) {
 		lock_release(fh->fh_lock);
+		filehandle_destroy(fh);
 		*retval = (off_t)ESPIPE;
 		return (off_t)ESPIPE;
 	}
@@ -390,12 +414,14 @@ sys_lseek(int fd, off_t pos, const void * whence, off_t * retval)
 
 	if(net_offset<0){
 		lock_release(fh->fh_lock);
+		filehandle_destroy(fh);
 		*retval = (off_t) EINVAL;
 		return (off_t)EINVAL;
 	}
 	fh->fh_offset_value = net_offset;
 	*retval = fh->fh_offset_value;
 	lock_release(fh->fh_lock);
+	filehandle_destroy(fh);
 
 	return 0;
 }
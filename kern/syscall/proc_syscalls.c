@@ -42,9 +42,13 @@
 #include <proc_syscalls.h>
 #include <uio.h>
 #include <synch.h>
+#include <epoch.h>
 #include <vnode.h>
 #include <copyinout.h>
 #include <kern/wait.h>
+#include <kern/mman.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <mips/trapframe.h>
 #include <kern/fcntl.h> //MACROS like O_RDONLY
 #include <limits.h>	//MACROS like ARG_MAX
@@ -87,12 +91,15 @@ sys_fork(struct trapframe *parent_tf, int32_t *retval)
 	}
 
 	newproc->ppid = curproc->pid;
+	newproc->p_nice = curproc->p_nice;
 	newproc->p_cwd = curproc->p_cwd;
 
 	spinlock_acquire(&newproc->p_lock);
 	VOP_INCREF(newproc->p_cwd);
 	spinlock_release(&newproc->p_lock);
 
+	uthread_fork(newproc);
+
 	err = filetable_copy(curproc, newproc);
 	if(err){
 		lock_release(curproc->fork_lock);
@@ -104,30 +111,18 @@ sys_fork(struct trapframe *parent_tf, int32_t *retval)
 	// Now ready to assign PID, be sure to remove this from
 	// the p_table in future error cases to free PID for the next 
 	// fork call
-	lock_acquire(p_table->pt_lock);
-
-	int32_t new_pid = next_pid();	
-	if(new_pid < 0) {
+	err = proc_table_insert(newproc);
+	if(err) {
 		lock_release(curproc->fork_lock);
 		proc_destroy(newproc);
-		*retval = ENOMEM;
-		return ENOMEM;
+		*retval = err;
+		return err;
 	}
 
-	newproc->pid = (pid_t) new_pid;
-	KASSERT(p_table->table[newproc->pid] == NULL);
-	p_table->table[newproc->pid] = newproc;
-
-	lock_release(p_table->pt_lock);
-
 	err = as_copy(proc_getas(), &newproc->p_addrspace, newproc->pid);
 	if(err){
-		lock_acquire(p_table->pt_lock);
-		KASSERT(p_table->table[newproc->pid] == newproc);
-		p_table->table[newproc->pid] = NULL;
-		lock_release(p_table->pt_lock);
 		lock_release(curproc->fork_lock);
-		proc_destroy(newproc); 
+		proc_table_remove(newproc);
 		
 		*retval = ENOMEM;
 		return ENOMEM;
@@ -139,27 +134,21 @@ sys_fork(struct trapframe *parent_tf, int32_t *retval)
 
 	child_tf = trapframe_copy(parent_tf);
 	if(child_tf == NULL){
-		lock_acquire(p_table->pt_lock);
-		KASSERT(p_table->table[newproc->pid] == newproc);
-		p_table->table[newproc->pid] = NULL;
-		lock_release(p_table->pt_lock);
 		lock_release(curproc->fork_lock);
-		proc_destroy(newproc); 
+		proc_table_remove(newproc);
 		
 		*retval = ENOMEM;
 		return ENOMEM;
 	}
 	
 
+	proc_addchild(curproc, newproc);
+
 	err = thread_fork("child", newproc, (void*)enter_forked_process, child_tf, (unsigned long)newproc->pid);
 	if(err) {
 		kfree(child_tf);
-		lock_acquire(p_table->pt_lock);
-		KASSERT(p_table->table[newproc->pid] == newproc);
-		p_table->table[newproc->pid] = NULL;
-		lock_release(p_table->pt_lock);
 		lock_release(curproc->fork_lock);
-		proc_destroy(newproc); 
+		proc_table_remove(newproc);
 		
 		*retval = err;
 		return err;
@@ -170,11 +159,15 @@ sys_fork(struct trapframe *parent_tf, int32_t *retval)
 	return 0;
 }
 
+/*
+ * Shared mappings sit between the heap and the stack, so the heap
+ * can grow up to the lowest of them (or the stack, if there are none).
+ */
 static
 bool
 heap_overlaps_stack(struct addrspace *as, intptr_t heap_increase)
 {
-	return (vaddr_t)(as->stack_start - as->stack_size) < (vaddr_t)(as->heap_start + as->heap_size + heap_increase);
+	return (vaddr_t)as->shm_bottom < (vaddr_t)(as->heap_start + as->heap_size + heap_increase);
 }
 
 int
@@ -189,12 +182,17 @@ sys_sbrk(intptr_t amount, int32_t *retval)
 		return EINVAL;
 	}
 
+	// Other threads may be faulting in or calling sbrk too
+	lock_acquire(as->as_lock);
+
 	if(amount < 0 && (size_t)(amount*-1) > as->heap_size) {
+		lock_release(as->as_lock);
 		*retval = EINVAL;
 		return EINVAL;
 	}
 
 	if(amount > 0 && heap_overlaps_stack(as, amount)) {
+		lock_release(as->as_lock);
 		*retval = ENOMEM;
 		return ENOMEM;
 	}
@@ -203,6 +201,8 @@ sys_sbrk(intptr_t amount, int32_t *retval)
 
 	as->heap_size += amount;
 
+	lock_release(as->as_lock);
+
 	if(amount < 0) {
 		err = as_clean_segments(as);
 		if(err) {
@@ -213,50 +213,93 @@ sys_sbrk(intptr_t amount, int32_t *retval)
 	return 0;
 }
 
-pid_t
-sys_waitpid(pid_t pid, userptr_t status_ptr, int options, int32_t *retval)
+/*
+ * mmap. Only shared anonymous memory is supported; the fd (and the
+ * offset after it) are passed on the user stack.
+ */
+int
+sys_mmap(vaddr_t addr, size_t len, int prot, int flags, const void *stackargs, int32_t *retval)
 {
-	int res;
-	int ch_status;
+	int fd;
+	int err;
+	vaddr_t start;
 
-	// Options not supported
-	if(options) {
+	// The address is only a hint, and we don't take hints
+	(void)addr;
+	(void)prot;
+
+	err = copyin((const_userptr_t)stackargs, &fd, sizeof(fd));
+	if(err) {
+		*retval = err;
+		return err;
+	}
+
+	if(flags != (MAP_SHARED | MAP_ANON) || fd != -1 || len == 0) {
 		*retval = EINVAL;
 		return EINVAL;
 	}
 
-	lock_acquire(p_table->pt_lock);
-
-	if(pid < PID_MIN || p_table->table[pid] == NULL) {
-		lock_release(p_table->pt_lock);
-		*retval = ESRCH;
-		return ESRCH;
+	err = as_map_shared(proc_getas(), len, &start);
+	if(err) {
+		*retval = err;
+		return err;
 	}
 
-	if(p_table->table[pid]->ppid != curproc->pid) {
-		lock_release(p_table->pt_lock);
-		*retval = ECHILD;
-		return ECHILD;
+	*retval = start;
+	return 0;
+}
+
+int
+sys_munmap(vaddr_t addr, size_t len, int32_t *retval)
+{
+	int err;
+
+	err = as_unmap_shared(proc_getas(), addr, len);
+	if(err) {
+		*retval = err;
+		return err;
 	}
+	return 0;
+}
 
-	struct proc *childproc = p_table->table[pid];
+/*
+ * Reap a child for waitpid and wait4: PID, or any child if PID is
+ * WAIT_ANY (or WAIT_MYPGRP, since there are no process groups). With
+ * WNOHANG, returns 0 in *RETVAL if no such child has exited yet.
+ *
+ * We don't keep resource usage per process, so RUSAGE_PTR, if given,
+ * gets zeros.
+ */
+static
+int
+waitchild(pid_t pid, userptr_t status_ptr, int options,
+	  userptr_t rusage_ptr, int32_t *retval)
+{
+	int res;
+	int ch_status;
+	struct proc *childproc;
+	struct rusage ru;
 
-	KASSERT(childproc->pid == pid);
-	
-	lock_release(p_table->pt_lock);
+	if(options & ~WNOHANG) {
+		return EINVAL;
+	}
 
 	/* Ensure the status ptr is valid (if provided) before continuing */
 	/* We won't do anything with the value, this just is a memcheck */
 	if(status_ptr != NULL) {
 		res = copyin(status_ptr, (void*)&res, 4);
 		if(res) {
-			*retval = res;
 			return res;
 		}
 	}
 
-	if(!childproc->exited) {
-		P(childproc->exit_sem);
+	res = proc_claimchild(pid, (options & WNOHANG) != 0, &childproc);
+	if(res) {
+		return res;
+	}
+	if(childproc == NULL) {
+		*retval = 0;
+		return 0;
 	}
 
 	KASSERT(childproc->exited);
@@ -266,27 +309,56 @@ sys_waitpid(pid_t pid, userptr_t status_ptr, int options, int32_t *retval)
 	if(status_ptr != NULL) {
 		res = copyout((void *)&ch_status, status_ptr, 4);
 		if(res) {
-			*retval = res;
+			proc_unclaimchild(childproc);
 			return res;
 		}
 	}
 
-	lock_acquire(p_table->pt_lock);
-	p_table->table[pid] = NULL;
-	proc_destroy(childproc); // leak memory for now, fix in asst3
-	lock_release(p_table->pt_lock);
+	if(rusage_ptr != NULL) {
+		bzero(&ru, sizeof(ru));
+		res = copyout(&ru, rusage_ptr, sizeof(ru));
+		if(res) {
+			proc_unclaimchild(childproc);
+			return res;
+		}
+	}
+
+	*retval = childproc->pid;
+	proc_table_remove(childproc);
+	return 0;
+}
+
+pid_t
+sys_waitpid(pid_t pid, userptr_t status_ptr, int options, int32_t *retval)
+{
+	int err;
+
+	err = waitchild(pid, status_ptr, options, NULL, retval);
+	if(err) {
+		*retval = err;
+		return err;
+	}
+	return 0;
+}
+
+int
+sys_wait4(pid_t pid, userptr_t status_ptr, int options, userptr_t rusage_ptr,
+	  int32_t *retval)
+{
+	int err;
 
-	*retval = pid;
+	err = waitchild(pid, status_ptr, options, rusage_ptr, retval);
+	if(err) {
+		*retval = err;
+		return err;
+	}
 	return 0;
 }
 
 void
 sys_exit(int exitcode) 
 {
-	curproc->exited = true;
-	curproc->exit_status = _MKWAIT_EXIT(exitcode);
-	V(curproc->exit_sem);
-	thread_exit();
+	uthread_exitproc(_MKWAIT_EXIT(exitcode));
 }
 
 void
@@ -296,6 +368,98 @@ sys_getpid(int32_t *retval)
 	*retval = curproc->pid;
 }
 
+/*
+ * Find the process for get/setpriority; 0 means curproc. Only
+ * PRIO_PROCESS is supported. Returns inside an epoch (so the process
+ * can't go away), with the value for epoch_exit in *SPL, unless
+ * there's an error.
+ */
+static
+int
+priority_target(int which, pid_t who, struct proc **ret, int *spl)
+{
+	struct proc *proc;
+
+	if(which != PRIO_PROCESS) {
+		return EINVAL;
+	}
+	if(who == 0) {
+		who = curproc->pid;
+	}
+	*spl = epoch_enter();
+	proc = proc_table_lookup(who);
+	if(proc == NULL || proc->exited) {
+		epoch_exit(*spl);
+		return ESRCH;
+	}
+
+	*ret = proc;
+	return 0;
+}
+
+int
+sys_getpriority(int which, pid_t who, int32_t *retval)
+{
+	struct proc *proc;
+	int err, spl;
+
+	err = priority_target(which, who, &proc, &spl);
+	if(err) {
+		*retval = err;
+		return err;
+	}
+
+	*retval = proc->p_nice;
+	epoch_exit(spl);
+	return 0;
+}
+
+/*
+ * Set a process's nice value, which picks the scheduler level its
+ * threads start at and get boosted back to. Out of range values are
+ * clamped. Other processes pick up the change at their next boost.
+ * Only ourselves and our own children can be reniced.
+ */
+int
+sys_setpriority(int which, pid_t who, int prio, int32_t *retval)
+{
+	struct proc *proc;
+	int err, spl;
+
+	err = priority_target(which, who, &proc, &spl);
+	if(err) {
+		*retval = err;
+		return err;
+	}
+
+	/*
+	 * p_parent belongs to proc_family_lock, which we can't take
+	 * here, but it only stops being curproc when curproc exits,
+	 * so an unlocked look is good enough to say no.
+	 */
+	if(proc != curproc && proc->p_parent != curproc) {
+		epoch_exit(spl);
+		*retval = EPERM;
+		return EPERM;
+	}
+
+	if(prio < PRIO_MIN) {
+		prio = PRIO_MIN;
+	}
+	if(prio > PRIO_MAX) {
+		prio = PRIO_MAX;
+	}
+	proc->p_nice = prio;
+	epoch_exit(spl);
+
+	if(proc == curproc) {
+		thread_renice();
+	}
+
+	*retval = 0;
+	return 0;
+}
+
 
 struct trapframe *
 trapframe_copy(struct trapframe *parent_tf)
@@ -367,6 +531,19 @@ sys_execv(const char *program, char **args, int32_t *retval)
 	// 	KASSERT(kprogram != NULL);
 	// 	first_exec = false;
 	// }
+
+	/*
+	 * Other threads can't keep running in the address space we're
+	 * about to throw away. This has to happen before we take
+	 * exec_lock, which one of them might be waiting for. If it
+	 * fails, we're being got rid of ourselves.
+	 */
+	int err = uthread_killothers();
+	if(err) {
+		*retval = err;
+		return err;
+	}
+
 	lock_acquire(exec_lock);
 	char *kargs = kmalloc(ARG_MAX);
 	char *kprogram = kmalloc(PATH_MAX);
@@ -566,6 +743,7 @@ sys_execv(const char *program, char **args, int32_t *retval)
 	kfree(lengths);
 	lock_release(exec_lock);
 	as_destroy(old_as);
+	uthread_execdone();
 
 	//Return to userspace using enter_new_process (in kern/arch/mips/locore/trap.c)
 	enter_new_process(index, argv_ptr_copy, NULL, stackptr, entrypoint);
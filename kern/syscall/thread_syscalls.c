@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * System calls for user threads. The bookkeeping is in proc/uthread.c.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <uthread.h>
+#include <proc_syscalls.h>
+#include <mips/trapframe.h>
+
+/*
+ * First thing a new user thread runs, in the kernel. TF is the
+ * trapframe to go to user mode with; SLOT is the thread's id.
+ */
+static
+void
+uthread_start(void *tf, unsigned long slot)
+{
+	struct trapframe trap = *(struct trapframe *)tf;
+
+	kfree(tf);
+	curthread->t_uslot = slot;
+
+	/* The process may have started exiting while we were being set up. */
+	uthread_checkexit();
+
+	mips_usermode(&trap);
+}
+
+/*
+ * Start a thread at ENTRY, with A0 and A1 as its first two arguments,
+ * on a stack of its own. Returns its id.
+ *
+ * The new thread has nothing to return to, so ENTRY mustn't return.
+ * libc's thread_create passes a start routine that calls the user's
+ * function and then thread_exit.
+ */
+int
+sys___thread_create(struct trapframe *tf, vaddr_t entry, vaddr_t a0,
+		    vaddr_t a1, int32_t *retval)
+{
+	struct proc *proc = curproc;
+	struct trapframe *child_tf;
+	vaddr_t stackptr;
+	unsigned slot;
+	int err;
+
+	if(entry >= USERSPACETOP || entry % 4 != 0) {
+		*retval = EFAULT;
+		return EFAULT;
+	}
+
+	err = uthread_alloc(proc, &slot);
+	if(err) {
+		*retval = err;
+		return err;
+	}
+
+	err = as_define_tstack(proc_getas(), slot, &stackptr);
+	if(err) {
+		uthread_unalloc(proc, slot);
+		*retval = err;
+		return err;
+	}
+
+	child_tf = kmalloc(sizeof(*child_tf));
+	if(child_tf == NULL) {
+		as_release_tstack(proc_getas(), slot);
+		uthread_unalloc(proc, slot);
+		*retval = ENOMEM;
+		return ENOMEM;
+	}
+
+	/* Keep gp and the status bits; everything else starts fresh. */
+	*child_tf = *tf;
+	child_tf->tf_epc = entry;
+	child_tf->tf_a0 = a0;
+	child_tf->tf_a1 = a1;
+	child_tf->tf_sp = stackptr;
+	child_tf->tf_ra = 0;
+
+	err = thread_fork("uthread", proc, uthread_start, child_tf, slot);
+	if(err) {
+		kfree(child_tf);
+		as_release_tstack(proc_getas(), slot);
+		uthread_unalloc(proc, slot);
+		*retval = err;
+		return err;
+	}
+
+	*retval = slot;
+	return 0;
+}
+
+void
+sys_thread_exit(void)
+{
+	uthread_exit();
+}
+
+/*
+ * Wait for thread TID to exit. Each thread can be joined once; its
+ * id may be reused after that.
+ */
+int
+sys_thread_join(int tid, int32_t *retval)
+{
+	int err;
+
+	if(tid < 0) {
+		*retval = ESRCH;
+		return ESRCH;
+	}
+
+	err = uthread_join(tid);
+	if(err) {
+		*retval = err;
+		return err;
+	}
+
+	*retval = 0;
+	return 0;
+}
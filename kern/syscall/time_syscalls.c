@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,44 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in *REQ, rounded up to whole hardclock ticks.
+ * Nothing cuts a sleep short, so the time left in *REM (if asked for)
+ * is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req, rem;
+	uint64_t ticks;
+	unsigned chunk;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	ticks = (uint64_t)req.tv_sec * HZ +
+		DIVROUNDUP((uint64_t)req.tv_nsec, 1000000000 / HZ);
+	while (ticks > 0) {
+		chunk = (ticks > 0x7fffffff) ? 0x7fffffff : ticks;
+		timeout_sleep(chunk);
+		ticks -= chunk;
+	}
+
+	if (user_rem != NULL) {
+		rem.tv_sec = 0;
+		rem.tv_nsec = 0;
+		result = copyout(&rem, user_rem, sizeof(rem));
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
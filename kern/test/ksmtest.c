@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Same-page merging test. Turns the scanner on and runs
+ * /testbin/ksmtest, which keeps identical pages in two processes long
+ * enough for them to merge and then checks that writing one of them
+ * breaks the sharing. Here we check the pages did get merged.
+ */
+
+#include <types.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <thread.h>
+#include <proc.h>
+#include <vm.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define KSMT_PROG	"/testbin/ksmtest"
+#define KSMT_PAGES	8	/* NPAGES in the program */
+
+static
+void
+ksmt_thread(void *ptr, unsigned long junk)
+{
+	char progname[sizeof(KSMT_PROG)];
+	int result;
+
+	(void)ptr;
+	(void)junk;
+
+	/* runprogram consumes its argument. */
+	strcpy(progname, KSMT_PROG);
+	result = runprogram(progname);
+	kprintf("ksmt: running %s failed: %s\n", KSMT_PROG,
+		strerror(result));
+}
+
+/*
+ * Run the program and wait for it. Returns its wait status, or -1 if
+ * it couldn't be run.
+ */
+static
+int
+ksmt_run(void)
+{
+	struct proc *proc;
+	unsigned tc;
+	int result;
+	int status;
+
+	proc = proc_create_runprogram(KSMT_PROG);
+	if (proc == NULL) {
+		return -1;
+	}
+
+	tc = thread_count;
+	result = thread_fork(KSMT_PROG, proc, ksmt_thread, NULL, 0);
+	if (result) {
+		proc_table_remove(proc);
+		return -1;
+	}
+
+	result = proc_claimchild(proc->pid, false, &proc);
+	if (result) {
+		panic("ksmt: proc_claimchild failed: %s\n",
+		      strerror(result));
+	}
+	status = proc->exit_status;
+	proc_table_remove(proc);
+
+	thread_wait_for_count(tc);
+	return status;
+}
+
+int
+ksmtest(int nargs, char **args)
+{
+	uint32_t before, after;
+	bool saved;
+	int status;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf_n("Starting ksmt...\n");
+
+	saved = ksm_enabled;
+	ksm_enabled = true;
+	before = ksm_pages_merged;
+	status = ksmt_run();
+	after = ksm_pages_merged;
+	ksm_enabled = saved;
+
+	kprintf_n("ksmt: %u pages merged during the run\n", after - before);
+
+	if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		kprintf("ksmt: %s failed\n", KSMT_PROG);
+		success(TEST161_FAIL, SECRET, "ksmt");
+		return 0;
+	}
+	if (after - before < KSMT_PAGES) {
+		kprintf("ksmt: expected at least %u merges\n", KSMT_PAGES);
+		success(TEST161_FAIL, SECRET, "ksmt");
+		return 0;
+	}
+
+	success(TEST161_SUCCESS, SECRET, "ksmt");
+	return 0;
+}
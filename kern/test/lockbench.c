@@ -0,0 +1,450 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock throughput benchmarks.
+ *
+ * lkb: LKB_THREADS threads each take a shared lock LKB_LOOPS times,
+ * doing a little work inside. It runs once with adaptive spinning off
+ * and once with it on and prints the throughput of each, so the two
+ * can be compared on machines with different numbers of cpus.
+ *
+ * slb: SLB_THREADS threads take a shared spinlock as often as they
+ * can for a second, first with a basic spinlock and then with a
+ * queued one. Prints the total acquisitions, and the least and most
+ * any one thread got, which shows how fair the lock is.
+ *
+ * lhb: LHB_THREADS threads take a shared lock LHB_LOOPS times each
+ * with adaptive spinning off, so contended acquisitions sleep. It
+ * runs once with lock handoff off and once with it on, and prints
+ * the context switches per acquisition of each. Without handoff a
+ * woken waiter often finds the lock taken again and has to go back
+ * to sleep, which costs extra switches.
+ *
+ * ulb: one thread takes and releases a lock nobody else wants
+ * ULB_LOOPS times, then does as many P/V pairs on a semaphore with
+ * a count to spare, and prints the round trips per second of each.
+ * Neither ever has to wait, so this measures the fast paths alone.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <thread.h>
+#include <synch.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define LKB_THREADS	8
+#define LKB_LOOPS	2000
+#define LKB_WORK	50	/* delay loop iterations inside the lock */
+
+#define SLB_THREADS	8
+#define SLB_WORK	20	/* delay loop iterations inside the lock */
+
+#define LHB_THREADS	8
+#define LHB_LOOPS	500
+#define LHB_WORK	200	/* delay loop iterations inside the lock */
+#define LHB_THINK	100	/* delay loop iterations outside it */
+
+#define ULB_LOOPS	100000
+
+/*
+ * One benchmark run: lockbench_run forks LB_NTHREADS threads that
+ * each call LB_BODY, lets them all go at once, and waits for them.
+ * The body gets the struct, and its thread number.
+ */
+struct lockbench {
+	void (*lb_body)(struct lockbench *lb, unsigned long num);
+	struct lock *lb_lock;		/* for the body, if it wants one */
+	volatile unsigned long lb_counter;	/* likewise; zeroed per run */
+	volatile bool lb_stop;		/* set when a timed run is up */
+	struct semaphore *lb_start;
+	struct semaphore *lb_done;
+	uint64_t lb_elapsed;		/* ns from the start to the last done */
+	uint64_t lb_switches;		/* context switches meanwhile */
+};
+
+static
+void
+lockbench_thread(void *ptr, unsigned long num)
+{
+	struct lockbench *lb = ptr;
+
+	P(lb->lb_start);
+	lb->lb_body(lb, num);
+	V(lb->lb_done);
+}
+
+/*
+ * Run BODY in NTHREADS threads. If SECS isn't 0, set lb_stop after
+ * that many seconds; the body should watch it. Fills in lb_elapsed
+ * and lb_switches. The caller sets up lb_lock if the body uses it.
+ */
+static
+void
+lockbench_run(struct lockbench *lb, const char *name, unsigned nthreads,
+	      unsigned secs, void (*body)(struct lockbench *, unsigned long))
+{
+	uint64_t start, switches;
+	unsigned i;
+	int result;
+
+	lb->lb_body = body;
+	lb->lb_counter = 0;
+	lb->lb_stop = false;
+	lb->lb_start = sem_create(name, 0);
+	lb->lb_done = sem_create(name, 0);
+	if (lb->lb_start == NULL || lb->lb_done == NULL) {
+		panic("%s: out of memory\n", name);
+	}
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork(name, NULL, lockbench_thread, lb, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n", name,
+			      strerror(result));
+		}
+	}
+
+	start = clock_nsecs();
+	switches = counter_read(CTR_SWITCHES);
+	for (i=0; i<nthreads; i++) {
+		V(lb->lb_start);
+	}
+	if (secs > 0) {
+		clocksleep(secs);
+		lb->lb_stop = true;
+	}
+	for (i=0; i<nthreads; i++) {
+		P(lb->lb_done);
+	}
+	lb->lb_switches = counter_read(CTR_SWITCHES) - switches;
+	lb->lb_elapsed = clock_nsecs() - start;
+
+	sem_destroy(lb->lb_start);
+	sem_destroy(lb->lb_done);
+}
+
+////////////////////////////////////////////////////////////
+
+static
+void
+lkb_body(struct lockbench *lb, unsigned long num)
+{
+	volatile unsigned delay;
+	unsigned i;
+
+	(void)num;
+
+	for (i=0; i<LKB_LOOPS; i++) {
+		lock_acquire(lb->lb_lock);
+		lb->lb_counter++;
+		for (delay=0; delay<LKB_WORK; delay++) {
+			/* nothing */
+		}
+		lock_release(lb->lb_lock);
+	}
+}
+
+/*
+ * One run with lock_spin_enabled set to SPIN. Returns false if the
+ * count comes out wrong.
+ */
+static
+bool
+lkb_run(struct lockbench *lb, bool spin)
+{
+	lock_spin_enabled = spin;
+	lockbench_run(lb, "lkb", LKB_THREADS, 0, lkb_body);
+
+	kprintf("lkb: spinning %s: %u acquisitions in %llu us, "
+		"%llu per second\n", spin ? "on " : "off",
+		LKB_THREADS * LKB_LOOPS, lb->lb_elapsed / 1000,
+		(unsigned long long)LKB_THREADS * LKB_LOOPS * 1000000000ULL /
+		(lb->lb_elapsed ? lb->lb_elapsed : 1));
+
+	return lb->lb_counter == LKB_THREADS * LKB_LOOPS;
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	struct lockbench lb;
+	bool saved, ok;
+
+	(void)nargs;
+	(void)args;
+
+	lb.lb_lock = lock_create("lkb");
+	if (lb.lb_lock == NULL) {
+		panic("lkb: out of memory\n");
+	}
+
+	kprintf("lkb: %u threads on %u cpus\n", LKB_THREADS, num_cpus);
+
+	saved = lock_spin_enabled;
+	ok = lkb_run(&lb, false);
+	ok = lkb_run(&lb, true) && ok;
+	lock_spin_enabled = saved;
+
+	lock_destroy(lb.lb_lock);
+
+	success(ok ? TEST161_SUCCESS : TEST161_FAIL, SECRET, "lkb");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+static struct spinlock slb_spinlock;
+static struct qspinlock slb_qspinlock;
+static bool slb_queued;
+static volatile unsigned long slb_count[SLB_THREADS];
+static volatile unsigned long slb_inside;
+static volatile bool slb_failed;
+
+static
+void
+slb_critical(void)
+{
+	volatile unsigned delay;
+
+	if (++slb_inside != 1) {
+		slb_failed = true;
+	}
+	for (delay=0; delay<SLB_WORK; delay++) {
+		/* nothing */
+	}
+	slb_inside--;
+}
+
+static
+void
+slb_body(struct lockbench *lb, unsigned long num)
+{
+	while (!lb->lb_stop) {
+		if (slb_queued) {
+			qspinlock_acquire(&slb_qspinlock);
+			slb_critical();
+			qspinlock_release(&slb_qspinlock);
+		}
+		else {
+			spinlock_acquire(&slb_spinlock);
+			slb_critical();
+			spinlock_release(&slb_spinlock);
+		}
+		slb_count[num]++;
+	}
+}
+
+static
+void
+slb_run(bool queued)
+{
+	struct lockbench lb;
+	unsigned long total, least, most;
+	unsigned i;
+
+	slb_queued = queued;
+	for (i=0; i<SLB_THREADS; i++) {
+		slb_count[i] = 0;
+	}
+
+	lockbench_run(&lb, "slb", SLB_THREADS, 1, slb_body);
+
+	total = 0;
+	least = most = slb_count[0];
+	for (i=0; i<SLB_THREADS; i++) {
+		total += slb_count[i];
+		if (slb_count[i] < least) {
+			least = slb_count[i];
+		}
+		if (slb_count[i] > most) {
+			most = slb_count[i];
+		}
+	}
+	kprintf("slb: %s: %lu acquisitions/sec, per thread %lu to %lu\n",
+		queued ? "queued" : "basic ", total, least, most);
+}
+
+int
+spinlockbench(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	spinlock_init(&slb_spinlock);
+	qspinlock_init(&slb_qspinlock);
+
+	kprintf("slb: %u threads on %u cpus\n", SLB_THREADS, num_cpus);
+
+	slb_failed = false;
+	slb_run(false);
+	slb_run(true);
+
+	spinlock_cleanup(&slb_spinlock);
+	qspinlock_cleanup(&slb_qspinlock);
+
+	success(slb_failed ? TEST161_FAIL : TEST161_SUCCESS, SECRET, "slb");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+static
+void
+lhb_body(struct lockbench *lb, unsigned long num)
+{
+	volatile unsigned delay;
+	unsigned i;
+
+	(void)num;
+
+	for (i=0; i<LHB_LOOPS; i++) {
+		lock_acquire(lb->lb_lock);
+		lb->lb_counter++;
+		for (delay=0; delay<LHB_WORK; delay++) {
+			/* nothing */
+		}
+		lock_release(lb->lb_lock);
+		for (delay=0; delay<LHB_THINK; delay++) {
+			/* nothing */
+		}
+	}
+}
+
+/*
+ * One run with lock_handoff_enabled set to HANDOFF. Returns false if
+ * the count comes out wrong.
+ */
+static
+bool
+lhb_run(struct lockbench *lb, bool handoff)
+{
+	lock_handoff_enabled = handoff;
+	lockbench_run(lb, "lhb", LHB_THREADS, 0, lhb_body);
+
+	kprintf("lhb: handoff %s: %u acquisitions in %llu us, "
+		"%llu switches, %llu.%02llu per acquisition\n",
+		handoff ? "on " : "off", LHB_THREADS * LHB_LOOPS,
+		lb->lb_elapsed / 1000, lb->lb_switches,
+		lb->lb_switches / (LHB_THREADS * LHB_LOOPS),
+		lb->lb_switches * 100 / (LHB_THREADS * LHB_LOOPS) % 100);
+
+	return lb->lb_counter == LHB_THREADS * LHB_LOOPS;
+}
+
+int
+lockhandoffbench(int nargs, char **args)
+{
+	struct lockbench lb;
+	bool savedspin, savedhandoff, ok;
+
+	(void)nargs;
+	(void)args;
+
+	lb.lb_lock = lock_create("lhb");
+	if (lb.lb_lock == NULL) {
+		panic("lhb: out of memory\n");
+	}
+
+	kprintf("lhb: %u threads on %u cpus\n", LHB_THREADS, num_cpus);
+
+	savedspin = lock_spin_enabled;
+	savedhandoff = lock_handoff_enabled;
+	lock_spin_enabled = false;
+	ok = lhb_run(&lb, false);
+	ok = lhb_run(&lb, true) && ok;
+	lock_spin_enabled = savedspin;
+	lock_handoff_enabled = savedhandoff;
+
+	lock_destroy(lb.lb_lock);
+
+	success(ok ? TEST161_SUCCESS : TEST161_FAIL, SECRET, "lhb");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Print the round trips per second for ULB_LOOPS of them in ELAPSED
+ * nanoseconds.
+ */
+static
+void
+ulb_report(const char *what, uint64_t elapsed)
+{
+	kprintf("ulb: %s: %u round trips in %llu us, %llu per second\n",
+		what, ULB_LOOPS, elapsed / 1000,
+		(unsigned long long)ULB_LOOPS * 1000000000ULL /
+		(elapsed ? elapsed : 1));
+}
+
+int
+uncontendedlockbench(int nargs, char **args)
+{
+	struct lock *lock;
+	struct semaphore *sem;
+	uint64_t start;
+	unsigned i;
+	bool ok;
+
+	(void)nargs;
+	(void)args;
+
+	lock = lock_create("ulb");
+	sem = sem_create("ulb", 2);
+	if (lock == NULL || sem == NULL) {
+		panic("ulb: out of memory\n");
+	}
+
+	start = clock_nsecs();
+	for (i=0; i<ULB_LOOPS; i++) {
+		lock_acquire(lock);
+		lock_release(lock);
+	}
+	ulb_report("lock     ", clock_nsecs() - start);
+
+	start = clock_nsecs();
+	for (i=0; i<ULB_LOOPS; i++) {
+		P(sem);
+		V(sem);
+	}
+	ulb_report("semaphore", clock_nsecs() - start);
+
+	ok = !lock_do_i_hold(lock) && sem->sem_count == 2;
+
+	lock_destroy(lock);
+	sem_destroy(sem);
+
+	success(ok ? TEST161_SUCCESS : TEST161_FAIL, SECRET, "ulb");
+	return 0;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Orphan reaping test. Runs /testbin/orphantest, which leaves
+ * thousands of processes for the kernel to clean up, and checks that
+ * the kernel heap is back where it started afterwards.
+ *
+ * The program runs once first to warm up: the process table keeps the
+ * leaves it grows into, and the file system keeps the vnodes it looks
+ * up, and neither is a leak.
+ */
+
+#include <types.h>
+#include <kern/wait.h>
+#include <lib.h>
+#include <thread.h>
+#include <proc.h>
+#include <vm.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define ORPHT_PROG	"/testbin/orphantest"
+#define ORPHT_SLACK	(4 * PAGE_SIZE)	/* allowed growth, in bytes */
+
+static
+void
+orpht_thread(void *ptr, unsigned long junk)
+{
+	char progname[sizeof(ORPHT_PROG)];
+	int result;
+
+	(void)ptr;
+	(void)junk;
+
+	/* runprogram consumes its argument. */
+	strcpy(progname, ORPHT_PROG);
+	result = runprogram(progname);
+	kprintf("orpht: running %s failed: %s\n", ORPHT_PROG,
+		strerror(result));
+}
+
+/*
+ * Run the program and wait until it and everything it left behind
+ * is gone. Returns its wait status, or -1 if it couldn't be run.
+ */
+static
+int
+orpht_run(void)
+{
+	struct proc *proc;
+	unsigned tc;
+	int result;
+	int status;
+
+	proc = proc_create_runprogram(ORPHT_PROG);
+	if (proc == NULL) {
+		return -1;
+	}
+
+	tc = thread_count;
+	result = thread_fork(ORPHT_PROG, proc, orpht_thread, NULL, 0);
+	if (result) {
+		proc_table_remove(proc);
+		return -1;
+	}
+
+	result = proc_claimchild(proc->pid, false, &proc);
+	if (result) {
+		panic("orpht: proc_claimchild failed: %s\n",
+		      strerror(result));
+	}
+	status = proc->exit_status;
+	proc_table_remove(proc);
+
+	thread_wait_for_count(tc);
+	proc_table_drain();
+	return status;
+}
+
+int
+orphantest(int nargs, char **args)
+{
+	unsigned long before, after;
+	int status;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf_n("Starting orpht...\n");
+
+	status = orpht_run();
+	if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		kprintf("orpht: %s failed\n", ORPHT_PROG);
+		success(TEST161_FAIL, SECRET, "orpht");
+		return 0;
+	}
+
+	before = kheap_getused();
+	status = orpht_run();
+	after = kheap_getused();
+	kprintf_n("orpht: heap %lu bytes before, %lu after\n", before, after);
+
+	if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		kprintf("orpht: %s failed\n", ORPHT_PROG);
+		success(TEST161_FAIL, SECRET, "orpht");
+		return 0;
+	}
+	if (after > before + ORPHT_SLACK) {
+		kprintf("orpht: leaked %lu bytes\n", after - before);
+		success(TEST161_FAIL, SECRET, "orpht");
+		return 0;
+	}
+
+	success(TEST161_SUCCESS, SECRET, "orpht");
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Process table test. Puts more processes in the table than the
+ * first leaf holds, takes every other one out and puts new ones in
+ * the holes, and checks the lookups all along.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <epoch.h>
+#include <proc.h>
+#include <test.h>
+
+#define PIDT_PROCS	1000
+
+static
+void
+pidt_check(struct proc *proc)
+{
+	int spl;
+
+	KASSERT(proc->pid >= PID_MIN && proc->pid <= PID_MAX);
+	spl = epoch_enter();
+	KASSERT(proc_table_lookup(proc->pid) == proc);
+	epoch_exit(spl);
+}
+
+static
+struct proc *
+pidt_add(void)
+{
+	struct proc *proc;
+	int result;
+
+	proc = proc_create_child("pidt");
+	if (proc == NULL) {
+		panic("pidt: proc_create_child failed\n");
+	}
+	result = proc_table_insert(proc);
+	if (result) {
+		panic("pidt: proc_table_insert failed: %s\n",
+		      strerror(result));
+	}
+	pidt_check(proc);
+	return proc;
+}
+
+int
+pidtest(int nargs, char **args)
+{
+	struct proc **procs;
+	pid_t maxpid = 0;
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting PID table test...\n");
+
+	procs = kmalloc(PIDT_PROCS * sizeof(*procs));
+	if (procs == NULL) {
+		panic("pidt: out of memory\n");
+	}
+
+	for (i=0; i<PIDT_PROCS; i++) {
+		procs[i] = pidt_add();
+		if (procs[i]->pid > maxpid) {
+			maxpid = procs[i]->pid;
+		}
+	}
+	KASSERT(maxpid >= PIDT_PROCS);
+
+	for (i=0; i<PIDT_PROCS; i+=2) {
+		proc_table_remove(procs[i]);
+		procs[i] = pidt_add();
+	}
+	for (i=0; i<PIDT_PROCS; i++) {
+		pidt_check(procs[i]);
+	}
+
+	for (i=0; i<PIDT_PROCS; i++) {
+		proc_table_remove(procs[i]);
+	}
+	kfree(procs);
+
+	kprintf("PID table test complete\n");
+	return 0;
+}
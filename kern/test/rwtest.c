@@ -6,6 +6,7 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -13,15 +14,223 @@
 #include <spinlock.h>
 
 /*
- * Use these stubs to test your reader-writer locks.
+ * rwt1 and rwt2 run RWT_THREADS threads over one lock, RWT_LOOPS
+ * times each. Writers set testval1 and testval2 to the same new value
+ * in two steps; readers check they match. Both print how many lock
+ * operations per second they got, so runs on different numbers of
+ * cpus can be compared.
+ *
+ * rwt1 uses one writer in RWT1_WRITERS threads and runs the rwlock
+ * with writer preference and then reader preference.
+ *
+ * rwt2 is read-mostly (one writer in RWT2_WRITERS) and runs the
+ * rwlock and then the big-reader lock, and reports the most readers
+ * it saw inside at once.
+ *
+ * rwt3-5 panic on success, so they have no numbers to report.
  */
 
+#define RWT_THREADS	16
+#define RWT_LOOPS	200
+#define RWT_WORK	50	/* delay loop iterations inside the lock */
+#define RWT1_WRITERS	4
+#define RWT2_WRITERS	16
+
+static volatile unsigned long testval1;
+static volatile unsigned long testval2;
+
+static struct rwlock *testrw = NULL;
+static struct brlock *testbr = NULL;
+static struct semaphore *startsem = NULL;
+static struct semaphore *donesem = NULL;
+
+static struct spinlock status_lock;
+static bool test_status = TEST161_FAIL;
+static unsigned rwt_writers;
+static unsigned rwt_inside;
+static unsigned rwt_maxinside;
+
+static
+void
+rwt_delay(void)
+{
+	volatile unsigned delay;
+
+	for (delay=0; delay<RWT_WORK; delay++) {
+		/* nothing */
+	}
+}
+
+static
+void
+rwt_reader(unsigned long i)
+{
+	if (testbr != NULL) {
+		brlock_acquire_read(testbr);
+	} else {
+		rwlock_acquire_read(testrw);
+	}
+
+	spinlock_acquire(&status_lock);
+	rwt_inside++;
+	if (rwt_inside > rwt_maxinside) {
+		rwt_maxinside = rwt_inside;
+	}
+	spinlock_release(&status_lock);
+
+	rwt_delay();
+	if (i % 8 == 0) {
+		thread_yield();
+	}
+	if (testval1 != testval2) {
+		spinlock_acquire(&status_lock);
+		test_status = TEST161_FAIL;
+		spinlock_release(&status_lock);
+	}
+
+	spinlock_acquire(&status_lock);
+	rwt_inside--;
+	spinlock_release(&status_lock);
+
+	if (testbr != NULL) {
+		brlock_release_read(testbr);
+	} else {
+		rwlock_release_read(testrw);
+	}
+}
+
+static
+void
+rwt_writer(unsigned long i)
+{
+	if (testbr != NULL) {
+		brlock_acquire_write(testbr);
+	} else {
+		rwlock_acquire_write(testrw);
+	}
+
+	testval1 = i;
+	rwt_delay();
+	if (i % 8 == 0) {
+		thread_yield();
+	}
+	testval2 = i;
+
+	if (testbr != NULL) {
+		brlock_release_write(testbr);
+	} else {
+		rwlock_release_write(testrw);
+	}
+}
+
+static
+void
+rwt_thread(void *junk, unsigned long num)
+{
+	unsigned long i;
+
+	(void)junk;
+
+	P(startsem);
+	for (i=0; i<RWT_LOOPS; i++) {
+		kprintf_t(".");
+		if (num % rwt_writers == 0) {
+			rwt_writer(num * RWT_LOOPS + i);
+		} else {
+			rwt_reader(i);
+		}
+	}
+	V(donesem);
+}
+
+/*
+ * One run over testrw or testbr, whichever is set. Prints the
+ * throughput tagged with NAME and DESC.
+ */
+static
+void
+rwt_run(const char *name, const char *desc)
+{
+	uint64_t start, elapsed;
+	unsigned i;
+	int result;
+
+	testval1 = testval2 = 0;
+	rwt_inside = rwt_maxinside = 0;
+
+	for (i=0; i<RWT_THREADS; i++) {
+		result = thread_fork(name, NULL, rwt_thread, NULL, i);
+		if (result) {
+			panic("%s: thread_fork failed: %s\n", name,
+			      strerror(result));
+		}
+	}
+
+	start = clock_nsecs();
+	for (i=0; i<RWT_THREADS; i++) {
+		V(startsem);
+	}
+	for (i=0; i<RWT_THREADS; i++) {
+		P(donesem);
+	}
+	elapsed = clock_nsecs() - start;
+
+	kprintf_n("\n");
+	kprintf("%s: %s: %u operations in %llu us, %llu per second, "
+		"at most %u readers inside\n", name, desc,
+		RWT_THREADS * RWT_LOOPS, elapsed / 1000,
+		(unsigned long long)RWT_THREADS * RWT_LOOPS * 1000000000ULL /
+		(elapsed ? elapsed : 1), rwt_maxinside);
+}
+
+static
+void
+rwt_setup(const char *name)
+{
+	spinlock_init(&status_lock);
+	test_status = TEST161_SUCCESS;
+
+	startsem = sem_create("startsem", 0);
+	donesem = sem_create("donesem", 0);
+	if (startsem == NULL || donesem == NULL) {
+		panic("%s: sem_create failed\n", name);
+	}
+	kprintf_n("%s: %u threads on %u cpus\n", name, RWT_THREADS, num_cpus);
+}
+
+static
+void
+rwt_cleanup(void)
+{
+	sem_destroy(startsem);
+	sem_destroy(donesem);
+	startsem = donesem = NULL;
+	spinlock_cleanup(&status_lock);
+}
+
 int rwtest(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt1 unimplemented\n");
-	success(TEST161_FAIL, SECRET, "rwt1");
+	kprintf_n("Starting rwt1...\n");
+	rwt_setup("rwt1");
+	rwt_writers = RWT1_WRITERS;
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt1: rwlock_create failed\n");
+	}
+
+	rwlock_set_writerpref(testrw, true);
+	rwt_run("rwt1", "writer preference");
+	rwlock_set_writerpref(testrw, false);
+	rwt_run("rwt1", "reader preference");
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+	rwt_cleanup();
+
+	success(test_status, SECRET, "rwt1");
 
 	return 0;
 }
@@ -30,8 +239,38 @@ int rwtest2(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt2 unimplemented\n");
-	success(TEST161_FAIL, SECRET, "rwt2");
+	kprintf_n("Starting rwt2...\n");
+	rwt_setup("rwt2");
+	rwt_writers = RWT2_WRITERS;
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt2: rwlock_create failed\n");
+	}
+	rwt_run("rwt2", "rwlock ");
+	rwlock_destroy(testrw);
+	testrw = NULL;
+
+	/* Readers have to overlap, or this isn't a reader-writer lock. */
+	if (rwt_maxinside < 2) {
+		test_status = TEST161_FAIL;
+	}
+
+	testbr = brlock_create("testbr");
+	if (testbr == NULL) {
+		panic("rwt2: brlock_create failed\n");
+	}
+	rwt_run("rwt2", "brlock ");
+	brlock_destroy(testbr);
+	testbr = NULL;
+
+	if (rwt_maxinside < 2) {
+		test_status = TEST161_FAIL;
+	}
+
+	rwt_cleanup();
+
+	success(test_status, SECRET, "rwt2");
 
 	return 0;
 }
@@ -40,9 +279,24 @@ int rwtest3(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt3 unimplemented\n");
+	kprintf_n("Starting rwt3...\n");
+	kprintf_n("(This test panics on success!)\n");
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt3: rwlock_create failed\n");
+	}
+
+	secprintf(SECRET, "Should panic...", "rwt3");
+	rwlock_release_read(testrw);
+
+	/* Should not get here on success. */
+
 	success(TEST161_FAIL, SECRET, "rwt3");
 
+	/* Don't do anything that could panic. */
+
+	testrw = NULL;
 	return 0;
 }
 
@@ -50,9 +304,24 @@ int rwtest4(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt4 unimplemented\n");
+	kprintf_n("Starting rwt4...\n");
+	kprintf_n("(This test panics on success!)\n");
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt4: rwlock_create failed\n");
+	}
+
+	secprintf(SECRET, "Should panic...", "rwt4");
+	rwlock_release_write(testrw);
+
+	/* Should not get here on success. */
+
 	success(TEST161_FAIL, SECRET, "rwt4");
 
+	/* Don't do anything that could panic. */
+
+	testrw = NULL;
 	return 0;
 }
 
@@ -60,8 +329,24 @@ int rwtest5(int nargs, char **args) {
 	(void)nargs;
 	(void)args;
 
-	kprintf_n("rwt5 unimplemented\n");
+	kprintf_n("Starting rwt5...\n");
+	kprintf_n("(This test panics on success!)\n");
+
+	testrw = rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwt5: rwlock_create failed\n");
+	}
+
+	secprintf(SECRET, "Should panic...", "rwt5");
+	rwlock_acquire_read(testrw);
+	rwlock_destroy(testrw);
+
+	/* Should not get here on success. */
+
 	success(TEST161_FAIL, SECRET, "rwt5");
 
+	/* Don't do anything that could panic. */
+
+	testrw = NULL;
 	return 0;
 }
@@ -38,8 +38,10 @@
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
+#include <proc.h>
 #include <synch.h>
 #include <test.h>
+#include <kern/resource.h>
 #include <kern/test161.h>
 #include <spinlock.h>
 
@@ -469,6 +471,182 @@ locktest5(int nargs, char **args) {
   return 0;
 }
 
+/*
+ * lt6: priority inversion. A low-priority thread takes testlock, a
+ * middle-priority thread hogs the cpu, and then a high-priority thread
+ * wakes up and waits for the lock. Without priority inheritance the
+ * low thread can't get back on the cpu to let go until the hog has
+ * sunk to its level, which takes a good part of a second; with it the
+ * high thread should wait about as long as the low one holds the lock.
+ * Each thread runs in a process of its own so it can have its own
+ * nice value. Meant for one cpu.
+ */
+#define LT6_HOLD_NSECS	100000000ULL	/* running time holding the lock */
+#define LT6_SLACK_NSECS	50000000ULL	/* allowed wait on top of that */
+#define LT6_HOG_NSECS	2000000000ULL	/* longest the hog runs */
+#define LT6_GAP_NSECS	1000000ULL	/* a longer gap means we were preempted */
+
+static volatile bool lt6_highdone;
+static uint64_t lt6_wait;
+
+/*
+ * Spin for NSECS of our own running time, not counting time we spend
+ * preempted.
+ */
+static
+void
+lt6_spin(uint64_t nsecs)
+{
+	uint64_t ran = 0, last, now;
+
+	last = clock_nsecs();
+	while (ran < nsecs) {
+		now = clock_nsecs();
+		if (now - last < LT6_GAP_NSECS) {
+			ran += now - last;
+		}
+		last = now;
+	}
+}
+
+static
+void
+lt6_low(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	lock_acquire(testlock);
+	V(testsem);
+	lt6_spin(LT6_HOLD_NSECS);
+	lock_release(testlock);
+	V(donesem);
+}
+
+static
+void
+lt6_middle(void *junk, unsigned long num)
+{
+	uint64_t start, now;
+	bool woke = false;
+
+	(void)junk;
+	(void)num;
+
+	start = clock_nsecs();
+	do {
+		now = clock_nsecs();
+		/* Let the high thread go once we're well under way. */
+		if (!woke && now - start > LT6_SLACK_NSECS) {
+			V(testsem2);
+			woke = true;
+		}
+	} while (!lt6_highdone && now - start < LT6_HOG_NSECS);
+	if (!woke) {
+		V(testsem2);
+	}
+	V(donesem);
+}
+
+static
+void
+lt6_high(void *junk, unsigned long num)
+{
+	uint64_t start;
+
+	(void)junk;
+	(void)num;
+
+	P(testsem2);
+	start = clock_nsecs();
+	lock_acquire(testlock);
+	lt6_wait = clock_nsecs() - start;
+	lock_release(testlock);
+	lt6_highdone = true;
+	V(donesem);
+}
+
+int
+locktest6(int nargs, char **args)
+{
+	static const struct {
+		const char *name;
+		int nice;
+		void (*func)(void *, unsigned long);
+	} lt6_threads[3] = {
+		{ "lt6-low",	PRIO_MAX,	lt6_low },
+		{ "lt6-middle",	0,		lt6_middle },
+		{ "lt6-high",	PRIO_MIN,	lt6_high },
+	};
+	struct proc *procs[3];
+	unsigned i, tc;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf_n("Starting lt6...\n");
+
+	tc = thread_count;
+	lt6_highdone = false;
+	lt6_wait = 0;
+
+	testlock = lock_create("testlock");
+	testsem = sem_create("testsem", 0);
+	testsem2 = sem_create("testsem2", 0);
+	donesem = sem_create("donesem", 0);
+	if (testlock == NULL || testsem == NULL || testsem2 == NULL ||
+	    donesem == NULL) {
+		panic("lt6: out of memory\n");
+	}
+
+	for (i=0; i<3; i++) {
+		procs[i] = proc_create_child(lt6_threads[i].name);
+		if (procs[i] == NULL) {
+			panic("lt6: proc_create_child failed\n");
+		}
+		procs[i]->p_nice = lt6_threads[i].nice;
+	}
+
+	for (i=0; i<3; i++) {
+		result = thread_fork(lt6_threads[i].name, procs[i],
+				     lt6_threads[i].func, NULL, 0);
+		if (result) {
+			panic("lt6: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+		if (i == 0) {
+			/* The low thread has to have the lock first. */
+			P(testsem);
+		}
+	}
+	for (i=0; i<3; i++) {
+		P(donesem);
+	}
+
+	/* Wait for the threads to leave their processes. */
+	thread_wait_for_count(tc);
+	for (i=0; i<3; i++) {
+		proc_destroy(procs[i]);
+	}
+
+	kprintf_n("lt6: high-priority thread waited %llu us for a lock "
+		  "held for %llu us\n", lt6_wait / 1000,
+		  LT6_HOLD_NSECS / 1000);
+
+	lock_destroy(testlock);
+	sem_destroy(testsem);
+	sem_destroy(testsem2);
+	sem_destroy(donesem);
+	testlock = NULL;
+	testsem = testsem2 = donesem = NULL;
+
+	success(lt6_wait <= LT6_HOLD_NSECS + LT6_SLACK_NSECS ?
+		TEST161_SUCCESS : TEST161_FAIL, SECRET, "lt6");
+
+	return 0;
+}
+
 static
 void
 cvtestthread(void *junk, unsigned long num)
@@ -32,15 +32,17 @@
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <epoch.h>
 #include <thread.h>
 #include <current.h>
+#include <mainbus.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution than one second.
+ * Callbacks at specific points in the future, and timed sleeps, go
+ * through the timer wheel in timeout.c, which hardclock advances on
+ * cpu 0. Their resolution is one hardclock (1/HZ seconds).
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -52,12 +54,7 @@
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
-
-/*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-static struct spinlock lbolt_lock;
+#define IDLE_HARDCLOCKS		HZ	/* Most ticks an idle cpu skips. */
 
 /*
  * Setup.
@@ -65,45 +62,123 @@ static struct spinlock lbolt_lock;
 void
 hardclock_bootstrap(void)
 {
-	spinlock_init(&lbolt_lock);
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
-	}
+	timeout_bootstrap();
 }
 
 /*
  * This is called once per second, on one processor, by the timer
- * code.
+ * code. Timed sleeps use the timer wheel (timeout.c) now, so there
+ * is nothing to do here.
  */
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	spinlock_acquire(&lbolt_lock);
-	wchan_wakeall(lbolt, &lbolt_lock);
-	spinlock_release(&lbolt_lock);
+}
+
+/*
+ * Account for TICKS hardclocks this cpu skipped while idle, and start
+ * taking them again.
+ */
+static
+void
+hardclock_catchup(unsigned ticks)
+{
+	curcpu->c_tickless = 0;
+	epoch_unidle();
+	counter_add(CTR_TICKS_SKIPPED, ticks);
+	if (curcpu->c_number == 0) {
+		timeout_unidle();
+		while (ticks-- > 0) {
+			timeout_tick();
+		}
+	}
+}
+
+/*
+ * Tickless idle. Called by the idle loop, with interrupts off, before
+ * it waits for an interrupt. An idle cpu has nothing to do on a tick
+ * but count it, so have the timer skip up to IDLE_HARDCLOCKS of them,
+ * or on cpu 0 up to when the timer wheel next needs turning.
+ */
+void
+hardclock_idle(void)
+{
+	unsigned ticks;
+
+	KASSERT(curcpu->c_tickless == 0);
+
+	ticks = IDLE_HARDCLOCKS;
+	if (curcpu->c_number == 0) {
+		ticks = timeout_idle(ticks);
+	}
+	if (ticks < 2 || !mainbus_timer_stretch(ticks)) {
+		if (curcpu->c_number == 0) {
+			timeout_unidle();
+		}
+		return;
+	}
+	curcpu->c_tickless = ticks;
+	epoch_idle();
+}
+
+/*
+ * Called by the idle loop after whatever interrupt woke it up. If that
+ * wasn't the stretched timer itself (see hardclock), put the timer
+ * back and count the ticks that went by.
+ */
+void
+hardclock_unidle(void)
+{
+	if (curcpu->c_tickless != 0) {
+		hardclock_catchup(mainbus_timer_restore(curcpu->c_tickless));
+	}
 }
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, except while the processor is idle.
  */
 void
 hardclock(void)
 {
+	int64_t ticks;
+
 	/*
 	 * Collect statistics here as desired.
 	 */
 
-	curcpu->c_hardclocks++;
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
+	if (curcpu->c_tickless != 0) {
+		/* A stretched timer ran out; this is its last tick. */
+		hardclock_catchup(curcpu->c_tickless - 1);
+	}
+	counter_inc(CTR_HARDCLOCKS);
+	ticks = counter_local(CTR_HARDCLOCKS);
+	epoch_tick();
+	if (curcpu->c_number == 0) {
+		timeout_tick();
+	}
+	if ((ticks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
+	if ((ticks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	thread_yield();
+	if (thread_tick()) {
+		counter_inc(CTR_PREEMPTS);
+		thread_yield();
+	}
+}
+
+/*
+ * Fetch the time in nanoseconds.
+ */
+uint64_t
+clock_nsecs(void)
+{
+	struct timespec ts;
+
+	gettime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
 /*
@@ -112,10 +187,7 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-	spinlock_acquire(&lbolt_lock);
-	while (num_secs > 0) {
-		wchan_sleep(lbolt, &lbolt_lock);
-		num_secs--;
+	if (num_secs > 0) {
+		timeout_sleep(num_secs * HZ);
 	}
-	spinlock_release(&lbolt_lock);
 }
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Per-cpu statistics counters. See counter.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <membar.h>
+#include <current.h>
+#include <counter.h>
+
+static const char *const counter_names[NCOUNTERS] = {
+	[CTR_HARDCLOCKS] = "hardclocks",
+	[CTR_TICKS_SKIPPED] = "ticks_skipped",
+	[CTR_SWITCHES] = "switches",
+	[CTR_WAKEUPS] = "wakeups",
+	[CTR_WAKEUP_NS] = "wakeup_ns",
+	[CTR_PREEMPTS] = "preempts",
+	[CTR_MIGRATIONS] = "migrations",
+	[CTR_STEALS] = "steals",
+	[CTR_REMOTE_WAKEUPS] = "remote_wakeups",
+	[CTR_WAKEQ_DRAINS] = "wakeq_drains",
+	[CTR_IPIS] = "ipis",
+	[CTR_PAGES_USED] = "pages_used",
+	[CTR_VM_FAULTS] = "vm_faults",
+	[CTR_TLB_SHOOTDOWNS] = "tlb_shootdowns",
+	[CTR_SYSCALLS] = "syscalls",
+	[CTR_SYSCALL_ERRORS] = "syscall_errors",
+};
+
+/*
+ * Counts from before the first cpu structure exists (kmalloc is in
+ * use before thread_bootstrap). There's only one cpu running then,
+ * with interrupts off.
+ */
+static int64_t counter_early[NCOUNTERS];
+
+void
+counter_add(unsigned ctr, int64_t n)
+{
+	int spl;
+
+	KASSERT(ctr < NCOUNTERS);
+
+	if (!CURCPU_EXISTS()) {
+		counter_early[ctr] += n;
+		return;
+	}
+
+	/*
+	 * Turning interrupts off keeps us on this cpu, and keeps an
+	 * interrupt handler here from counting in the middle of our
+	 * read-modify-write.
+	 */
+	spl = splhigh();
+	curcpu->c_countergen++;
+	membar_store_store();
+	curcpu->c_counters[ctr] += n;
+	membar_store_store();
+	curcpu->c_countergen++;
+	splx(spl);
+}
+
+int64_t
+counter_local(unsigned ctr)
+{
+	return counter_cpu(curcpu, ctr);
+}
+
+int64_t
+counter_cpu(struct cpu *c, unsigned ctr)
+{
+	volatile int64_t *slot;
+	unsigned gen;
+	int64_t val;
+
+	KASSERT(ctr < NCOUNTERS);
+
+	/* Don't return half of an update (see counter.h). */
+	slot = &c->c_counters[ctr];
+	do {
+		gen = c->c_countergen;
+		membar_load_load();
+		val = *slot;
+		membar_load_load();
+	} while ((gen & 1) != 0 || c->c_countergen != gen);
+	return val;
+}
+
+int64_t
+counter_read(unsigned ctr)
+{
+	int64_t total;
+	unsigned i;
+
+	KASSERT(ctr < NCOUNTERS);
+
+	total = counter_early[ctr];
+	for (i=0; i<num_cpus; i++) {
+		total += counter_cpu(cpu_lookup(i), ctr);
+	}
+	return total;
+}
+
+void
+counter_print(int cpunum)
+{
+	struct cpu *c = NULL;
+	unsigned i;
+
+	if (cpunum >= 0) {
+		if ((unsigned)cpunum >= num_cpus) {
+			kprintf("No cpu %d\n", cpunum);
+			return;
+		}
+		c = cpu_lookup(cpunum);
+	}
+
+	for (i=0; i<NCOUNTERS; i++) {
+		kprintf("%-16s %16lld\n", counter_names[i],
+			(long long)(c != NULL ? counter_cpu(c, i) :
+				    counter_read(i)));
+	}
+}
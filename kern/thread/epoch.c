@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Epoch-based reclamation.
+ *
+ * Each cpu writes the global epoch into its own slot on every
+ * hardclock. A hardclock can't happen inside a read section, since
+ * those run with interrupts off, so this marks the cpu as having
+ * finished whatever it was reading. Once every cpu has seen the
+ * current epoch, cpu 0 moves it on by one.
+ *
+ * An object unlinked in epoch E may still be held by a reader that
+ * started before its cpu saw E, so the move to E+1 doesn't free it.
+ * But every cpu then has to tick again, after the unlink, before the
+ * epoch reaches E+2, and by then no reader can have it.
+ *
+ * An idle cpu that stops ticking says so first, and doesn't hold
+ * anything up: it can't be reading, and it notes the epoch again
+ * before it leaves the idle loop. A busy cpu that stops ticking
+ * holds the epoch where it is; objects are just freed later.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <membar.h>
+#include <current.h>
+#include <epoch.h>
+#include <platform/maxcpus.h>
+
+static volatile unsigned epoch_global;	/* written only by cpu 0 */
+
+static struct {
+	volatile unsigned ec_seen;	/* last epoch this cpu ticked in */
+	volatile bool ec_idle;		/* not ticking, and not reading */
+	char ec_pad[59];		/* one per cache line */
+} epoch_cpus[MAXCPUS];
+
+int
+epoch_enter(void)
+{
+	return splhigh();
+}
+
+void
+epoch_exit(int spl)
+{
+	splx(spl);
+}
+
+unsigned
+epoch_current(void)
+{
+	/* Order the caller's unlink before the read. */
+	membar_any_any();
+	return epoch_global;
+}
+
+bool
+epoch_expired(unsigned e)
+{
+	/* Subtract so this keeps working when the counter wraps. */
+	return epoch_global - e >= 2;
+}
+
+void
+epoch_tick(void)
+{
+	unsigned now, i;
+
+	now = epoch_global;
+
+	/* Whatever we read before the interrupt is done with. */
+	membar_any_store();
+	epoch_cpus[curcpu->c_number].ec_seen = now;
+
+	if (curcpu->c_number != 0) {
+		return;
+	}
+	membar_load_load();
+	for (i=0; i<num_cpus; i++) {
+		if (epoch_cpus[i].ec_seen != now && !epoch_cpus[i].ec_idle) {
+			return;
+		}
+	}
+	epoch_global = now + 1;
+}
+
+void
+epoch_idle(void)
+{
+	membar_any_store();
+	epoch_cpus[curcpu->c_number].ec_idle = true;
+}
+
+void
+epoch_unidle(void)
+{
+	unsigned n = curcpu->c_number;
+
+	/* Catch up with the epoch before we stop counting as idle. */
+	epoch_cpus[n].ec_seen = epoch_global;
+	membar_store_store();
+	epoch_cpus[n].ec_idle = false;
+	/* And clear it before we read anything. */
+	membar_any_any();
+}
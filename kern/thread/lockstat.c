@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock contention profiler. See lockstat.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <membar.h>
+#include <lockstat.h>
+
+#define LOCKSTAT_NCLASSES	256	/* power of 2 */
+#define LOCKSTAT_NAMELEN	24	/* longer names are truncated */
+
+struct lockstat_class {
+	unsigned lc_kind;			/* LOCKSTAT_*; */
+	bool lc_used;				/* slot is taken */
+	const void *lc_site;			/* spinlocks: call site */
+	char lc_name[LOCKSTAT_NAMELEN];		/* others: lock name */
+	uint64_t lc_acquires;			/* acquisitions */
+	uint64_t lc_contended;			/* ...that had to wait */
+	uint64_t lc_wait_ns;			/* total time waiting */
+	uint64_t lc_wait_max_ns;		/* longest single wait */
+	uint64_t lc_hold_ns;			/* total time held */
+};
+
+volatile bool lockstat_enabled;
+
+/*
+ * The class table, open addressed with linear probing. Classes are
+ * never removed (reset only zeroes the counters), so a lock can keep
+ * a pointer to its class while held.
+ *
+ * The table is protected by a bare lock word, not a spinlock, since
+ * we're called from inside spinlock_acquire and spinlock_release.
+ * It's only ever held with interrupts off and for a few instructions.
+ */
+static struct lockstat_class lockstat_classes[LOCKSTAT_NCLASSES];
+static volatile spinlock_data_t lockstat_lock = SPINLOCK_DATA_INITIALIZER;
+static unsigned lockstat_dropped;	/* events lost to a full table */
+
+static const char *const lockstat_kindnames[] = {
+	"spin", "lock", "sem", "cv",
+};
+
+static
+void
+lockstat_lock_acquire(void)
+{
+	while (spinlock_data_get(&lockstat_lock) != 0 ||
+	       spinlock_data_testandset(&lockstat_lock) != 0) {
+		/* spin */
+	}
+	membar_store_any();
+}
+
+static
+void
+lockstat_lock_release(void)
+{
+	membar_any_store();
+	spinlock_data_set(&lockstat_lock, 0);
+}
+
+uint64_t
+lockstat_now(void)
+{
+	return clock_nsecs();
+}
+
+/*
+ * Does class LC have the given key? Names are compared only as far
+ * as we store them.
+ */
+static
+bool
+lockstat_match(struct lockstat_class *lc, unsigned kind, const char *name,
+	       const void *site)
+{
+	unsigned i;
+
+	if (lc->lc_kind != kind) {
+		return false;
+	}
+	if (kind == LOCKSTAT_SPINLOCK) {
+		return lc->lc_site == site;
+	}
+	for (i = 0; i < LOCKSTAT_NAMELEN - 1; i++) {
+		if (lc->lc_name[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find or create the class for a key. Call with the table locked.
+ * Returns NULL if the table is full.
+ */
+static
+struct lockstat_class *
+lockstat_lookup(unsigned kind, const char *name, const void *site)
+{
+	struct lockstat_class *lc;
+	uint32_t hash;
+	unsigned i, j, slot;
+
+	/* FNV-1a over the name or the site address */
+	hash = 2166136261U ^ kind;
+	if (kind == LOCKSTAT_SPINLOCK) {
+		hash = (hash ^ (uintptr_t)site) * 16777619U;
+	}
+	else {
+		for (i = 0; i < LOCKSTAT_NAMELEN - 1 && name[i] != 0; i++) {
+			hash = (hash ^ (unsigned char)name[i]) * 16777619U;
+		}
+	}
+
+	for (i = 0; i < LOCKSTAT_NCLASSES; i++) {
+		slot = (hash + i) & (LOCKSTAT_NCLASSES - 1);
+		lc = &lockstat_classes[slot];
+		if (!lc->lc_used) {
+			lc->lc_used = true;
+			lc->lc_kind = kind;
+			if (kind == LOCKSTAT_SPINLOCK) {
+				lc->lc_site = site;
+			}
+			else {
+				lc->lc_site = NULL;
+				for (j = 0; j < LOCKSTAT_NAMELEN - 1 &&
+					     name[j] != 0; j++) {
+					lc->lc_name[j] = name[j];
+				}
+				lc->lc_name[j] = 0;
+			}
+			return lc;
+		}
+		if (lockstat_match(lc, kind, name, site)) {
+			return lc;
+		}
+	}
+	lockstat_dropped++;
+	return NULL;
+}
+
+/*
+ * Charge an acquisition, and the wait since WAITSTART if nonzero, to
+ * the class for the key. Returns the class, or NULL.
+ */
+static
+struct lockstat_class *
+lockstat_charge(unsigned kind, const char *name, const void *site,
+		uint64_t waitstart, uint64_t now)
+{
+	struct lockstat_class *lc;
+	uint64_t wait;
+
+	lockstat_lock_acquire();
+	lc = lockstat_lookup(kind, name, site);
+	if (lc != NULL) {
+		lc->lc_acquires++;
+		if (waitstart != 0) {
+			wait = now - waitstart;
+			lc->lc_contended++;
+			lc->lc_wait_ns += wait;
+			if (wait > lc->lc_wait_max_ns) {
+				lc->lc_wait_max_ns = wait;
+			}
+		}
+	}
+	lockstat_lock_release();
+	return lc;
+}
+
+/*
+ * A lock LL of the given kind was acquired, after waiting since
+ * WAITSTART (0 if it was free).
+ */
+void
+lockstat_acquire(struct lockstat_lockable *ll, unsigned kind,
+		 const char *name, const void *site, uint64_t waitstart)
+{
+	uint64_t now;
+	int spl;
+
+	spl = splhigh();
+	now = clock_nsecs();
+	ll->ll_class = lockstat_charge(kind, name, site, waitstart, now);
+	ll->ll_start = now;
+	splx(spl);
+}
+
+/*
+ * A lock LL acquired while we were collecting is being released.
+ */
+void
+lockstat_release(struct lockstat_lockable *ll)
+{
+	struct lockstat_class *lc;
+	uint64_t now;
+	int spl;
+
+	lc = ll->ll_class;
+	ll->ll_class = NULL;
+
+	spl = splhigh();
+	now = clock_nsecs();
+	lockstat_lock_acquire();
+	lc->lc_hold_ns += now - ll->ll_start;
+	lockstat_lock_release();
+	splx(spl);
+}
+
+/*
+ * A P() or cv_wait completed, after waiting since WAITSTART (0 if it
+ * didn't block). These have no owner, so no hold time.
+ */
+void
+lockstat_wait(unsigned kind, const char *name, uint64_t waitstart)
+{
+	int spl;
+
+	spl = splhigh();
+	lockstat_charge(kind, name, NULL, waitstart, clock_nsecs());
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+// Menu hooks
+
+void
+lockstat_setenabled(bool on)
+{
+	lockstat_enabled = on;
+}
+
+/*
+ * Zero the counters, keeping the classes themselves.
+ */
+void
+lockstat_reset(void)
+{
+	struct lockstat_class *lc;
+	unsigned i;
+	int spl;
+
+	spl = splhigh();
+	lockstat_lock_acquire();
+	for (i = 0; i < LOCKSTAT_NCLASSES; i++) {
+		lc = &lockstat_classes[i];
+		lc->lc_acquires = 0;
+		lc->lc_contended = 0;
+		lc->lc_wait_ns = 0;
+		lc->lc_wait_max_ns = 0;
+		lc->lc_hold_ns = 0;
+	}
+	lockstat_dropped = 0;
+	lockstat_lock_release();
+	splx(spl);
+}
+
+/*
+ * Print the TOPN classes with the most total wait time.
+ *
+ * kprintf takes locks, which would come back here, so work from a
+ * copy of the table rather than holding the table lock.
+ */
+void
+lockstat_print(unsigned topn)
+{
+	struct lockstat_class *copy, *best, tmp;
+	unsigned i, j, n, dropped;
+	int spl;
+
+	copy = kmalloc(sizeof(lockstat_classes));
+	if (copy == NULL) {
+		kprintf("lockstat: Out of memory\n");
+		return;
+	}
+
+	spl = splhigh();
+	lockstat_lock_acquire();
+	memcpy(copy, lockstat_classes, sizeof(lockstat_classes));
+	dropped = lockstat_dropped;
+	lockstat_lock_release();
+	splx(spl);
+
+	/* Pack the classes that have seen use, then select the top N. */
+	for (i = n = 0; i < LOCKSTAT_NCLASSES; i++) {
+		if (copy[i].lc_used && copy[i].lc_acquires > 0) {
+			copy[n++] = copy[i];
+		}
+	}
+	if (topn > n) {
+		topn = n;
+	}
+	for (i = 0; i < topn; i++) {
+		best = &copy[i];
+		for (j = i + 1; j < n; j++) {
+			if (copy[j].lc_wait_ns > best->lc_wait_ns ||
+			    (copy[j].lc_wait_ns == best->lc_wait_ns &&
+			     copy[j].lc_contended > best->lc_contended)) {
+				best = &copy[j];
+			}
+		}
+		tmp = copy[i];
+		copy[i] = *best;
+		*best = tmp;
+	}
+
+	kprintf("lockstat: %s, %u classes, top %u by wait time (ns)\n",
+		lockstat_enabled ? "on" : "off", n, topn);
+	kprintf("%-24s %-4s %10s %10s %12s %10s %12s\n",
+		"class", "kind", "acquires", "contended", "wait",
+		"wait max", "held");
+	for (i = 0; i < topn; i++) {
+		if (copy[i].lc_kind == LOCKSTAT_SPINLOCK) {
+			kprintf("spin@%-19p ", copy[i].lc_site);
+		}
+		else {
+			kprintf("%-24s ", copy[i].lc_name);
+		}
+		kprintf("%-4s %10llu %10llu %12llu %10llu %12llu\n",
+			lockstat_kindnames[copy[i].lc_kind],
+			copy[i].lc_acquires, copy[i].lc_contended,
+			copy[i].lc_wait_ns, copy[i].lc_wait_max_ns,
+			copy[i].lc_hold_ns);
+	}
+	if (dropped > 0) {
+		kprintf("lockstat: %u events dropped, class table full\n",
+			dropped);
+	}
+
+	kfree(copy);
+}
@@ -52,6 +52,7 @@ spinlock_init(struct spinlock *splk)
 {
 	spinlock_data_set(&splk->splk_lock, 0);
 	splk->splk_holder = NULL;
+	LOCKSTAT_LOCKABLEINIT(&splk->splk_lockstat);
 	HANGMAN_LOCKABLEINIT(&splk->splk_hangman, "spinlock");
 }
 
@@ -76,6 +77,7 @@ void
 spinlock_acquire(struct spinlock *splk)
 {
 	struct cpu *mycpu;
+	uint64_t waitstart = 0;
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -104,10 +106,11 @@ spinlock_acquire(struct spinlock *splk)
 		 * previously unheld and we now own it. If it was 1,
 		 * we don't.
 		 */
-		if (spinlock_data_get(&splk->splk_lock) != 0) {
-			continue;
-		}
-		if (spinlock_data_testandset(&splk->splk_lock) != 0) {
+		if (spinlock_data_get(&splk->splk_lock) != 0 ||
+		    spinlock_data_testandset(&splk->splk_lock) != 0) {
+			if (waitstart == 0) {
+				waitstart = LOCKSTAT_NOW();
+			}
 			continue;
 		}
 		break;
@@ -116,6 +119,9 @@ spinlock_acquire(struct spinlock *splk)
 	membar_store_any();
 	splk->splk_holder = mycpu;
 
+	LOCKSTAT_ACQUIRE(&splk->splk_lockstat, LOCKSTAT_SPINLOCK, NULL,
+			 __builtin_return_address(0), waitstart);
+
 	if (CURCPU_EXISTS()) {
 		HANGMAN_ACQUIRE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
@@ -135,6 +141,8 @@ spinlock_release(struct spinlock *splk)
 		HANGMAN_RELEASE(&curcpu->c_hangman, &splk->splk_hangman);
 	}
 
+	LOCKSTAT_RELEASE(&splk->splk_lockstat);
+
 	splk->splk_holder = NULL;
 	membar_any_store();
 	spinlock_data_set(&splk->splk_lock, 0);
@@ -154,3 +162,115 @@ spinlock_do_i_hold(struct spinlock *splk)
 	/* Assume we can read splk_holder atomically enough for this to work */
 	return (splk->splk_holder == curcpu->c_self);
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Queued spinlocks.
+ */
+
+/* Delay loop iterations per waiter ahead of us. */
+#define QSPINLOCK_BACKOFF	32
+
+void
+qspinlock_init(struct qspinlock *qsl)
+{
+	spinlock_data_set(&qsl->qsl_next, 0);
+	spinlock_data_set(&qsl->qsl_serving, 0);
+	qsl->qsl_holder = NULL;
+	LOCKSTAT_LOCKABLEINIT(&qsl->qsl_lockstat);
+	HANGMAN_LOCKABLEINIT(&qsl->qsl_hangman, "qspinlock");
+}
+
+void
+qspinlock_cleanup(struct qspinlock *qsl)
+{
+	KASSERT(qsl->qsl_holder == NULL);
+	KASSERT(spinlock_data_get(&qsl->qsl_next) ==
+		spinlock_data_get(&qsl->qsl_serving));
+}
+
+/*
+ * Get the lock. As with spinlock_acquire, disable interrupts first.
+ * Then take a ticket and wait for our number to come up.
+ */
+void
+qspinlock_acquire(struct qspinlock *qsl)
+{
+	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	volatile unsigned delay;
+	uint64_t waitstart = 0;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		mycpu = curcpu->c_self;
+		if (qsl->qsl_holder == mycpu) {
+			panic("Deadlock on qspinlock %p\n", qsl);
+		}
+		mycpu->c_spinlocks++;
+
+		HANGMAN_WAIT(&curcpu->c_hangman, &qsl->qsl_hangman);
+	}
+	else {
+		mycpu = NULL;
+	}
+
+	ticket = spinlock_data_fetchadd(&qsl->qsl_next, 1);
+	while ((serving = spinlock_data_get(&qsl->qsl_serving)) != ticket) {
+		if (waitstart == 0) {
+			waitstart = LOCKSTAT_NOW();
+		}
+		/* Unsigned arithmetic copes with the tickets wrapping. */
+		for (delay = 0; delay < (ticket - serving) * QSPINLOCK_BACKOFF;
+		     delay++) {
+			/* nothing */
+		}
+	}
+
+	membar_store_any();
+	qsl->qsl_holder = mycpu;
+
+	LOCKSTAT_ACQUIRE(&qsl->qsl_lockstat, LOCKSTAT_SPINLOCK, NULL,
+			 __builtin_return_address(0), waitstart);
+
+	if (CURCPU_EXISTS()) {
+		HANGMAN_ACQUIRE(&curcpu->c_hangman, &qsl->qsl_hangman);
+	}
+}
+
+/*
+ * Release the lock by calling the next ticket. Only the holder writes
+ * qsl_serving, so a plain store is enough.
+ */
+void
+qspinlock_release(struct qspinlock *qsl)
+{
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(qsl->qsl_holder == curcpu->c_self);
+		KASSERT(curcpu->c_spinlocks > 0);
+		curcpu->c_spinlocks--;
+		HANGMAN_RELEASE(&curcpu->c_hangman, &qsl->qsl_hangman);
+	}
+
+	LOCKSTAT_RELEASE(&qsl->qsl_lockstat);
+
+	qsl->qsl_holder = NULL;
+	membar_any_store();
+	spinlock_data_set(&qsl->qsl_serving,
+			  spinlock_data_get(&qsl->qsl_serving) + 1);
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+bool
+qspinlock_do_i_hold(struct qspinlock *qsl)
+{
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
+
+	return (qsl->qsl_holder == curcpu->c_self);
+}
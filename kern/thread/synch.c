@@ -34,11 +34,14 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <spl.h>
+#include <membar.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -49,6 +52,8 @@ sem_create(const char *name, unsigned initial_count)
 {
 	struct semaphore *sem;
 
+	COMPILE_ASSERT(sizeof(sem->sem_count) == sizeof(spinlock_data_t));
+
 	sem = kmalloc(sizeof(*sem));
 	if (sem == NULL) {
 		return NULL;
@@ -78,6 +83,14 @@ sem_destroy(struct semaphore *sem)
 {
 	KASSERT(sem != NULL);
 
+	/*
+	 * A V that just raised the count from 0 may still be on its
+	 * way out of sem_lock, even though a P has taken the count
+	 * without the spinlock and decided we're done. Wait for it.
+	 */
+	spinlock_acquire(&sem->sem_lock);
+	spinlock_release(&sem->sem_lock);
+
 	/* wchan_cleanup will assert if anyone's waiting on it */
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
@@ -85,10 +98,32 @@ sem_destroy(struct semaphore *sem)
 	kfree(sem);
 }
 
+/*
+ * Take one from the count without the spinlock, if it's nonzero.
+ */
+static
+bool
+sem_trydown(struct semaphore *sem)
+{
+	volatile spinlock_data_t *count;
+	spinlock_data_t c;
+
+	count = (volatile spinlock_data_t *)&sem->sem_count;
+	while ((c = spinlock_data_get(count)) > 0) {
+		if (spinlock_data_cas(count, c, c - 1) == c) {
+			membar_store_any();
+			return true;
+		}
+	}
+	return false;
+}
+
 // NOTE: P is analogous to "wait"
 void
 P(struct semaphore *sem)
 {
+	uint64_t waitstart = 0;
+
 	KASSERT(sem != NULL);
 
 	/*
@@ -99,25 +134,28 @@ P(struct semaphore *sem)
 	 */
 	KASSERT(curthread->t_in_interrupt == false);
 
+	if (sem_trydown(sem)) {
+		/* Counted as a P that didn't wait. */
+		LOCKSTAT_WAIT(LOCKSTAT_SEM, sem->sem_name, 0);
+		return;
+	}
+
 	/* Use the semaphore spinlock to protect the wchan as well. */
 	spinlock_acquire(&sem->sem_lock);
-	while (sem->sem_count == 0) {
+	if (!sem_trydown(sem)) {
 		/*
+		 * The count only leaves 0 under the spinlock, so it
+		 * stays 0 until we're asleep.
 		 *
-		 * Note that we don't maintain strict FIFO ordering of
-		 * threads going through the semaphore; that is, we
-		 * might "get" it on the first try even if other
-		 * threads are waiting. Apparently according to some
-		 * textbooks semaphores must for some reason have
-		 * strict ordering. Too bad. :-)
-		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * V gives its count directly to the thread it wakes,
+		 * so when we wake up the count is ours and nobody
+		 * can have "got" it first. That also makes waiters go
+		 * through in FIFO order.
 		 */
+		waitstart = LOCKSTAT_NOW();
 		wchan_sleep(sem->sem_wchan, &sem->sem_lock);
 	}
-	KASSERT(sem->sem_count > 0);
-	sem->sem_count--;
+	LOCKSTAT_WAIT(LOCKSTAT_SEM, sem->sem_name, waitstart);
 	spinlock_release(&sem->sem_lock);
 }
 
@@ -125,13 +163,35 @@ P(struct semaphore *sem)
 void
 V(struct semaphore *sem)
 {
+	volatile spinlock_data_t *count;
+	spinlock_data_t c;
+
 	KASSERT(sem != NULL);
 
+	/*
+	 * Fast path: if the count is above 0, nobody can be asleep in
+	 * P, so just add one. The compare-and-swap must be the last
+	 * thing we do to the semaphore: a P can take the count right
+	 * away, and its caller may then destroy it.
+	 */
+	count = (volatile spinlock_data_t *)&sem->sem_count;
+	membar_any_store();
+	while ((c = spinlock_data_get(count)) > 0) {
+		KASSERT(c + 1 > 0);
+		if (spinlock_data_cas(count, c, c + 1) == c) {
+			return;
+		}
+	}
+
 	spinlock_acquire(&sem->sem_lock);
 
-	sem->sem_count++;
-	KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan, &sem->sem_lock);
+	/* Hand the count to a waiter if there is one; see P. */
+	if (wchan_wakeone(sem->sem_wchan, &sem->sem_lock) == NULL) {
+		do {
+			c = spinlock_data_get(count);
+			KASSERT(c + 1 > 0);
+		} while (spinlock_data_cas(count, c, c + 1) != c);
+	}
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -159,6 +219,7 @@ lock_create(const char *name)
 	spinlock_init(&lock->lk_spinlock);
 
 	HANGMAN_LOCKABLEINIT(&lock->lk_hangman, lock->lk_name);
+	LOCKSTAT_LOCKABLEINIT(&lock->lk_lockstat);
 	
 	lock->lk_wchan = wchan_create(lock->lk_name);
 	if (lock->lk_wchan == NULL) {
@@ -168,7 +229,10 @@ lock_create(const char *name)
 		return NULL;
 	}
 	
-	lock->lk_thread = NULL;	
+	lock->lk_owner = 0;
+	lock->lk_piholder = NULL;
+	lock->lk_pinext = NULL;
+	lock->lk_pilevel = SCHED_NLEVELS;
 
 	return lock;
 }
@@ -177,18 +241,251 @@ void
 lock_destroy(struct lock *lock)
 {
 	KASSERT(lock != NULL);
-	KASSERT(lock->lk_thread == NULL);
+	KASSERT(lock->lk_owner == 0);
+	KASSERT(lock->lk_piholder == NULL);
+
+	/*
+	 * A release that went through the slow path may still be on
+	 * its way out of lk_spinlock after freeing the lock; wait for
+	 * it. See lock_release.
+	 */
+	spinlock_acquire(&lock->lk_spinlock);
+	spinlock_release(&lock->lk_spinlock);
 	
 	spinlock_cleanup(&lock->lk_spinlock);
 	wchan_destroy(lock->lk_wchan);
 	kfree(lock->lk_name);
-	lock->lk_thread = NULL;
 	kfree(lock);
 }
 
+/*
+ * Adaptive spinning.
+ *
+ * When the lock is held by a thread running on another cpu, it will
+ * probably be released soon, and sleeping would cost two context
+ * switches. So lock_acquire polls it instead, with exponential
+ * backoff between polls, for up to LOCK_SPIN_POLLS polls in total.
+ * Every LOCK_SPIN_RECHECK polls it checks (under the spinlock, with
+ * the waiters bit set, so the holder can't exit under us) that the
+ * holder is still running, and goes to sleep if not.
+ */
+#define LOCK_SPIN_POLLS		128
+#define LOCK_SPIN_RECHECK	16
+#define LOCK_BACKOFF_MAX	256	/* delay loop iterations */
+
+bool lock_spin_enabled = true;
+bool lock_handoff_enabled = true;
+
+/*
+ * Is the holder running? Call with the lock's spinlock held and
+ * LOCK_WAITERS set.
+ */
+static
+bool
+lock_holder_running(struct thread *holder)
+{
+	return holder->t_state == S_RUN && holder->t_cpu->c_curthread == holder;
+}
+
+/*
+ * Poll the lock without its spinlock until HOLDER lets go or we've
+ * done LOCK_SPIN_RECHECK polls. Returns the number of polls made.
+ */
+static
+unsigned
+lock_spin(struct lock *lock, struct thread *holder)
+{
+	volatile unsigned delay;
+	unsigned polls, backoff = 1;
+
+	for (polls = 1; polls <= LOCK_SPIN_RECHECK; polls++) {
+		for (delay = 0; delay < backoff; delay++) {
+			/* nothing */
+		}
+		if (LOCK_HOLDER(lock) != holder) {
+			break;
+		}
+		if (backoff < LOCK_BACKOFF_MAX) {
+			backoff *= 2;
+		}
+	}
+	return polls;
+}
+
+/*
+ * Priority inheritance.
+ *
+ * A thread about to sleep waiting for a lock lends its level (see
+ * thread_level) to the holder, so a low-priority holder can't be
+ * kept off the cpu by middle-priority work while a high-priority
+ * thread waits for it. If the holder is itself asleep waiting for
+ * another lock, the loan is passed on down the chain.
+ *
+ * A held lock with sleepers is on its holder's t_pilocks list, with
+ * lk_pilevel the best level lent through it, and the holder's
+ * t_inherited is the best over its list. Releasing the lock takes it
+ * off the list and recomputes that; handing it over puts it on the
+ * new holder's list. All of this is under lock_pi_lock, which is only
+ * taken by threads about to sleep on a lock or wake one, so the
+ * uncontended paths never touch it.
+ *
+ * Threads a CV moves onto the lock's wchan (see cv_signal) lend
+ * their level once the lock next changes hands, not before.
+ */
+static struct spinlock lock_pi_lock = SPINLOCK_INITIALIZER;
+
+/* Put LOCK on HOLDER's t_pilocks. */
+static
+void
+lock_pi_list(struct lock *lock, struct thread *holder)
+{
+	KASSERT(lock->lk_piholder == NULL);
+	lock->lk_piholder = holder;
+	lock->lk_pinext = holder->t_pilocks;
+	lock->lk_pilevel = SCHED_NLEVELS;
+	holder->t_pilocks = lock;
+}
+
+/* Take LOCK off its holder's t_pilocks. */
+static
+void
+lock_pi_unlist(struct lock *lock)
+{
+	struct lock **lp;
+
+	for (lp = &lock->lk_piholder->t_pilocks; *lp != lock;
+	     lp = &(*lp)->lk_pinext) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = lock->lk_pinext;
+	lock->lk_piholder = NULL;
+	lock->lk_pinext = NULL;
+	lock->lk_pilevel = SCHED_NLEVELS;
+}
+
+/*
+ * Lend LEVEL through LOCK to its holder, and on through whatever the
+ * holder is waiting for. Stops where as much has been lent already,
+ * which also keeps a deadlocked cycle from looping forever.
+ */
+static
+void
+lock_pi_lend(struct lock *lock, unsigned level)
+{
+	struct thread *holder;
+
+	KASSERT(spinlock_do_i_hold(&lock_pi_lock));
+
+	while (lock != NULL && lock->lk_piholder != NULL &&
+	       level < lock->lk_pilevel) {
+		lock->lk_pilevel = level;
+		holder = lock->lk_piholder;
+		if (level < holder->t_inherited) {
+			thread_inherit(holder, level);
+		}
+		lock = holder->t_blockedon;
+	}
+}
+
+/*
+ * We're about to sleep on LOCK, held by HOLDER. Call with the lock's
+ * spinlock held and LOCK_WAITERS set, so HOLDER stays put.
+ */
+static
+void
+lock_pi_block(struct lock *lock, struct thread *holder)
+{
+	spinlock_acquire(&lock_pi_lock);
+	if (lock->lk_piholder == NULL) {
+		lock_pi_list(lock, holder);
+	}
+	KASSERT(lock->lk_piholder == holder);
+	curthread->t_blockedon = lock;
+	lock_pi_lend(lock, thread_level(curthread));
+	spinlock_release(&lock_pi_lock);
+}
+
+/*
+ * LOCK has just gone to NEWHOLDER; have any threads still asleep on
+ * it lend their levels to it. Call with the lock's spinlock and
+ * lock_pi_lock held.
+ */
+static
+void
+lock_pi_take(struct lock *lock, struct thread *newholder)
+{
+	KASSERT(spinlock_do_i_hold(&lock_pi_lock));
+
+	if (!wchan_isempty(lock->lk_wchan, &lock->lk_spinlock)) {
+		lock_pi_list(lock, newholder);
+		lock_pi_lend(lock, wchan_toplevel(lock->lk_wchan,
+						  &lock->lk_spinlock));
+	}
+}
+
+/*
+ * We're letting go of LOCK after waking WOKEN (if not NULL), and
+ * giving it to NEWHOLDER (if not NULL). Take back what was lent to us
+ * through it. Call with the lock's spinlock held.
+ */
+static
+void
+lock_pi_release(struct lock *lock, struct thread *woken,
+		struct thread *newholder)
+{
+	struct lock *l;
+	unsigned level;
+
+	spinlock_acquire(&lock_pi_lock);
+	if (woken != NULL) {
+		woken->t_blockedon = NULL;
+	}
+	if (lock->lk_piholder != NULL) {
+		KASSERT(lock->lk_piholder == curthread);
+		lock_pi_unlist(lock);
+		level = SCHED_NLEVELS;
+		for (l = curthread->t_pilocks; l != NULL; l = l->lk_pinext) {
+			if (l->lk_pilevel < level) {
+				level = l->lk_pilevel;
+			}
+		}
+		if (level != curthread->t_inherited) {
+			thread_inherit(curthread, level);
+		}
+	}
+	if (newholder != NULL) {
+		lock_pi_take(lock, newholder);
+	}
+	spinlock_release(&lock_pi_lock);
+}
+
+/*
+ * Take the lock if it's free, keeping the waiters bit as it is.
+ */
+static
+bool
+lock_trytake(struct lock *lock, spinlock_data_t owner)
+{
+	spinlock_data_t me = (spinlock_data_t)(uintptr_t)curthread;
+
+	if ((owner & ~LOCK_WAITERS) != 0) {
+		return false;
+	}
+	if (spinlock_data_cas(&lock->lk_owner, owner, me | owner) != owner) {
+		return false;
+	}
+	membar_store_any();
+	return true;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+	struct thread *holder;
+	spinlock_data_t owner;
+	unsigned spun = 0;
+	uint64_t waitstart = 0;
+
 	KASSERT(lock != NULL);
 
 	/*
@@ -199,44 +496,132 @@ lock_acquire(struct lock *lock)
 	 */
 	KASSERT(curthread->t_in_interrupt == false);
 
-	/* Use the lock's spinlock to protect the wchan as well. */
-	spinlock_acquire(&lock->lk_spinlock);
-	
 	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
-	
-	while (lock->lk_thread != NULL) {
-		wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+
+	KASSERT(LOCK_HOLDER(lock) != curthread);
+
+	/* Fast path: nobody has it and nobody is waiting. */
+	if (!lock_trytake(lock, 0)) {
+		/* Use the lock's spinlock to protect the wchan as well. */
+		spinlock_acquire(&lock->lk_spinlock);
+		while (1) {
+			owner = spinlock_data_get(&lock->lk_owner);
+			holder = (struct thread *)(uintptr_t)
+				(owner & ~LOCK_WAITERS);
+			if (holder == curthread) {
+				/* lock_release handed it to us */
+				break;
+			}
+			if (lock_trytake(lock, owner)) {
+				if (owner & LOCK_WAITERS) {
+					spinlock_acquire(&lock_pi_lock);
+					lock_pi_take(lock, curthread);
+					spinlock_release(&lock_pi_lock);
+				}
+				break;
+			}
+			if (holder == NULL) {
+				/* Lost a race with the fast path; retry. */
+				continue;
+			}
+			/*
+			 * Set the waiters bit, so the holder's release
+			 * fails its fast path and has to come through
+			 * the spinlock. If the holder let go first, try
+			 * again. Once it's set, the holder can't let go
+			 * (or exit) while we hold the spinlock, so we
+			 * can look at it.
+			 */
+			if ((owner & LOCK_WAITERS) == 0 &&
+			    spinlock_data_cas(&lock->lk_owner, owner,
+					      owner | LOCK_WAITERS) != owner) {
+				continue;
+			}
+			if (waitstart == 0) {
+				waitstart = LOCKSTAT_NOW();
+			}
+			if (lock_spin_enabled && spun < LOCK_SPIN_POLLS &&
+			    lock_holder_running(holder)) {
+				spinlock_release(&lock->lk_spinlock);
+				spun += lock_spin(lock, holder);
+				spinlock_acquire(&lock->lk_spinlock);
+				continue;
+			}
+			lock_pi_block(lock, holder);
+			wchan_sleep(lock->lk_wchan, &lock->lk_spinlock);
+		}
+		spinlock_release(&lock->lk_spinlock);
 	}
 
-	KASSERT(lock->lk_thread == NULL);
-	lock->lk_thread = curthread;
-	
 	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
-	
-	spinlock_release(&lock->lk_spinlock);
+	LOCKSTAT_ACQUIRE(&lock->lk_lockstat, LOCKSTAT_LOCK, lock->lk_name,
+			 NULL, waitstart);
 }
 
 void
 lock_release(struct lock *lock)
 {
+	spinlock_data_t me = (spinlock_data_t)(uintptr_t)curthread;
+	struct thread *next;
+	spinlock_data_t waiters;
+
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
 
-	spinlock_acquire(&lock->lk_spinlock);
-	
-	KASSERT(lock->lk_thread != NULL);
-	wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
-	lock->lk_thread = NULL;
-	
 	HANGMAN_RELEASE(&curthread->t_hangman, &lock->lk_hangman);
-	
+	LOCKSTAT_RELEASE(&lock->lk_lockstat);
+
+	/* Fast path: nobody is asleep waiting for it. */
+	membar_any_store();
+	if (spinlock_data_cas(&lock->lk_owner, me, 0) == me) {
+		return;
+	}
+
+	/*
+	 * The waiters bit is set. Nobody else changes lk_owner while
+	 * it's set and we hold the spinlock, so just store the result.
+	 *
+	 * Give the lock to the thread we wake, if any. If we just
+	 * freed it, a thread that hasn't been waiting could often
+	 * take it first, and the one we woke would go back to sleep.
+	 */
+	spinlock_acquire(&lock->lk_spinlock);
+	next = wchan_wakeone(lock->lk_wchan, &lock->lk_spinlock);
+	waiters = wchan_isempty(lock->lk_wchan, &lock->lk_spinlock) ?
+		0 : LOCK_WAITERS;
+	if (lock_handoff_enabled && next != NULL) {
+		waiters |= (spinlock_data_t)(uintptr_t)next;
+		lock_pi_release(lock, next, next);
+	}
+	else {
+		lock_pi_release(lock, next, NULL);
+	}
+	spinlock_data_set(&lock->lk_owner, waiters);
 	spinlock_release(&lock->lk_spinlock);
 }
 
 bool
 lock_do_i_hold(struct lock *lock)
 {
-	return (lock->lk_thread == curthread);
+	return (LOCK_HOLDER(lock) == curthread);
+}
+
+/*
+ * Threads were just moved to LOCK's wchan by a CV; make its holder
+ * (our caller) wake them on release. Call with the lock's spinlock
+ * held.
+ */
+static
+void
+lock_set_waiters(struct lock *lock)
+{
+	KASSERT(spinlock_do_i_hold(&lock->lk_spinlock));
+	KASSERT(lock_do_i_hold(lock));
+
+	if (!wchan_isempty(lock->lk_wchan, &lock->lk_spinlock)) {
+		spinlock_data_set(&lock->lk_owner,
+				  lock->lk_owner | LOCK_WAITERS);
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -269,6 +654,9 @@ cv_create(const char *name)
 		kfree(cv);
 		return NULL;
 	}
+
+	cv->cv_nwaiters = 0;
+	cv->cv_waitlock = NULL;
 	
 	return cv;
 }
@@ -288,17 +676,40 @@ cv_destroy(struct cv *cv)
 void
 cv_wait(struct cv *cv, struct lock *lock)
 {
+	uint64_t waitstart;
+
 	KASSERT(cv != NULL);
 	KASSERT(lock != NULL);
 
 	KASSERT(lock_do_i_hold(lock));
 	spinlock_acquire(&cv->cv_spinlock);
+
+	if (cv->cv_nwaiters++ == 0) {
+		cv->cv_waitlock = lock;
+	}
+	else if (cv->cv_waitlock != lock) {
+		cv->cv_waitlock = NULL;
+	}
 	
 	lock_release(lock);
+	waitstart = LOCKSTAT_NOW();
 	wchan_sleep(cv->cv_wchan, &(cv->cv_spinlock));
 	spinlock_release(&(cv->cv_spinlock));
+	LOCKSTAT_WAIT(LOCKSTAT_CV, cv->cv_name, waitstart);
 
-	lock_acquire(lock);
+	if (lock_do_i_hold(lock)) {
+		/*
+		 * We were moved to the lock's queue and it was then
+		 * handed to us; just do the bookkeeping.
+		 */
+		HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+		HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+		LOCKSTAT_ACQUIRE(&lock->lk_lockstat, LOCKSTAT_LOCK,
+				 lock->lk_name, NULL, 0);
+	}
+	else {
+		lock_acquire(lock);
+	}
 }
 
 void
@@ -309,7 +720,18 @@ cv_signal(struct cv *cv, struct lock *lock)
 	KASSERT(lock_do_i_hold(lock));
 	
 	spinlock_acquire(&(cv->cv_spinlock));
-	wchan_wakeone(cv->cv_wchan, &cv->cv_spinlock);
+	if (cv->cv_nwaiters > 0 && cv->cv_waitlock == lock) {
+		spinlock_acquire(&lock->lk_spinlock);
+		if (wchan_requeueone(cv->cv_wchan, &cv->cv_spinlock,
+				     lock->lk_wchan, &lock->lk_spinlock)) {
+			cv->cv_nwaiters--;
+		}
+		lock_set_waiters(lock);
+		spinlock_release(&lock->lk_spinlock);
+	}
+	else if (wchan_wakeone(cv->cv_wchan, &cv->cv_spinlock) != NULL) {
+		cv->cv_nwaiters--;
+	}
 	spinlock_release(&cv->cv_spinlock);				
 }
 
@@ -320,7 +742,17 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
 	spinlock_acquire(&(cv->cv_spinlock));
-	wchan_wakeall(cv->cv_wchan, &cv->cv_spinlock);
+	if (cv->cv_nwaiters > 0 && cv->cv_waitlock == lock) {
+		spinlock_acquire(&lock->lk_spinlock);
+		wchan_requeueall(cv->cv_wchan, &cv->cv_spinlock,
+				 lock->lk_wchan, &lock->lk_spinlock);
+		lock_set_waiters(lock);
+		spinlock_release(&lock->lk_spinlock);
+	}
+	else {
+		wchan_wakeall(cv->cv_wchan, &cv->cv_spinlock);
+	}
+	cv->cv_nwaiters = 0;
 	spinlock_release(&cv->cv_spinlock);				
 }
 
@@ -366,11 +798,17 @@ rwlock_create(const char * name) {
 	rw->r_count = 0;
 	rw->w_wait = false;
 	rw->w_exec = false;	
+	rw->r_waiting = 0;
+	rw->r_batch = 0;
+	rw->rw_writerpref = true;
 	return rw;
 }
 
 void
 rwlock_destroy(struct rwlock *rw) {
+	KASSERT(rw != NULL);
+	KASSERT(rw->r_count == 0);
+	KASSERT(!rw->w_exec);
 	wchan_destroy(rw->r_wchan);
 	wchan_destroy(rw->w_wchan);
 	spinlock_cleanup(&rw->rw_spinlock);
@@ -378,14 +816,50 @@ rwlock_destroy(struct rwlock *rw) {
 	kfree(rw);
 }
 
+void
+rwlock_set_writerpref(struct rwlock *rw, bool on) {
+	KASSERT(rw != NULL);
+	spinlock_acquire(&rw->rw_spinlock);
+	rw->rw_writerpref = on;
+	/* Readers held back only by waiting writers may go now. */
+	wchan_wakeall(rw->r_wchan, &rw->rw_spinlock);
+	spinlock_release(&rw->rw_spinlock);
+}
+
+/*
+ * Should a reader wait? Always behind a writer that has the lock.
+ * With writer preference, also behind a waiting writer, unless this
+ * reader was already waiting when the last writer let go (WAITED and
+ * there's room in the batch; see rwlock_release_write).
+ */
+static
+bool
+rwlock_reader_blocked(struct rwlock *rw, bool waited) {
+	if(rw->w_exec) {
+		return true;
+	}
+	if(rw->w_wait && rw->rw_writerpref) {
+		return !(waited && rw->r_batch > 0);
+	}
+	return false;
+}
+
 void
 rwlock_acquire_read(struct rwlock *rw) {
+	bool waited = false;
+
 	KASSERT(rw != NULL);
 	KASSERT(curthread->t_in_interrupt == false); 
 	KASSERT(rw->r_count >= 0);
 	spinlock_acquire(&rw->rw_spinlock);
-	while(rw->w_exec || rw->w_wait) {
+	while(rwlock_reader_blocked(rw, waited)) {
+		rw->r_waiting++;
 		wchan_sleep(rw->r_wchan, &rw->rw_spinlock);
+		rw->r_waiting--;
+		waited = true;
+	}
+	if(waited && rw->r_batch > 0) {
+		rw->r_batch--;
 	}
 	rw->r_count++;
 	KASSERT(rw->r_count > 0);
@@ -426,10 +900,207 @@ rwlock_release_write(struct rwlock *rw) {
 	spinlock_acquire(&rw->rw_spinlock);
 	KASSERT(rw->w_exec);
 	rw->w_exec = false;
-	if(rw->w_wait) {
-		wchan_wakeone(rw->w_wchan, &rw->rw_spinlock);
-	} else {
+	if(rw->r_waiting > 0) {
+		/*
+		 * Readers that waited through this writer go next,
+		 * even if another writer is waiting. The last of them
+		 * out wakes the writer.
+		 */
+		rw->r_batch = rw->r_waiting;
 		wchan_wakeall(rw->r_wchan, &rw->rw_spinlock);
+	} else if(rw->w_wait) {
+		wchan_wakeone(rw->w_wchan, &rw->rw_spinlock);
 	}
 	spinlock_release(&rw->rw_spinlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Big-reader lock
+
+struct brlock *
+brlock_create(const char *name)
+{
+	struct brlock *br;
+	unsigned i;
+
+	br = kmalloc(sizeof(*br));
+	if (br == NULL) {
+		return NULL;
+	}
+
+	br->br_name = kstrdup(name);
+	if (br->br_name == NULL) {
+		kfree(br);
+		return NULL;
+	}
+
+	br->br_wlock = lock_create(br->br_name);
+	if (br->br_wlock == NULL) {
+		kfree(br->br_name);
+		kfree(br);
+		return NULL;
+	}
+
+	br->br_rwchan = wchan_create(br->br_name);
+	if (br->br_rwchan == NULL) {
+		lock_destroy(br->br_wlock);
+		kfree(br->br_name);
+		kfree(br);
+		return NULL;
+	}
+
+	br->br_wwchan = wchan_create(br->br_name);
+	if (br->br_wwchan == NULL) {
+		wchan_destroy(br->br_rwchan);
+		lock_destroy(br->br_wlock);
+		kfree(br->br_name);
+		kfree(br);
+		return NULL;
+	}
+
+	spinlock_init(&br->br_spinlock);
+	br->br_writer = false;
+	for (i=0; i<MAXCPUS; i++) {
+		br->br_cpus[i].bc_readers = 0;
+	}
+
+	return br;
+}
+
+/*
+ * Total readers over all cpus.
+ */
+static
+int
+brlock_readers(struct brlock *br)
+{
+	unsigned i;
+	int total = 0;
+
+	for (i=0; i<MAXCPUS; i++) {
+		total += br->br_cpus[i].bc_readers;
+	}
+	return total;
+}
+
+void
+brlock_destroy(struct brlock *br)
+{
+	KASSERT(br != NULL);
+	KASSERT(!br->br_writer);
+	KASSERT(brlock_readers(br) == 0);
+
+	spinlock_cleanup(&br->br_spinlock);
+	wchan_destroy(br->br_wwchan);
+	wchan_destroy(br->br_rwchan);
+	lock_destroy(br->br_wlock);
+	kfree(br->br_name);
+	kfree(br);
+}
+
+/*
+ * Add DELTA to the current cpu's reader count, then check for a
+ * writer. Interrupts are off so we can't change cpus part way, which
+ * makes each count private to its cpu. The barrier pairs with the
+ * one in brlock_acquire_write: either we see br_writer, or the
+ * writer sees our count.
+ *
+ * If BACKOUT and there is a writer, take DELTA off again before
+ * turning interrupts back on, so both land on the same cpu's count.
+ */
+static
+bool
+brlock_count(struct brlock *br, int delta, bool backout)
+{
+	bool writer;
+	int spl;
+
+	spl = splhigh();
+	br->br_cpus[curcpu->c_number].bc_readers += delta;
+	membar_any_any();
+	writer = br->br_writer;
+	if (writer && backout) {
+		br->br_cpus[curcpu->c_number].bc_readers -= delta;
+	}
+	splx(spl);
+
+	return writer;
+}
+
+/*
+ * Tell a writer waiting for the readers to drain to look again.
+ */
+static
+void
+brlock_poke_writer(struct brlock *br)
+{
+	spinlock_acquire(&br->br_spinlock);
+	wchan_wakeone(br->br_wwchan, &br->br_spinlock);
+	spinlock_release(&br->br_spinlock);
+}
+
+void
+brlock_acquire_read(struct brlock *br)
+{
+	KASSERT(br != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	while (brlock_count(br, 1, true)) {
+		/* A writer is in or on its way; get out of its way. */
+		brlock_poke_writer(br);
+
+		spinlock_acquire(&br->br_spinlock);
+		while (br->br_writer) {
+			wchan_sleep(br->br_rwchan, &br->br_spinlock);
+		}
+		spinlock_release(&br->br_spinlock);
+	}
+}
+
+void
+brlock_release_read(struct brlock *br)
+{
+	KASSERT(br != NULL);
+
+	if (brlock_count(br, -1, false)) {
+		brlock_poke_writer(br);
+	}
+}
+
+void
+brlock_acquire_write(struct brlock *br)
+{
+	KASSERT(br != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	lock_acquire(br->br_wlock);
+
+	spinlock_acquire(&br->br_spinlock);
+	br->br_writer = true;
+	membar_any_any();
+	while (brlock_readers(br) != 0) {
+		wchan_sleep(br->br_wwchan, &br->br_spinlock);
+	}
+	spinlock_release(&br->br_spinlock);
+}
+
+void
+brlock_release_write(struct brlock *br)
+{
+	KASSERT(br != NULL);
+	KASSERT(brlock_do_i_hold_write(br));
+
+	spinlock_acquire(&br->br_spinlock);
+	br->br_writer = false;
+	wchan_wakeall(br->br_rwchan, &br->br_spinlock);
+	spinlock_release(&br->br_spinlock);
+
+	lock_release(br->br_wlock);
+}
+
+bool
+brlock_do_i_hold_write(struct brlock *br)
+{
+	return lock_do_i_hold(br->br_wlock) && br->br_writer;
+}
@@ -35,11 +35,15 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
+#include <clock.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <membar.h>
 #include <wchan.h>
 #include <thread.h>
 #include <threadlist.h>
@@ -55,6 +59,18 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
+/*
+ * Scheduler tuning. A thread's time slice grows as it moves down the
+ * levels; every SCHED_BOOST_HARDCLOCKS everything goes back to its
+ * base level. The boost period must be a multiple of the schedule()
+ * period in clock.c.
+ */
+#define SCHED_QUANTUM(level)	((level) + 1)	/* in hardclocks */
+#define SCHED_BOOST_HARDCLOCKS	HZ
+
+/* A thread that ran this recently likely has a warm cache on its cpu. */
+#define SCHED_CACHE_HOT_NS	5000000ULL	/* 5 ms */
+
 /* Wait channel. A wchan is protected by an associated, passed-in spinlock. */
 struct wchan {
 	const char *wc_name;		/* name for this channel */
@@ -70,6 +86,9 @@ unsigned num_cpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+/* Set once the clock is attached and the scheduler can timestamp. */
+static bool thread_timestamps = false;
+
 /* Used to synchronize exit cleanup. */
 unsigned thread_count = 0;
 static struct spinlock thread_count_lock = SPINLOCK_INITIALIZER;
@@ -114,6 +133,128 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+////////////////////////////////////////////////////////////
+
+/*
+ * Run queues.
+ *
+ * Each cpu has a run queue per priority level, and runs the head of
+ * the highest (lowest-numbered) level that isn't empty. These must
+ * be called with the cpu's run queue lock held.
+ */
+
+/*
+ * The level a thread starts at and is boosted back to: its process's
+ * nice value spread evenly across the levels.
+ */
+static
+unsigned
+thread_baselevel(struct thread *t)
+{
+	int nice;
+
+	nice = (t->t_proc != NULL) ? t->t_proc->p_nice : 0;
+	KASSERT(nice >= PRIO_MIN && nice <= PRIO_MAX);
+	return (nice - PRIO_MIN) * SCHED_NLEVELS / (PRIO_MAX - PRIO_MIN + 1);
+}
+
+/*
+ * The level T is queued and preempted at: its own, unless a thread
+ * waiting for a lock it holds has lent it a better one.
+ */
+unsigned
+thread_level(struct thread *t)
+{
+	unsigned inherited = t->t_inherited;
+
+	return inherited < t->t_priority ? inherited : t->t_priority;
+}
+
+static
+void
+runqueue_init(struct cpu *c)
+{
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+}
+
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+	unsigned i, count = 0;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		count += c->c_runqueue[i].tl_count;
+	}
+	return count;
+}
+
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_priority < SCHED_NLEVELS);
+	t->t_rqlevel = thread_level(t);
+	threadlist_addtail(&c->c_runqueue[t->t_rqlevel], t);
+}
+
+/* Take the next thread to run. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			t->t_rqlevel = SCHED_NLEVELS;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Take the thread that would run last, to give to another cpu. */
+static
+struct thread *
+runqueue_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=SCHED_NLEVELS; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			t->t_rqlevel = SCHED_NLEVELS;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Is a thread waiting at a higher priority than LEVEL? */
+static
+bool
+runqueue_has_above(struct cpu *c, unsigned level)
+{
+	unsigned i;
+
+	for (i=0; i<level; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////////
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -141,12 +282,26 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
+	thread->t_wakenext = NULL;
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_uslot = 0;
 	HANGMAN_ACTORINIT(&thread->t_hangman, thread->t_name);
 
+	/* Scheduler fields */
+	thread->t_priority = thread_baselevel(thread);
+	thread->t_ticks = 0;
+	thread->t_lastran = 0;
+	thread->t_wakeup = 0;
+	thread->t_rqlevel = SCHED_NLEVELS;
+
+	/* Priority inheritance fields */
+	thread->t_inherited = SCHED_NLEVELS;
+	thread->t_blockedon = NULL;
+	thread->t_pilocks = NULL;
+
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
@@ -182,12 +337,17 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
-	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
+	c->c_wakeup_max_ns = 0;
+	c->c_tickless = 0;
+	bzero(c->c_counters, sizeof(c->c_counters));
+	c->c_countergen = 0;
+	vmtrace_cpu_init(&c->c_vmtrace);
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+	runqueue_init(c);
+	qspinlock_init(&c->c_runqueue_lock);
+	c->c_wakeq = NULL;
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -257,6 +417,16 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Look up a cpu by number.
+ */
+struct cpu *
+cpu_lookup(unsigned software_number)
+{
+	KASSERT(software_number < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, software_number);
+}
+
 /*
  * Destroy a thread.
  *
@@ -277,6 +447,7 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
+	KASSERT(thread->t_pilocks == NULL);
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
@@ -316,6 +487,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -330,9 +503,14 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next =
+			&curcpu->c_runqueue[i].tl_tail;
+		curcpu->c_runqueue[i].tl_tail.tln_prev =
+			&curcpu->c_runqueue[i].tl_head;
+	}
+	curcpu->c_wakeq = NULL;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -448,6 +626,9 @@ thread_start_cpus(void)
 	}
 	cpu_startup_sem = NULL;
 
+	/* Devices are probed, so there's a clock to read now. */
+	thread_timestamps = true;
+
 	// Gross hack to deal with os/161 "idle" threads. Hardcode the thread count
 	// to 1 so the inc/dec properly works in thread_[fork/exit]. The one thread
 	// is the cpu0 boot thread (menu), which is the only thread that hasn't
@@ -455,10 +636,78 @@ thread_start_cpus(void)
 	thread_count = 1;
 }
 
+/*
+ * Push a thread onto C's wake queue. Returns true if the queue was
+ * empty. Pushers never take anything off, and the owner only ever
+ * takes the whole list, so a plain compare-and-swap on the head is
+ * enough; a head that went away and came back is still a valid list.
+ */
+static
+bool
+wakeq_push(struct cpu *c, struct thread *t)
+{
+	volatile spinlock_data_t *head;
+	spinlock_data_t old;
+
+	COMPILE_ASSERT(sizeof(c->c_wakeq) == sizeof(spinlock_data_t));
+	head = (volatile spinlock_data_t *)&c->c_wakeq;
+	/* T's fields have to be visible before T is. */
+	membar_store_store();
+	do {
+		old = spinlock_data_get(head);
+		t->t_wakenext = (struct thread *)(uintptr_t)old;
+	} while (spinlock_data_cas(head, old,
+				   (spinlock_data_t)(uintptr_t)t) != old);
+	return old == 0;
+}
+
+/*
+ * Move everything on this cpu's wake queue to its run queue, in the
+ * order the threads were woken. The runqueue lock must be held.
+ */
+static
+void
+wakeq_drain(void)
+{
+	volatile spinlock_data_t *head;
+	spinlock_data_t old;
+	struct thread *t, *next, *list;
+
+	KASSERT(qspinlock_do_i_hold(&curcpu->c_runqueue_lock));
+
+	if (curcpu->c_wakeq == NULL) {
+		return;
+	}
+
+	head = (volatile spinlock_data_t *)&curcpu->c_wakeq;
+	do {
+		old = spinlock_data_get(head);
+	} while (spinlock_data_cas(head, old, 0) != old);
+
+	/* The list is newest first; turn it around. */
+	list = NULL;
+	for (t = (struct thread *)(uintptr_t)old; t != NULL; t = next) {
+		next = t->t_wakenext;
+		t->t_wakenext = list;
+		list = t;
+	}
+	for (t = list; t != NULL; t = next) {
+		next = t->t_wakenext;
+		t->t_wakenext = NULL;
+		KASSERT(t->t_cpu == curcpu->c_self);
+		runqueue_add(curcpu->c_self, t);
+	}
+	counter_inc(CTR_WAKEQ_DRAINS);
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too.
+ * targetcpu might be curcpu; it might not be, too. If it isn't, the
+ * thread goes on the target cpu's wake queue instead of its run
+ * queue, so we never take another cpu's runqueue lock here, and the
+ * target is only interrupted if it's idle and nobody else has
+ * interrupted it since it last looked.
  */
 static
 void
@@ -466,32 +715,135 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
 
-	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
-		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+		KASSERT(qspinlock_do_i_hold(&targetcpu->c_runqueue_lock));
+	}
+	else if (targetcpu != curcpu->c_self) {
+		target->t_state = S_READY;
+		counter_inc(CTR_REMOTE_WAKEUPS);
+		if (wakeq_push(targetcpu, target)) {
+			/*
+			 * Pairs with the barrier in thread_switch:
+			 * either the target sees our push before it
+			 * idles, or we see it idle.
+			 */
+			membar_any_any();
+			if (targetcpu->c_isidle) {
+				ipi_send(targetcpu, IPI_UNIDLE);
+			}
+		}
+		return;
 	}
 	else {
-		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		qspinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
+
+	if (!already_have_lock) {
+		qspinlock_release(&targetcpu->c_runqueue_lock);
+	}
+}
+
+/*
+ * Timestamp for the scheduler, or 0 before there's a clock.
+ */
+static
+uint64_t
+thread_now(void)
+{
+	return thread_timestamps ? clock_nsecs() : 0;
+}
 
-	if (targetcpu->c_isidle && targetcpu != curcpu->c_self) {
+/*
+ * Choose a cpu for a thread that is waking up:
+ *   - its previous cpu, if that is idle;
+ *   - otherwise an idle cpu;
+ *   - otherwise the cpu with the fewest runnable threads. If the
+ *     thread ran within SCHED_CACHE_HOT_NS, its previous cpu is
+ *     counted as one thread less loaded, to favor its warm cache.
+ *
+ * The loads are read without locking; this is only placement, and
+ * work stealing fixes up bad guesses.
+ */
+static
+struct cpu *
+thread_wakeup_cpu(struct thread *target, uint64_t now)
+{
+	struct cpu *prev, *c, *best;
+	unsigned i, load, bestload;
+
+	prev = target->t_cpu;
+	if (prev->c_isidle || num_cpus <= 1) {
+		return prev;
+	}
+
+	for (i=0; i<num_cpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		/* Skip idle cpus that already have something to run */
+		if (c->c_isidle && runqueue_count(c) == 0 &&
+		    c->c_wakeq == NULL) {
+			return c;
+		}
+	}
+
+	best = prev;
+	bestload = runqueue_count(prev);
+	if (bestload > 0 && now - target->t_lastran < SCHED_CACHE_HOT_NS) {
+		bestload--;
+	}
+	for (i=0; i<num_cpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == prev) {
+			continue;
+		}
+		load = runqueue_count(c);
+		if (load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	return best;
+}
+
+/*
+ * Make a thread that was sleeping runnable, on the cpu chosen by
+ * thread_wakeup_cpu.
+ */
+static
+void
+thread_wakeup(struct thread *target)
+{
+	struct cpu *prev, *c;
+	uint64_t now;
+
+	now = thread_now();
+	prev = target->t_cpu;
+	c = thread_wakeup_cpu(target, now);
+
+	if (c != prev) {
 		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
+		 * If the target is still the previous cpu's curthread
+		 * (it went to sleep and that cpu is idling on its
+		 * stack; see thread_consider_migration) it has to stay
+		 * there. Once it isn't, it can't become curthread again
+		 * without being on that cpu's run queue.
 		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
+		qspinlock_acquire(&prev->c_runqueue_lock);
+		if (prev->c_curthread == target) {
+			c = prev;
+		}
+		qspinlock_release(&prev->c_runqueue_lock);
 	}
 
-	if (!already_have_lock) {
-		spinlock_release(&targetcpu->c_runqueue_lock);
-	}
+	target->t_cpu = c;
+	target->t_wakeup = now;
+	thread_make_runnable(target, false);
 }
 
 /*
@@ -546,6 +898,9 @@ thread_fork(const char *name,
 		return result;
 	}
 
+	/* Start at the base level for the process's priority */
+	newthread->t_priority = thread_baselevel(newthread);
+
 	/*
 	 * Because new threads come out holding the cpu runqueue lock
 	 * (see notes at bottom of thread_switch), we need to account
@@ -567,6 +922,85 @@ thread_fork(const char *name,
 	return 0;
 }
 
+/*
+ * Work stealing.
+ *
+ * Called by a cpu that has run out of threads, just before it would
+ * idle. Finds the remote cpu with the most runnable threads and takes
+ * half of them, from the low-priority end, onto our own run queue.
+ * Returns true if it got anything.
+ *
+ * The caller must not hold its own run queue lock: we only ever hold
+ * one run queue lock at a time, so two cpus stealing from each other
+ * can't deadlock.
+ */
+static
+bool
+thread_steal(void)
+{
+	struct threadlist stolen;
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, n, count, most;
+
+	/*
+	 * Pick a victim without locking; the counts are only a hint
+	 * and get rechecked below.
+	 */
+	victim = NULL;
+	most = 0;
+	for (i=0; i<num_cpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (count > most) {
+			most = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return false;
+	}
+
+	threadlist_init(&stolen);
+	qspinlock_acquire(&victim->c_runqueue_lock);
+	n = DIVROUNDUP(runqueue_count(victim), 2);
+	for (i=0; i<n; i++) {
+		t = runqueue_remtail(victim);
+		/*
+		 * Don't take the victim's curthread; see the comment
+		 * in thread_consider_migration. Leave it, and anything
+		 * ahead of it, where it is.
+		 */
+		if (t == victim->c_curthread) {
+			runqueue_add(victim, t);
+			break;
+		}
+		threadlist_addhead(&stolen, t);
+	}
+	qspinlock_release(&victim->c_runqueue_lock);
+
+	if (threadlist_isempty(&stolen)) {
+		threadlist_cleanup(&stolen);
+		return false;
+	}
+
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
+	while ((t = threadlist_remhead(&stolen)) != NULL) {
+		t->t_cpu = curcpu->c_self;
+		runqueue_add(curcpu->c_self, t);
+		counter_inc(CTR_STEALS);
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, victim->c_number, curcpu->c_number);
+	}
+	qspinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&stolen);
+
+	return true;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -582,6 +1016,7 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *cur, *next;
+	uint64_t now, latency;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -604,12 +1039,16 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	/* Remember our TLB entries for when we next run. */
+	as_tlbsave();
+
+	/* Lock the run queue, and pick up any remote wakeups. */
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
+	wakeq_drain();
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
-		spinlock_release(&curcpu->c_runqueue_lock);
+	if (newstate == S_READY && runqueue_count(curcpu->c_self) == 0) {
+		qspinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
@@ -622,6 +1061,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		/* Blocking before the slice is used up earns a level. */
+		if (cur->t_priority > thread_baselevel(cur)) {
+			cur->t_priority--;
+		}
+		cur->t_ticks = 0;
 		cur->t_wchan_name = wc->wc_name;
 		/*
 		 * Add the thread to the list in the wait channel, and
@@ -656,20 +1100,50 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before idling, try to take work from a busier cpu rather
+	 * than wait for it to push some to us. While idle, the timer
+	 * only interrupts when something is due; see hardclock_idle.
+	 *
+	 * Wakers on other cpus don't interrupt us unless they see
+	 * c_isidle set, so it has to be set before we last look at
+	 * the wake queue; see thread_make_runnable.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	membar_any_any();
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		wakeq_drain();
+		next = runqueue_remhead(curcpu->c_self);
 		if (next == NULL) {
-			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
-			spinlock_acquire(&curcpu->c_runqueue_lock);
+			qspinlock_release(&curcpu->c_runqueue_lock);
+			if (!thread_steal()) {
+				hardclock_idle();
+				cpu_idle();
+				hardclock_unidle();
+			}
+			qspinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Account for the switch. */
+	now = thread_now();
+	cur->t_lastran = now;
+	if (next != cur) {
+		counter_inc(CTR_SWITCHES);
+	}
+	if (next->t_wakeup != 0) {
+		latency = now - next->t_wakeup;
+		counter_inc(CTR_WAKEUPS);
+		counter_add(CTR_WAKEUP_NS, latency);
+		if (latency > curcpu->c_wakeup_max_ns) {
+			curcpu->c_wakeup_max_ns = latency;
+		}
+		next->t_wakeup = 0;
+	}
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -735,7 +1209,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = S_RUN;
 
 	/* Unlock the run queue. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	qspinlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -768,7 +1242,7 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	cur->t_state = S_RUN;
 
 	/* Release the runqueue lock acquired in thread_switch. */
-	spinlock_release(&curcpu->c_runqueue_lock);
+	qspinlock_release(&curcpu->c_runqueue_lock);
 
 	/* Activate our address space in the MMU. */
 	as_activate();
@@ -810,10 +1284,13 @@ thread_exit(void)
 	cur = curthread;
 
 	/*
-	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * Detach from our process. User threads have done this
+	 * already, before letting anyone know they were gone (see
+	 * uthread.c), since the process may be destroyed right after.
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -849,17 +1326,140 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Threads start at the base
+ * level for their process's nice value (see setpriority). Using up a
+ * whole time slice moves a thread down a level, where slices are
+ * longer; blocking before then moves it back up, but not above its
+ * base level. So compute-bound threads sink and interactive ones
+ * stay near the top, where they preempt anything below them.
+ *
+ * This is called periodically from hardclock(). To keep threads at
+ * the bottom from starving, every SCHED_BOOST_HARDCLOCKS it moves all
+ * the threads on this cpu back to their base levels.
  */
-
 void
 schedule(void)
 {
+	struct threadlist boosted;
+	struct thread *t;
+	unsigned i;
+
+	if ((counter_local(CTR_HARDCLOCKS) % SCHED_BOOST_HARDCLOCKS) != 0) {
+		return;
+	}
+
+	threadlist_init(&boosted);
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=0; i<SCHED_NLEVELS; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			threadlist_addtail(&boosted, t);
+		}
+	}
+	while ((t = threadlist_remhead(&boosted)) != NULL) {
+		t->t_priority = thread_baselevel(t);
+		t->t_ticks = 0;
+		runqueue_add(curcpu->c_self, t);
+	}
+	qspinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&boosted);
+
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = thread_baselevel(curthread);
+		curthread->t_ticks = 0;
+	}
+}
+
+/*
+ * Charge the current thread for a hardclock, moving it down a level
+ * if it has used up its slice. Returns true if it should yield:
+ * something better is waiting, or its slice is up and something as
+ * good is.
+ */
+bool
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	bool preempt;
+
+	if (curcpu->c_isidle) {
+		return false;
+	}
+
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
+	wakeq_drain();
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+		if (cur->t_priority < SCHED_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		/*
+		 * Round-robin with anything else at our new level or
+		 * above; a thread with nothing to compete with just
+		 * keeps going, without the cost of a thread_yield.
+		 * (A lent level doesn't sink; see thread_level.)
+		 */
+		preempt = runqueue_has_above(curcpu->c_self,
+					     thread_level(cur) + 1);
+	}
+	else {
+		preempt = runqueue_has_above(curcpu->c_self,
+					     thread_level(cur));
+	}
+	qspinlock_release(&curcpu->c_runqueue_lock);
+
+	return preempt;
+}
+
+/*
+ * Put the current thread at its (possibly new) base level.
+ */
+void
+thread_renice(void)
+{
+	int spl;
+
+	spl = splhigh();
+	curthread->t_priority = thread_baselevel(curthread);
+	curthread->t_ticks = 0;
+	splx(spl);
+}
+
+/*
+ * Lend T the run queue level LEVEL, or take back what it was lent if
+ * LEVEL is SCHED_NLEVELS. If T is waiting on a run queue, move it to
+ * the queue for its new level; otherwise the new level takes effect
+ * the next time it's queued or ticks. Called by synch.c with
+ * lock_pi_lock held.
+ */
+void
+thread_inherit(struct thread *t, unsigned level)
+{
+	struct cpu *c;
+
+	KASSERT(level <= SCHED_NLEVELS);
+
+	t->t_inherited = level;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * T's cpu can change under us until we hold that cpu's run
+	 * queue lock, but only by way of a state in which T isn't on
+	 * any run queue, and whoever queues it next sees the store
+	 * above.
 	 */
+	while (1) {
+		c = t->t_cpu;
+		qspinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		qspinlock_release(&c->c_runqueue_lock);
+	}
+	if (t->t_rqlevel < SCHED_NLEVELS && t->t_rqlevel != thread_level(t)) {
+		threadlist_remove(&c->c_runqueue[t->t_rqlevel], t);
+		runqueue_add(c, t);
+	}
+	qspinlock_release(&c->c_runqueue_lock);
 }
 
 /*
@@ -892,12 +1492,12 @@ thread_consider_migration(void)
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		qspinlock_acquire(&c->c_runqueue_lock);
+		total_count += runqueue_count(c);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = runqueue_count(c);
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		qspinlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -907,20 +1507,20 @@ thread_consider_migration(void)
 
 	to_send = my_count - one_share;
 	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
+	qspinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runqueue_remtail(curcpu->c_self);
 		threadlist_addhead(&victims, t);
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+	qspinlock_release(&curcpu->c_runqueue_lock);
 
 	for (i=0; i < numcpus && to_send > 0; i++) {
 		c = cpuarray_get(&allcpus, i);
 		if (c == curcpu->c_self) {
 			continue;
 		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		qspinlock_acquire(&c->c_runqueue_lock);
+		while (runqueue_count(c) < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -951,7 +1551,8 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			runqueue_add(c, t);
+			counter_inc(CTR_MIGRATIONS);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -964,7 +1565,7 @@ thread_consider_migration(void)
 				ipi_send(c, IPI_UNIDLE);
 			}
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		qspinlock_release(&c->c_runqueue_lock);
 	}
 
 	/*
@@ -973,17 +1574,40 @@ thread_consider_migration(void)
 	 * Don't panic; just put them back on our own run queue.
 	 */
 	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
+		qspinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runqueue_add(curcpu->c_self, t);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		qspinlock_release(&curcpu->c_runqueue_lock);
 	}
 
 	KASSERT(threadlist_isempty(&victims));
 	threadlist_cleanup(&victims);
 }
 
+/*
+ * Print the wakeup-to-run latency seen on each cpu.
+ */
+void
+thread_printstats(void)
+{
+	struct cpu *c;
+	unsigned i;
+	int64_t wakeups;
+
+	for (i=0; i<num_cpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		wakeups = counter_cpu(c, CTR_WAKEUPS);
+		kprintf("cpu%u: %lld switches, %lld wakeups, "
+			"wakeup-to-run avg %lld ns, max %llu ns\n", c->c_number,
+			(long long)counter_cpu(c, CTR_SWITCHES),
+			(long long)wakeups,
+			(long long)(wakeups ?
+				counter_cpu(c, CTR_WAKEUP_NS) / wakeups : 0),
+			(unsigned long long)c->c_wakeup_max_ns);
+	}
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -1048,9 +1672,10 @@ wchan_sleep(struct wchan *wc, struct spinlock *lk)
 }
 
 /*
- * Wake up one thread sleeping on a wait channel.
+ * Wake up one thread sleeping on a wait channel. Returns the thread
+ * woken, or NULL if there wasn't one.
  */
-void
+struct thread *
 wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 {
 	struct thread *target;
@@ -1062,7 +1687,7 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 
 	if (target == NULL) {
 		/* Nobody was sleeping. */
-		return;
+		return NULL;
 	}
 
 	/*
@@ -1073,7 +1698,28 @@ wchan_wakeone(struct wchan *wc, struct spinlock *lk)
 	 * in thread_switch.
 	 */
 
-	thread_make_runnable(target, false);
+	thread_wakeup(target);
+	return target;
+}
+
+/*
+ * Wake up T, if it is sleeping on the wait channel.
+ */
+bool
+wchan_wakethread(struct wchan *wc, struct spinlock *lk, struct thread *t)
+{
+	struct thread *itt;
+
+	KASSERT(spinlock_do_i_hold(lk));
+
+	THREADLIST_FORALL(itt, wc->wc_threads) {
+		if (itt == t) {
+			threadlist_remove(&wc->wc_threads, t);
+			thread_wakeup(t);
+			return true;
+		}
+	}
+	return false;
 }
 
 /*
@@ -1103,12 +1749,52 @@ wchan_wakeall(struct wchan *wc, struct spinlock *lk)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		thread_wakeup(target);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move up to MAX threads, oldest first, from one wait channel to the
+ * end of another without waking them. Returns the number moved.
+ */
+static
+unsigned
+wchan_requeue(struct wchan *from, struct spinlock *fromlk,
+	      struct wchan *to, struct spinlock *tolk, unsigned max)
+{
+	struct thread *target;
+	unsigned n;
+
+	KASSERT(spinlock_do_i_hold(fromlk));
+	KASSERT(spinlock_do_i_hold(tolk));
+
+	for (n = 0; n < max; n++) {
+		target = threadlist_remhead(&from->wc_threads);
+		if (target == NULL) {
+			break;
+		}
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+	return n;
+}
+
+bool
+wchan_requeueone(struct wchan *from, struct spinlock *fromlk,
+		 struct wchan *to, struct spinlock *tolk)
+{
+	return wchan_requeue(from, fromlk, to, tolk, 1) == 1;
+}
+
+void
+wchan_requeueall(struct wchan *from, struct spinlock *fromlk,
+		 struct wchan *to, struct spinlock *tolk)
+{
+	wchan_requeue(from, fromlk, to, tolk, ~0U);
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1124,12 +1810,47 @@ wchan_isempty(struct wchan *wc, struct spinlock *lk)
 	return ret;
 }
 
+unsigned
+wchan_toplevel(struct wchan *wc, struct spinlock *lk)
+{
+	struct thread *t;
+	unsigned level, best = SCHED_NLEVELS;
+
+	KASSERT(spinlock_do_i_hold(lk));
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		level = thread_level(t);
+		if (level < best) {
+			best = level;
+		}
+	}
+	return best;
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
  * Machine-independent IPI handling
  */
 
+/*
+ * Post an IPI code to TARGET, interrupting it unless an earlier IPI
+ * is still pending; interprocessor_interrupt handles every bit that
+ * is set when it gets around to it, so one interrupt is enough. The
+ * IPI lock must be held.
+ */
+static
+void
+ipi_post(struct cpu *target, int code)
+{
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
+
+	if (target->c_ipi_pending == 0) {
+		mainbus_send_ipi(target);
+		counter_inc(CTR_IPIS);
+	}
+	target->c_ipi_pending |= (uint32_t)1 << code;
+}
+
 /*
  * Send an IPI (inter-processor interrupt) to the specified CPU.
  */
@@ -1139,8 +1860,7 @@ ipi_send(struct cpu *target, int code)
 	KASSERT(code >= 0 && code < 32);
 
 	spinlock_acquire(&target->c_ipi_lock);
-	target->c_ipi_pending |= (uint32_t)1 << code;
-	mainbus_send_ipi(target);
+	ipi_post(target, code);
 	spinlock_release(&target->c_ipi_lock);
 }
 
@@ -1189,8 +1909,7 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 		target->c_numshootdown = n+1;
 	}
 
-	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
-	mainbus_send_ipi(target);
+	ipi_post(target, IPI_TLBSHOOTDOWN);
 
 	spinlock_release(&target->c_ipi_lock);
 }
@@ -1215,20 +1934,14 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_OFFLINE)) {
 		/* offline request */
 		spinlock_release(&curcpu->c_ipi_lock);
-		spinlock_acquire(&curcpu->c_runqueue_lock);
+		qspinlock_acquire(&curcpu->c_runqueue_lock);
 		if (!curcpu->c_isidle) {
 			kprintf("cpu%d: offline: warning: not idle\n",
 				curcpu->c_number);
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		qspinlock_release(&curcpu->c_runqueue_lock);
 		cpu_halt();
 	}
-	if (bits & (1U << IPI_UNIDLE)) {
-		/*
-		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
-		 */
-	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		/*
 		 * Note: depending on your VM system locking you might
@@ -1243,6 +1956,23 @@ interprocessor_interrupt(void)
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	if (bits & (1U << IPI_UNIDLE)) {
+		/*
+		 * If the cpu was idle it has already unidled itself to
+		 * take the interrupt, and the idle loop will look at
+		 * the wake queue. But the cpu may have found other
+		 * work since the IPI was sent, so take the queued
+		 * wakeups now rather than at the next hardclock. This
+		 * is done after dropping the IPI lock because
+		 * thread_consider_migration calls ipi_send with the
+		 * target's runqueue lock held. (Wakeups don't; they go
+		 * through the wake queue.)
+		 */
+		qspinlock_acquire(&curcpu->c_runqueue_lock);
+		wakeq_drain();
+		qspinlock_release(&curcpu->c_runqueue_lock);
+	}
 }
 
 /*
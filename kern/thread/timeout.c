@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Timer wheel.
+ *
+ * Pending timeouts live in a hierarchical timer wheel: TW_LEVELS
+ * levels of TW_SIZE slots each. Level 0 has a slot per tick for the
+ * next TW_SIZE ticks; each slot of level n covers TW_SIZE^n ticks.
+ * Arming and cancelling a timeout are O(1). On each tick we run the
+ * current level 0 slot, and whenever a level wraps around we move the
+ * timeouts from the next slot of the level above down into the
+ * levels below ("cascading").
+ *
+ * Timeouts further off than the wheel covers go in the last slot of
+ * the top level and get re-filed as they cascade.
+ *
+ * When cpu 0 is idle it doesn't take ticks it has no use for: it asks
+ * timeout_idle how many it can skip, which is up to the next busy
+ * level 0 slot or the next cascade, and catches up afterwards. Until
+ * it calls timeout_unidle, arming a timeout due before then sends it
+ * an IPI so it can think again.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+
+#define TW_BITS		6
+#define TW_SIZE		(1 << TW_BITS)
+#define TW_MASK		(TW_SIZE - 1)
+#define TW_LEVELS	4
+#define TW_SPAN		(1ULL << (TW_BITS * TW_LEVELS))	/* ticks covered */
+
+/* Wait channels for timeout_sleep, hashed by sleeper. */
+#define SLEEPQ_SIZE	16
+
+static struct spinlock timeout_lock = SPINLOCK_INITIALIZER;
+static struct timeout *timer_wheel[TW_LEVELS][TW_SIZE];
+static uint64_t timeout_now;		/* Last tick processed */
+static bool timeout_idling;		/* cpu 0 is skipping ticks... */
+static uint64_t timeout_wakeat;		/* ...until this one */
+static struct timeout *volatile timeout_running; /* fn being called */
+
+static struct {
+	struct spinlock sq_lock;
+	struct wchan *sq_wchan;
+} sleepq[SLEEPQ_SIZE];
+
+/*
+ * Setup.
+ */
+void
+timeout_bootstrap(void)
+{
+	char name[16];
+	unsigned i;
+
+	for (i=0; i<SLEEPQ_SIZE; i++) {
+		spinlock_init(&sleepq[i].sq_lock);
+		snprintf(name, sizeof(name), "sleep%u", i);
+		sleepq[i].sq_wchan = wchan_create(name);
+		if (sleepq[i].sq_wchan == NULL) {
+			panic("timeout_bootstrap: Out of memory\n");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Put TO in the slot for its expiry time. Call with timeout_lock held.
+ */
+static
+void
+timer_wheel_insert(struct timeout *to)
+{
+	struct timeout **slot;
+	uint64_t expire, delta;
+	unsigned level;
+
+	expire = to->to_expire;
+	if (expire <= timeout_now) {
+		/* Overdue (from cascading); run on the next tick. */
+		expire = timeout_now + 1;
+	}
+	delta = expire - timeout_now;
+	if (delta >= TW_SPAN) {
+		expire = timeout_now + TW_SPAN - 1;
+		delta = TW_SPAN - 1;
+	}
+
+	for (level=0; level<TW_LEVELS-1; level++) {
+		if (delta < (1ULL << (TW_BITS * (level + 1)))) {
+			break;
+		}
+	}
+	slot = &timer_wheel[level][(expire >> (TW_BITS * level)) & TW_MASK];
+
+	to->to_next = *slot;
+	if (to->to_next != NULL) {
+		to->to_next->to_pprev = &to->to_next;
+	}
+	to->to_pprev = slot;
+	*slot = to;
+}
+
+/*
+ * Take TO out of the wheel. Call with timeout_lock held.
+ */
+static
+void
+timer_wheel_remove(struct timeout *to)
+{
+	KASSERT(to->to_pprev != NULL);
+	*to->to_pprev = to->to_next;
+	if (to->to_next != NULL) {
+		to->to_next->to_pprev = to->to_pprev;
+	}
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+}
+
+/*
+ * Re-file everything in one slot of a higher level.
+ */
+static
+void
+timer_wheel_cascade(unsigned level, unsigned index)
+{
+	struct timeout *to;
+
+	while ((to = timer_wheel[level][index]) != NULL) {
+		timer_wheel_remove(to);
+		timer_wheel_insert(to);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+void
+timeout_init(struct timeout *to, void (*fn)(void *), void *arg)
+{
+	to->to_next = NULL;
+	to->to_pprev = NULL;
+	to->to_expire = 0;
+	to->to_fn = fn;
+	to->to_arg = arg;
+}
+
+void
+timeout(struct timeout *to, unsigned ticks)
+{
+	bool kick;
+
+	if (ticks == 0) {
+		ticks = 1;
+	}
+
+	spinlock_acquire(&timeout_lock);
+	KASSERT(to->to_pprev == NULL);
+	to->to_expire = timeout_now + ticks;
+	timer_wheel_insert(to);
+	kick = timeout_idling && to->to_expire < timeout_wakeat;
+	if (kick) {
+		/* One IPI is enough. */
+		timeout_idling = false;
+	}
+	spinlock_release(&timeout_lock);
+
+	/* On cpu 0 itself, the idle loop will look again anyway. */
+	if (kick && curcpu->c_number != 0) {
+		ipi_send(cpu_lookup(0), IPI_UNIDLE);
+	}
+}
+
+bool
+untimeout(struct timeout *to)
+{
+	bool pending;
+
+	spinlock_acquire(&timeout_lock);
+	pending = (to->to_pprev != NULL);
+	if (pending) {
+		timer_wheel_remove(to);
+	}
+	else if (!(curcpu->c_number == 0 && curthread->t_in_interrupt)) {
+		/*
+		 * It may have fired and be running on cpu 0 now; wait
+		 * for it to finish, so the caller can free TO and its
+		 * argument. (Unless we're the timer interrupt, in which
+		 * case it's us, or done.) It can't sleep, so this is
+		 * short.
+		 */
+		while (timeout_running == to) {
+			spinlock_release(&timeout_lock);
+			spinlock_acquire(&timeout_lock);
+		}
+	}
+	spinlock_release(&timeout_lock);
+
+	return pending;
+}
+
+/*
+ * Advance the wheel by one tick and run what has come due. Called
+ * from hardclock on cpu 0 only.
+ */
+void
+timeout_tick(void)
+{
+	struct timeout *to;
+	void (*fn)(void *);
+	void *arg;
+	unsigned level, index;
+
+	spinlock_acquire(&timeout_lock);
+
+	timeout_now++;
+	for (level=1; level<TW_LEVELS; level++) {
+		if ((timeout_now & ((1ULL << (TW_BITS * level)) - 1)) != 0) {
+			break;
+		}
+		index = (timeout_now >> (TW_BITS * level)) & TW_MASK;
+		timer_wheel_cascade(level, index);
+	}
+
+	/*
+	 * Run the current slot. Everything in it is due now; the
+	 * lock is dropped around each call so the function can arm
+	 * timeouts (which always land in a later slot).
+	 */
+	index = timeout_now & TW_MASK;
+	while ((to = timer_wheel[0][index]) != NULL) {
+		KASSERT(to->to_expire <= timeout_now);
+		timer_wheel_remove(to);
+		fn = to->to_fn;
+		arg = to->to_arg;
+		timeout_running = to;
+		spinlock_release(&timeout_lock);
+		fn(arg);
+		spinlock_acquire(&timeout_lock);
+		timeout_running = NULL;
+	}
+
+	spinlock_release(&timeout_lock);
+}
+
+/*
+ * Cpu 0 is about to idle; return how many ticks it can let go by
+ * before it has to run timeout_tick again, at most MAX.
+ */
+unsigned
+timeout_idle(unsigned max)
+{
+	unsigned ticks, i;
+
+	spinlock_acquire(&timeout_lock);
+
+	/* At the next wraparound of level 0, the level above cascades. */
+	ticks = TW_SIZE - (timeout_now & TW_MASK);
+	for (i=1; i<ticks; i++) {
+		if (timer_wheel[0][(timeout_now + i) & TW_MASK] != NULL) {
+			ticks = i;
+			break;
+		}
+	}
+	if (ticks > max) {
+		ticks = max;
+	}
+
+	timeout_idling = true;
+	timeout_wakeat = timeout_now + ticks;
+	spinlock_release(&timeout_lock);
+
+	return ticks;
+}
+
+/*
+ * Cpu 0 is taking ticks again.
+ */
+void
+timeout_unidle(void)
+{
+	spinlock_acquire(&timeout_lock);
+	timeout_idling = false;
+	spinlock_release(&timeout_lock);
+}
+
+////////////////////////////////////////////////////////////
+
+struct sleeper {
+	unsigned sl_queue;		/* Index in sleepq */
+	struct thread *sl_thread;
+	volatile bool sl_done;
+};
+
+static
+void
+timeout_wakeup(void *arg)
+{
+	struct sleeper *sl = arg;
+	unsigned q = sl->sl_queue;
+
+	/* Once sl_done is set the sleeper may return; don't touch sl. */
+	spinlock_acquire(&sleepq[q].sq_lock);
+	sl->sl_done = true;
+	wchan_wakethread(sleepq[q].sq_wchan, &sleepq[q].sq_lock,
+			 sl->sl_thread);
+	spinlock_release(&sleepq[q].sq_lock);
+}
+
+/*
+ * Sleep for TICKS ticks. The queue is picked by thread, since the
+ * stack address of SL is much the same for every sleeper, and the
+ * timeout wakes only us.
+ */
+void
+timeout_sleep(unsigned ticks)
+{
+	struct sleeper sl;
+	struct timeout to;
+
+	sl.sl_queue = ((uintptr_t)curthread / sizeof(struct thread))
+		% SLEEPQ_SIZE;
+	sl.sl_thread = curthread;
+	sl.sl_done = false;
+	timeout_init(&to, timeout_wakeup, &sl);
+
+	spinlock_acquire(&sleepq[sl.sl_queue].sq_lock);
+	timeout(&to, ticks);
+	while (!sl.sl_done) {
+		wchan_sleep(sleepq[sl.sl_queue].sq_wchan,
+			    &sleepq[sl.sl_queue].sq_lock);
+	}
+	spinlock_release(&sleepq[sl.sl_queue].sq_lock);
+}
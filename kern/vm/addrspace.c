@@ -36,6 +36,7 @@
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
+#include <synch.h>
 #include <vm.h>
 
 /*
@@ -44,6 +45,12 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
+/* Protects as_refcount in every address space */
+static struct spinlock as_reflock = SPINLOCK_INITIALIZER;
+
+/* Translations saved per address space; at most TLBWS_MAX */
+unsigned tlb_working_set = 16;
+
 struct addrspace *
 as_create(void)
 {
@@ -54,8 +61,16 @@ as_create(void)
 		return NULL;
 	}
 
+	as->as_lock = lock_create("addrspace");
+	if(as->as_lock == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_refcount = 1;
+
 	as->pt = pt_create();
 	if(as->pt == NULL) {
+		lock_destroy(as->as_lock);
 		kfree(as);
 		return NULL;
 	}
@@ -63,18 +78,34 @@ as_create(void)
 	as->regions = region_list_create();
 	if(as->regions == NULL) {
 		kfree(as->pt);
+		lock_destroy(as->as_lock);
+		kfree(as);
+		return NULL;
+	}
+
+	as->shm = shm_list_create();
+	if(as->shm == NULL) {
+		region_list_destroy(as->regions);
+		kfree(as->pt);
+		lock_destroy(as->as_lock);
 		kfree(as);
 		return NULL;
 	}
+	as->shm_bottom = 0;
 
 	as->heap_start = 0;
 	as->heap_size = 0;
 
 	as->stack_start = 0;
 	as->stack_size = 0;
+	as->as_tstacks = 0;
 
 	as->as_pid = 0;
 
+	spinlock_init(&as->as_tlblock);
+	as->as_tlbfrozen = 0;
+	as->as_ntlbsaved = 0;
+
 	return as;
 }
 
@@ -124,7 +155,19 @@ as_copy(struct addrspace *old, struct addrspace **ret, pid_t new_pid)
 	newas->stack_start = old->stack_start;
 	newas->stack_size = old->stack_size;
 
+	lock_acquire(old->as_lock);
+
+	err = shm_list_copy(old->shm, newas->shm);
+	if(err) {
+		lock_release(old->as_lock);
+		as_destroy(newas);
+		return ENOMEM;
+	}
+	newas->shm_bottom = old->shm_bottom;
+	newas->as_tstacks = old->as_tstacks;
+
 	err = pt_copy(old, newas);
+	lock_release(old->as_lock);
 	if(err) {
 		as_destroy(newas);
 		return ENOMEM;
@@ -134,12 +177,36 @@ as_copy(struct addrspace *old, struct addrspace **ret, pid_t new_pid)
 	return 0;
 }
 
+void
+as_incref(struct addrspace *as)
+{
+	spinlock_acquire(&as_reflock);
+	KASSERT(as->as_refcount > 0);
+	as->as_refcount++;
+	spinlock_release(&as_reflock);
+}
+
 void
 as_destroy(struct addrspace *as)
 {
+	bool last;
+
 	if(as != NULL) {
+		spinlock_acquire(&as_reflock);
+		KASSERT(as->as_refcount > 0);
+		as->as_refcount--;
+		last = (as->as_refcount == 0);
+		spinlock_release(&as_reflock);
+
+		if(!last) {
+			return;
+		}
+
 		region_list_destroy(as->regions);
 		pt_destroy(as);
+		shm_list_destroy(as->shm);
+		spinlock_cleanup(&as->as_tlblock);
+		lock_destroy(as->as_lock);
 		kfree(as);
 	}
 }
@@ -149,6 +216,7 @@ void
 as_activate(void)
 {
 	int i, spl;
+	unsigned n;
 	struct addrspace *as;
 
 	as = proc_getas();
@@ -163,9 +231,91 @@ as_activate(void)
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
 
+	/*
+	 * Load the translations we had when we last ran, saving a
+	 * refill fault for each one that is still wanted.
+	 */
+	spinlock_acquire(&as->as_tlblock);
+	if (as->as_tlbfrozen == 0) {
+		for (n=0; n<as->as_ntlbsaved; n++) {
+			tlb_write(as->as_tlbhi[n], as->as_tlblo[n], n);
+		}
+	}
+	spinlock_release(&as->as_tlblock);
+
+	splx(spl);
+}
+
+/*
+ * Called from thread_switch when curthread is giving up the
+ * processor. There are no reference bits in the MIPS TLB, so the
+ * translations still resident are taken as the working set; we keep
+ * the first tlb_working_set of them.
+ */
+void
+as_tlbsave(void)
+{
+	int i, spl;
+	unsigned n, max;
+	uint32_t ehi, elo;
+	struct addrspace *as;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return;
+	}
+
+	max = tlb_working_set;
+	if (max > TLBWS_MAX) {
+		max = TLBWS_MAX;
+	}
+
+	spl = splhigh();
+	spinlock_acquire(&as->as_tlblock);
+
+	n = 0;
+	if (as->as_tlbfrozen == 0) {
+		for (i=0; i<NUM_TLB && n<max; i++) {
+			tlb_read(&ehi, &elo, i);
+			if (elo & TLBLO_VALID) {
+				as->as_tlbhi[n] = ehi;
+				as->as_tlblo[n] = elo;
+				n++;
+			}
+		}
+	}
+	as->as_ntlbsaved = n;
+
+	spinlock_release(&as->as_tlblock);
 	splx(spl);
 }
 
+/*
+ * Remove VPN's translation from every TLB. The caller holds as_lock
+ * and is about to change the page's mapping.
+ *
+ * The saved working set is dropped, and saving and loading are held
+ * off until all cpus have finished; otherwise a cpu switching out
+ * before the shootdown reached it could save the old translation and
+ * another could load it after.
+ */
+void
+as_shootdown(struct addrspace *as, vaddr_t vpn)
+{
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	spinlock_acquire(&as->as_tlblock);
+	as->as_tlbfrozen++;
+	as->as_ntlbsaved = 0;
+	spinlock_release(&as->as_tlblock);
+
+	vm_tlbshootdown_all(vpn);
+
+	spinlock_acquire(&as->as_tlblock);
+	as->as_tlbfrozen--;
+	spinlock_release(&as->as_tlblock);
+}
+
 void
 as_deactivate(void)
 {
@@ -277,6 +427,9 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	*stackptr = USERSTACK;
 	as->stack_start = *stackptr;
 	as->stack_size = PAGE_SIZE * 1024; // 4MB
+	// Shared mappings are placed below the thread stacks, growing down
+	as->shm_bottom = as->stack_start - as->stack_size -
+		(UTHREAD_MAX - 1) * TSTACK_SIZE;
 	return 0;
 }
 
@@ -287,6 +440,104 @@ as_in_stack(struct addrspace *as, vaddr_t vaddr)
 	return (vaddr < as->stack_start) && (vaddr >= as->stack_start - as->stack_size);
 }
 
+/*
+ * Top of the stack for user thread SLOT.
+ */
+static
+vaddr_t
+as_tstack_top(struct addrspace *as, unsigned slot)
+{
+	KASSERT(slot > 0 && slot < UTHREAD_MAX);
+	return as->stack_start - as->stack_size - (slot - 1) * TSTACK_SIZE;
+}
+
+/*
+ * Is VADDR on the stack of a user thread, and not its guard page?
+ */
+static
+bool
+as_in_tstack(struct addrspace *as, vaddr_t vaddr)
+{
+	vaddr_t top = as->stack_start - as->stack_size;
+	unsigned slot;
+
+	if(as->as_tstacks == 0 || vaddr >= top ||
+	   vaddr < top - (UTHREAD_MAX - 1) * TSTACK_SIZE) {
+		return false;
+	}
+	slot = (top - vaddr - 1) / TSTACK_SIZE + 1;
+	if((as->as_tstacks & (1U << slot)) == 0) {
+		return false;
+	}
+	return vaddr >= as_tstack_top(as, slot) - TSTACK_SIZE + PAGE_SIZE;
+}
+
+/*
+ * Drop VPN's translation before its page goes away. Only this cpu
+ * can have one, unless other threads are running in the address
+ * space; then they all have to be told.
+ */
+static
+void
+as_unmap_tlb(struct addrspace *as, vaddr_t vpn)
+{
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	if(as->as_tstacks != 0) {
+		as_shootdown(as, vpn);
+	} else {
+		tlb_null_entry(vpn);
+	}
+}
+
+/*
+ * Unmap whatever pages of thread stack SLOT have been touched.
+ */
+static
+void
+as_unmap_tstack(struct addrspace *as, unsigned slot)
+{
+	vaddr_t top, va;
+
+	KASSERT(lock_do_i_hold(as->as_lock));
+
+	top = as_tstack_top(as, slot);
+	for(va = top - TSTACK_SIZE; va < top; va += PAGE_SIZE) {
+		if(pt_get_pte(as->pt, va) != NULL) {
+			as_unmap_tlb(as, va);
+			pt_remove(as, va);
+		}
+	}
+}
+
+int
+as_define_tstack(struct addrspace *as, unsigned slot, vaddr_t *stackptr)
+{
+	KASSERT(as->stack_size != 0);
+
+	lock_acquire(as->as_lock);
+	if(as->as_tstacks & (1U << slot)) {
+		/* Left over from the parent; see uthread_fork. */
+		as_unmap_tstack(as, slot);
+	}
+	as->as_tstacks |= 1U << slot;
+	lock_release(as->as_lock);
+
+	*stackptr = as_tstack_top(as, slot);
+	return 0;
+}
+
+void
+as_release_tstack(struct addrspace *as, unsigned slot)
+{
+	lock_acquire(as->as_lock);
+	if(as->as_tstacks & (1U << slot)) {
+		as_unmap_tstack(as, slot);
+		as->as_tstacks &= ~(1U << slot);
+	}
+	lock_release(as->as_lock);
+}
+
 static
 bool
 as_in_heap(struct addrspace *as, vaddr_t vaddr)
@@ -297,7 +548,7 @@ as_in_heap(struct addrspace *as, vaddr_t vaddr)
 bool
 vaddr_in_segment(struct addrspace *as, vaddr_t vaddr)
 {
-	bool res = is_valid_region(as->regions, vaddr, 0) || as_in_stack(as, vaddr) || as_in_heap(as, vaddr);
+	bool res = is_valid_region(as->regions, vaddr, 0) || as_in_stack(as, vaddr) || as_in_tstack(as, vaddr) || as_in_heap(as, vaddr) || shm_lookup(as->shm, vaddr) != NULL;
 	// if(!res) {
 	// 	kprintf("!=============================================!\n");
 	// 	kprintf("ERROR: is_valid_region returning false! vaddr: %x\n", vaddr);
@@ -319,7 +570,7 @@ vaddr_in_segment(struct addrspace *as, vaddr_t vaddr)
 bool
 page_still_needed(struct addrspace *as, vaddr_t vaddr)
 {
-	bool res = as_in_heap(as, vaddr) || as_in_stack(as, vaddr) || region_uses_page(as->regions, vaddr);
+	bool res = as_in_heap(as, vaddr) || as_in_stack(as, vaddr) || as_in_tstack(as, vaddr) || region_uses_page(as->regions, vaddr) || shm_lookup(as->shm, vaddr) != NULL;
 	// if(!res) {
 	// 	kprintf("!=============================================!\n");
 	// 	kprintf("NOTE: page_still_needed() returning false! Page vaddr: %x\n", vaddr);
@@ -350,6 +601,8 @@ as_clean_segments(struct addrspace *as)
 
 	struct pagetable *pt = as->pt;
 
+	lock_acquire(as->as_lock);
+
 	if(pt->head != NULL) {
 
 		struct pt_entry *prev = NULL;
@@ -376,7 +629,7 @@ as_clean_segments(struct addrspace *as)
 				}
 				current = current->next_entry;
 				to_destroy->next_entry = NULL;
-				tlb_null_entry(to_destroy->vpn);
+				as_unmap_tlb(as, to_destroy->vpn);
 				pte_destroy(to_destroy, as->as_pid);
 
 			} else {
@@ -387,5 +640,95 @@ as_clean_segments(struct addrspace *as)
 		}
 
 	}
+
+	lock_release(as->as_lock);
 	return 0;
-}
\ No newline at end of file
+}
+/*
+ * Create a shared anonymous segment of at least len bytes and map it
+ * below the stack (and any earlier shared mappings). Address space is
+ * handed out bump-allocator style; unmapping does not recycle it.
+ */
+int
+as_map_shared(struct addrspace *as, size_t len, vaddr_t *ret)
+{
+	struct shm_segment *seg;
+	size_t npages;
+	vaddr_t start;
+	int err;
+
+	if(as == NULL || len == 0) {
+		return EINVAL;
+	}
+
+	KASSERT(as->shm_bottom != 0);
+
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+	seg = shm_segment_create(npages);
+	if(seg == NULL) {
+		return ENOMEM;
+	}
+
+	lock_acquire(as->as_lock);
+
+	if(npages > (as->shm_bottom - (as->heap_start + as->heap_size)) / PAGE_SIZE) {
+		lock_release(as->as_lock);
+		shm_segment_decref(seg);
+		return ENOMEM;
+	}
+	start = as->shm_bottom - npages * PAGE_SIZE;
+
+	err = shm_list_add(as->shm, start, seg);
+	if(err) {
+		lock_release(as->as_lock);
+		shm_segment_decref(seg);
+		return err;
+	}
+
+	as->shm_bottom = start;
+	lock_release(as->as_lock);
+
+	*ret = start;
+	return 0;
+}
+
+/*
+ * Remove the shared mapping at vaddr. Only whole mappings can be
+ * removed.
+ */
+int
+as_unmap_shared(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct shm_mapping *map;
+
+	if(as == NULL) {
+		return EINVAL;
+	}
+
+	lock_acquire(as->as_lock);
+
+	map = shm_lookup(as->shm, vaddr);
+	if(map == NULL || map->start != vaddr ||
+	   (len + PAGE_SIZE - 1) / PAGE_SIZE != map->npages) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	map = shm_list_remove(as->shm, vaddr);
+	KASSERT(map != NULL);
+
+	// Untouched pages have no entry, so nothing to do for them.
+	for(size_t i = 0; i < map->npages; i++) {
+		vaddr_t va = map->start + i * PAGE_SIZE;
+		if(pt_get_pte(as->pt, va) != NULL) {
+			as_unmap_tlb(as, va);
+			pt_remove(as, va);
+		}
+	}
+
+	lock_release(as->as_lock);
+
+	shm_segment_decref(map->seg);
+	kfree(map);
+	return 0;
+}
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Futexes: user-level wait and wake on a word of user memory.
+ *
+ * A futex is identified by a key. For a word in a shared mapping the
+ * key is the physical address of the word, so every process that maps
+ * the segment finds the same futex. Otherwise it is the address space
+ * and virtual address, which stays the same however the page moves
+ * (copy-on-write, page merging).
+ *
+ * Waiters are kept in a hash table of FUTEX_NBUCKETS buckets, each a
+ * list of waiters and a wait channel under a spinlock. FUTEX_WAKE
+ * marks the waiters it picks and wakes the whole bucket; the others
+ * see they weren't picked and go back to sleep.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/futex.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <synch.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <proc_syscalls.h>
+
+#define FUTEX_HASHBITS	6
+#define FUTEX_NBUCKETS	(1 << FUTEX_HASHBITS)
+
+struct futex_key {
+	struct addrspace *fk_as;	/* NULL for a shared page */
+	uintptr_t fk_addr;		/* vaddr, or paddr if shared */
+};
+
+/* One of these lives on the stack of each waiting thread. */
+struct futex_waiter {
+	struct futex_waiter *fw_next;
+	struct futex_key fw_key;
+	struct proc *fw_proc;		/* for futex_wakeproc */
+	bool fw_woken;
+};
+
+static struct futex_bucket {
+	struct spinlock fb_lock;
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters;
+} futex_table[FUTEX_NBUCKETS];
+
+/*
+ * Setup.
+ */
+void
+futex_bootstrap(void)
+{
+	char name[16];
+	unsigned i;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		spinlock_init(&futex_table[i].fb_lock);
+		snprintf(name, sizeof(name), "futex%u", i);
+		futex_table[i].fb_wchan = wchan_create(name);
+		if (futex_table[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+/*
+ * Work out the key for the word at UADDR in the current process.
+ */
+static
+int
+futex_getkey(vaddr_t uaddr, struct futex_key *key)
+{
+	struct addrspace *as;
+	struct shm_mapping *map;
+	paddr_t ppn;
+	int err = 0;
+
+	if (uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	if (uaddr >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	as = proc_getas();
+	KASSERT(as != NULL);
+
+	lock_acquire(as->as_lock);
+	map = shm_lookup(as->shm, uaddr);
+	if (map != NULL) {
+		err = shm_segment_getpage(map->seg,
+					  (uaddr - map->start) / PAGE_SIZE,
+					  &ppn);
+		key->fk_as = NULL;
+		key->fk_addr = ppn + (uaddr & ~PAGE_FRAME);
+	}
+	else {
+		key->fk_as = as;
+		key->fk_addr = uaddr;
+	}
+	lock_release(as->as_lock);
+
+	return err;
+}
+
+static
+struct futex_bucket *
+futex_bucket(const struct futex_key *key)
+{
+	uint32_t hash;
+
+	hash = ((uintptr_t)key->fk_as ^ key->fk_addr) >> 2;
+	hash *= 2654435761U;	/* Knuth's multiplicative hash */
+	return &futex_table[hash >> (32 - FUTEX_HASHBITS)];
+}
+
+static
+bool
+futex_samekey(const struct futex_key *a, const struct futex_key *b)
+{
+	return a->fk_as == b->fk_as && a->fk_addr == b->fk_addr;
+}
+
+/*
+ * FUTEX_WAIT.
+ *
+ * We can't read user memory under the bucket spinlock, since that
+ * might fault. So queue up first, then check the value, then sleep
+ * unless a FUTEX_WAKE has picked us in the meantime. A waker changes
+ * the value before waking, so if we read the old value any wake that
+ * follows will find us on the queue.
+ */
+static
+int
+futex_wait(vaddr_t uaddr, int val)
+{
+	struct futex_waiter w, **pp;
+	struct futex_bucket *fb;
+	int cur, err;
+
+	err = futex_getkey(uaddr, &w.fw_key);
+	if (err) {
+		return err;
+	}
+	w.fw_proc = curproc;
+	w.fw_woken = false;
+	w.fw_next = NULL;
+
+	/* Join the end of the queue, so wakeups go in arrival order. */
+	fb = futex_bucket(&w.fw_key);
+	spinlock_acquire(&fb->fb_lock);
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		/* nothing */
+	}
+	*pp = &w;
+	spinlock_release(&fb->fb_lock);
+
+	err = copyin((const_userptr_t)uaddr, &cur, sizeof(cur));
+	if (!err && cur != val) {
+		err = EAGAIN;
+	}
+
+	spinlock_acquire(&fb->fb_lock);
+	if (!err && curproc->p_exiting) {
+		/* Too late for futex_wakeproc to see us; don't sleep. */
+		err = EINTR;
+	}
+	if (err) {
+		if (!w.fw_woken) {
+			for (pp = &fb->fb_waiters; *pp != &w;
+			     pp = &(*pp)->fw_next) {
+				KASSERT(*pp != NULL);
+			}
+			*pp = w.fw_next;
+		}
+	}
+	else {
+		while (!w.fw_woken) {
+			wchan_sleep(fb->fb_wchan, &fb->fb_lock);
+		}
+	}
+	spinlock_release(&fb->fb_lock);
+
+	return err;
+}
+
+/*
+ * FUTEX_WAKE. Wake up to COUNT waiters, longest waiting first.
+ */
+static
+int
+futex_wake(vaddr_t uaddr, int count, int32_t *retval)
+{
+	struct futex_key key;
+	struct futex_waiter *w, **pp;
+	struct futex_bucket *fb;
+	int err, woken = 0;
+
+	if (count < 0) {
+		return EINVAL;
+	}
+
+	err = futex_getkey(uaddr, &key);
+	if (err) {
+		return err;
+	}
+
+	fb = futex_bucket(&key);
+	spinlock_acquire(&fb->fb_lock);
+	pp = &fb->fb_waiters;
+	while ((w = *pp) != NULL && woken < count) {
+		if (futex_samekey(&w->fw_key, &key)) {
+			*pp = w->fw_next;
+			w->fw_woken = true;
+			woken++;
+		}
+		else {
+			pp = &w->fw_next;
+		}
+	}
+	if (woken > 0) {
+		wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+	}
+	spinlock_release(&fb->fb_lock);
+
+	*retval = woken;
+	return 0;
+}
+
+int
+sys_futex(userptr_t uaddr, int op, int val, int32_t *retval)
+{
+	int err;
+
+	switch (op) {
+	    case FUTEX_WAIT:
+		err = futex_wait((vaddr_t)uaddr, val);
+		break;
+	    case FUTEX_WAKE:
+		err = futex_wake((vaddr_t)uaddr, val, retval);
+		break;
+	    default:
+		err = EINVAL;
+		break;
+	}
+
+	if (err) {
+		*retval = err;
+	}
+	return err;
+}
+
+/*
+ * Wake every waiter belonging to PROC, which is exiting, so its
+ * threads can leave (see uthread.c). A waiter that queues after we've
+ * been through its bucket sees p_exiting and doesn't sleep.
+ */
+void
+futex_wakeproc(struct proc *proc)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter *w, **pp;
+	unsigned i;
+	bool woken;
+
+	for (i=0; i<FUTEX_NBUCKETS; i++) {
+		fb = &futex_table[i];
+		woken = false;
+		spinlock_acquire(&fb->fb_lock);
+		pp = &fb->fb_waiters;
+		while ((w = *pp) != NULL) {
+			if (w->fw_proc == proc) {
+				*pp = w->fw_next;
+				w->fw_woken = true;
+				woken = true;
+			}
+			else {
+				pp = &w->fw_next;
+			}
+		}
+		if (woken) {
+			wchan_wakeall(fb->fb_wchan, &fb->fb_lock);
+		}
+		spinlock_release(&fb->fb_lock);
+	}
+}
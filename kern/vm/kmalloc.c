@@ -168,7 +168,7 @@ struct pageref {
  * OS/161 performance and scalability aren't super-critical.
  */
 
-static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
+static struct qspinlock kmalloc_spinlock = QSPINLOCK_INITIALIZER;
 
 ////////////////////////////////////////
 
@@ -230,9 +230,9 @@ allocpagerefpage(struct kheap_root *root)
 	 * avoids deadlock if alloc_kpages needs to come back here.
 	 * Note that this means things can change behind our back...
 	 */
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 	va = alloc_kpages(1);
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 	if (va == 0) {
 		kprintf("kmalloc: Couldn't get a pageref page\n");
 		return;
@@ -241,9 +241,9 @@ allocpagerefpage(struct kheap_root *root)
 
 	if (root->page != NULL) {
 		/* Oops, somebody else allocated it. */
-		spinlock_release(&kmalloc_spinlock);
+		qspinlock_release(&kmalloc_spinlock);
 		free_kpages(va);
-		spinlock_acquire(&kmalloc_spinlock);
+		qspinlock_acquire(&kmalloc_spinlock);
 		/* Once allocated it isn't ever freed. */
 		KASSERT(root->page != NULL);
 		return;
@@ -509,7 +509,7 @@ checksubpage(struct pageref *pr)
 	size_t smallerblocksize;
 #endif
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(qspinlock_do_i_hold(&kmalloc_spinlock));
 
 	if (pr->freelist_offset == INVALID_OFFSET) {
 		KASSERT(pr->nfree==0);
@@ -585,7 +585,7 @@ checksubpages(void)
 	int i;
 	unsigned sc=0, ac=0;
 
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(qspinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
@@ -703,9 +703,9 @@ void
 kheap_nextgeneration(void)
 {
 #ifdef LABELS
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 	mallocgeneration++;
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 #endif
 }
 
@@ -714,9 +714,9 @@ kheap_dump(void)
 {
 #ifdef LABELS
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 	dump_subpages(mallocgeneration);
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 #else
 	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
 #endif
@@ -729,11 +729,11 @@ kheap_dumpall(void)
 	unsigned i;
 
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 	for (i=0; i<=mallocgeneration; i++) {
 		dump_subpages(i);
 	}
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 #else
 	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
 #endif
@@ -755,7 +755,7 @@ subpage_stats(struct pageref *pr, bool quiet)
 	uint32_t freemap[PAGE_SIZE / (SMALLEST_SUBPAGE_SIZE*32)];
 
 	checksubpage(pr);
-	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(qspinlock_do_i_hold(&kmalloc_spinlock));
 
 	/* clear freemap[] */
 	for (i=0; i<ARRAYCOUNT(freemap); i++) {
@@ -808,7 +808,7 @@ kheap_printstats(void)
 	struct pageref *pr;
 
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
@@ -816,7 +816,7 @@ kheap_printstats(void)
 		subpage_stats(pr, false);
 	}
 
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 }
 
 
@@ -831,7 +831,7 @@ kheap_getused(void) {
 	unsigned int num_pages = 0, coremap_bytes = 0;
 
 	/* compute with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		total += subpage_stats(pr, true);
 		num_pages++;
@@ -845,7 +845,7 @@ kheap_getused(void) {
 		total += coremap_bytes - (num_pages * PAGE_SIZE);
 	}
 
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 
 	return total;
 }
@@ -955,7 +955,7 @@ subpage_kmalloc(size_t sz
 	sz = sizes[blktype];
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
@@ -997,7 +997,7 @@ subpage_kmalloc(size_t sz
 
 			checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
+			qspinlock_release(&kmalloc_spinlock);
 			return retptr;
 		}
 	}
@@ -1011,7 +1011,7 @@ subpage_kmalloc(size_t sz
 	 * Note that this means things can change behind our back...
 	 */
 
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 	prpage = alloc_kpages(1);
 	if (prpage==0) {
 		/* Out of memory. */
@@ -1023,12 +1023,12 @@ subpage_kmalloc(size_t sz
 	/* deadbeef the whole page, as it probably starts zeroed */
 	fill_deadbeef((void *)prpage, PAGE_SIZE);
 #endif
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
-		spinlock_release(&kmalloc_spinlock);
+		qspinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
 		return NULL;
@@ -1109,7 +1109,7 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
 
@@ -1133,7 +1133,7 @@ subpage_kfree(void *ptr)
 
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
+		qspinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
@@ -1191,17 +1191,17 @@ subpage_kfree(void *ptr)
 		remove_lists(pr, blktype);
 		freepageref(pr);
 		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
+		qspinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 	}
 	else {
-		spinlock_release(&kmalloc_spinlock);
+		qspinlock_release(&kmalloc_spinlock);
 	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
+	qspinlock_acquire(&kmalloc_spinlock);
 	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
+	qspinlock_release(&kmalloc_spinlock);
 #endif
 
 	return 0;
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Same-page merging.
+ *
+ * Off by default; the "ksm on" menu command turns it on. Then a
+ * kernel thread wakes up once a second and walks the page table of
+ * every process, hashing each private page. A page whose hash is the
+ * same as on the previous pass is considered stable and may be merged:
+ *
+ *   - If the stable table has a merged frame with the same hash and
+ *     the same contents, the page is pointed at that frame and its
+ *     own frame is freed.
+ *   - Otherwise, if the unstable table saw another page with the same
+ *     hash earlier in this pass, this page's frame becomes a merged
+ *     frame and goes into the stable table. The other page merges
+ *     into it when the scanner next reaches it.
+ *   - Otherwise the page is remembered in the unstable table.
+ *
+ * Merged frames are mapped read-only; a write faults and vm_fault
+ * gives the writer a private copy (pt_break_cow).
+ *
+ * Both tables are small direct-mapped arrays allocated at boot, so
+ * the scanner doesn't allocate memory as it runs. Stable slots don't
+ * hold references; a slot is only used after checking that its frame
+ * is still merged and has the right contents.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <synch.h>
+#include <thread.h>
+#include <proc.h>
+#include <limits.h>
+#include <addrspace.h>
+#include <vm.h>
+
+#define KSM_TABLE_SIZE	256	/* slots in each table */
+#define KSM_SCAN_SECS	1	/* seconds between passes */
+
+struct ksm_stable {
+	uint32_t ks_hash;
+	paddr_t ks_ppn;		/* merged frame, or 0 */
+};
+
+struct ksm_unstable {
+	uint32_t ku_hash;
+	unsigned ku_pass;	/* pass that recorded this slot */
+	pid_t ku_pid;
+	vaddr_t ku_vpn;
+};
+
+volatile bool ksm_enabled = false;
+uint32_t ksm_pages_merged;
+
+static struct ksm_stable *ksm_stable;
+static struct ksm_unstable *ksm_unstable;
+static unsigned ksm_pass;
+
+/*
+ * FNV-1a over the words of a page.
+ */
+static
+uint32_t
+ksm_hash(paddr_t ppn)
+{
+	const uint32_t *words = (const uint32_t *)PADDR_TO_KVADDR(ppn);
+	uint32_t hash = 2166136261U;
+	unsigned i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		hash ^= words[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static
+bool
+ksm_same_page(paddr_t a, paddr_t b)
+{
+	const uint32_t *wa = (const uint32_t *)PADDR_TO_KVADDR(a);
+	const uint32_t *wb = (const uint32_t *)PADDR_TO_KVADDR(b);
+	unsigned i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+		if (wa[i] != wb[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * Point PTE at the merged frame TARGET if the contents match. The
+ * page's own frame is freed.
+ */
+static
+bool
+ksm_merge_into(struct addrspace *as, struct pt_entry *pte, paddr_t target)
+{
+	paddr_t old = pte->ppn;
+
+	if (!ksm_same_page(old, target)) {
+		return false;
+	}
+	if (!page_ref_if_merged(target)) {
+		return false;
+	}
+
+	/*
+	 * Take away write access, then compare again: the owner may
+	 * have written the page before the shootdown, but any write
+	 * after it faults and waits for the as lock we hold.
+	 */
+	as_shootdown(as, pte->vpn);
+	if (!ksm_same_page(old, target)) {
+		page_decref(target);
+		return false;
+	}
+
+	pte->ppn = target;
+	free_page_at_index(old / PAGE_SIZE, as->as_pid, pte->vpn);
+	ksm_pages_merged++;
+	return true;
+}
+
+/*
+ * Make PTE's frame a merged frame and publish it in the stable table.
+ */
+static
+void
+ksm_promote(struct addrspace *as, struct pt_entry *pte, uint32_t hash)
+{
+	struct ksm_stable *slot = &ksm_stable[hash % KSM_TABLE_SIZE];
+
+	as_shootdown(as, pte->vpn);
+	page_make_merged(pte->ppn, as->as_pid, pte->vpn);
+	slot->ks_hash = hash;
+	slot->ks_ppn = pte->ppn;
+}
+
+static
+void
+ksm_scan_as(struct addrspace *as, pid_t pid)
+{
+	struct pt_entry *pte;
+	struct ksm_stable *st;
+	struct ksm_unstable *un;
+	uint32_t hash;
+
+	lock_acquire(as->as_lock);
+
+	for (pte = as->pt->head; pte != NULL && ksm_enabled;
+	     pte = pte->next_entry) {
+
+		/* Skips shared memory and pages merged already */
+		if (page_is_shared(pte->ppn)) {
+			continue;
+		}
+
+		hash = ksm_hash(pte->ppn);
+		if (hash != pte->checksum) {
+			/* Not stable yet */
+			pte->checksum = hash;
+			continue;
+		}
+
+		st = &ksm_stable[hash % KSM_TABLE_SIZE];
+		if (st->ks_ppn != 0 && st->ks_hash == hash &&
+		    ksm_merge_into(as, pte, st->ks_ppn)) {
+			continue;
+		}
+
+		un = &ksm_unstable[hash % KSM_TABLE_SIZE];
+		if (un->ku_pass == ksm_pass && un->ku_hash == hash &&
+		    (un->ku_pid != pid || un->ku_vpn != pte->vpn)) {
+			ksm_promote(as, pte, hash);
+			un->ku_pass = 0;
+			continue;
+		}
+
+		un->ku_hash = hash;
+		un->ku_pass = ksm_pass;
+		un->ku_pid = pid;
+		un->ku_vpn = pte->vpn;
+	}
+
+	lock_release(as->as_lock);
+}
+
+static
+void
+ksm_scan(void)
+{
+	struct addrspace *as;
+	pid_t pid;
+
+	ksm_pass++;
+	if (ksm_pass == 0) {
+		/* 0 marks an unused unstable slot */
+		ksm_pass = 1;
+	}
+
+	for (pid = proc_table_next(0); pid > 0 && ksm_enabled;
+	     pid = proc_table_next(pid)) {
+		as = proc_holdas(pid);
+		if (as != NULL) {
+			ksm_scan_as(as, pid);
+			as_destroy(as);
+		}
+	}
+}
+
+static
+void
+ksm_thread(void *data1, unsigned long data2)
+{
+	(void)data1;
+	(void)data2;
+
+	while (true) {
+		clocksleep(KSM_SCAN_SECS);
+		if (ksm_enabled) {
+			ksm_scan();
+		}
+	}
+}
+
+/*
+ * Start the scanner. Called once the other cpus are up.
+ */
+void
+ksm_bootstrap(void)
+{
+	int result;
+
+	ksm_stable = kmalloc(KSM_TABLE_SIZE * sizeof(*ksm_stable));
+	ksm_unstable = kmalloc(KSM_TABLE_SIZE * sizeof(*ksm_unstable));
+	if (ksm_stable == NULL || ksm_unstable == NULL) {
+		panic("ksm_bootstrap: Out of memory\n");
+	}
+	bzero(ksm_stable, KSM_TABLE_SIZE * sizeof(*ksm_stable));
+	bzero(ksm_unstable, KSM_TABLE_SIZE * sizeof(*ksm_unstable));
+
+	result = thread_fork("ksm", NULL, ksm_thread, NULL, 0);
+	if (result) {
+		panic("ksm_bootstrap: thread_fork: %s\n", strerror(result));
+	}
+}
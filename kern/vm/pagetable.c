@@ -38,6 +38,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <vmtrace.h>
 
 vaddr_t
 get_vpn(vaddr_t vaddr) {
@@ -97,6 +98,16 @@ pt_copy(struct addrspace *old, struct addrspace *newas)
 
 	struct pt_entry *old_curr = old->pt->head;
 	while(old_curr != NULL) {
+		// Shared frames are mapped, not copied
+		if(page_is_shared(old_curr->ppn)) {
+			ret = pt_add_frame(newas, old_curr->vpn, old_curr->ppn);
+			if(ret) {
+				return ret;
+			}
+			old_curr = old_curr->next_entry;
+			continue;
+		}
+
 		ret = pt_add(newas, old_curr->vpn, &new_ppn);
 		if(ret) {
 			return ret;
@@ -110,6 +121,21 @@ pt_copy(struct addrspace *old, struct addrspace *newas)
 	return 0;
 }
 
+static
+void
+pt_append(struct pagetable *pt, struct pt_entry *pte)
+{
+	if(pt->tail == NULL){
+		KASSERT(pt->head == NULL);
+		pt->head = pte;
+		pt->tail = pte;
+	} else {
+		KASSERT(pt->head != NULL);
+		pt->tail->next_entry = pte;
+		pt->tail = pte;
+	}
+}
+
 static
 int32_t
 pte_set_ppn(struct pt_entry *pte, struct addrspace *as)
@@ -127,10 +153,12 @@ pte_set_ppn(struct pt_entry *pte, struct addrspace *as)
 	if(ppn <= 0) {
 		return ENOMEM;
 	}
+	VMTRACE(VMT_FRAME_ALLOC, pte->vpn, 0);
 
 	KASSERT(ppn % PAGE_SIZE == 0);
 
 	bzero((void *)PADDR_TO_KVADDR(ppn), PAGE_SIZE);
+	VMTRACE(VMT_FRAME_ZERO, pte->vpn, 0);
 
 	pte->ppn = ppn;
 	return 0;
@@ -165,16 +193,7 @@ pt_add(struct addrspace *as, vaddr_t vaddr, paddr_t *ppn_ret)
 		}
 
 		*ppn_ret = pte->ppn;
-
-		if(pt->tail == NULL){
-			KASSERT(pt->head == NULL);
-			pt->head = pte;
-			pt->tail = pte;
-		} else {
-			KASSERT(pt->head != NULL);
-			pt->tail->next_entry = pte;
-			pt->tail = pte;
-		}
+		pt_append(pt, pte);
 
 	} else {
 		*ppn_ret = old_pte->ppn;
@@ -183,6 +202,76 @@ pt_add(struct addrspace *as, vaddr_t vaddr, paddr_t *ppn_ret)
 	return 0;
 }
 
+/*
+ * Map an existing shared frame at vaddr, taking a reference to it
+ * for the new entry.
+ */
+int32_t
+pt_add_frame(struct addrspace *as, vaddr_t vaddr, paddr_t ppn)
+{
+	if(as == NULL || as->pt == NULL){
+		return EINVAL;
+	}
+
+	KASSERT(pt_get_pte(as->pt, vaddr) == NULL);
+
+	struct pt_entry *pte = pte_create();
+	if(pte == NULL){
+		return ENOMEM;
+	}
+
+	int32_t err = page_incref(ppn);
+	if(err) {
+		kfree(pte);
+		return err;
+	}
+
+	pte->vpn = get_vpn(vaddr);
+	pte->ppn = ppn;
+	pt_append(as->pt, pte);
+
+	return 0;
+}
+
+/*
+ * Give the page at vaddr a private, writeable frame in place of the
+ * merged frame it maps. If nobody else maps the merged frame any more
+ * it is simply handed back to us. The caller holds as_lock.
+ */
+int32_t
+pt_break_cow(struct addrspace *as, vaddr_t vaddr, paddr_t *ppn_ret)
+{
+	struct pt_entry *pte = pt_get_pte(as->pt, vaddr);
+	KASSERT(pte != NULL);
+
+	paddr_t old_ppn = pte->ppn;
+	if(page_unmerge(old_ppn, as->as_pid, pte->vpn)) {
+		*ppn_ret = old_ppn;
+		return 0;
+	}
+
+	paddr_t new_ppn = alloc_upages(1, pte->vpn, as->as_pid);
+	if(new_ppn == 0) {
+		return ENOMEM;
+	}
+	VMTRACE(VMT_FRAME_ALLOC, pte->vpn, 1);
+
+	memcpy((void *)PADDR_TO_KVADDR(new_ppn), (void *)PADDR_TO_KVADDR(old_ppn), PAGE_SIZE);
+	pte->ppn = new_ppn;
+
+	/*
+	 * Other threads of ours may still map the merged frame, which
+	 * could be freed below; vm_fault only fixes up this cpu.
+	 */
+	if(as->as_tstacks != 0) {
+		as_shootdown(as, pte->vpn);
+	}
+	page_decref(old_ppn);
+
+	*ppn_ret = new_ppn;
+	return 0;
+}
+
 int32_t 
 pt_remove(struct addrspace *as, vaddr_t vaddr)
 {
@@ -277,6 +366,7 @@ pte_create(void)
 	pte->next_entry = NULL;
 	pte->vpn = 0;
 	pte->ppn = 0;
+	pte->checksum = 0;
 
 	return pte;
 }
@@ -287,8 +377,12 @@ pte_destroy(struct pt_entry *pte, pid_t owner_pid)
 	if(pte != NULL) {
 		if(pte->ppn > 0) {
 			KASSERT(pte->ppn % PAGE_SIZE == 0);	
-			uint32_t cm_index = pte->ppn / PAGE_SIZE;
-			free_page_at_index(cm_index, owner_pid, pte->vpn);
+			if(page_is_shared(pte->ppn)) {
+				page_decref(pte->ppn);
+			} else {
+				uint32_t cm_index = pte->ppn / PAGE_SIZE;
+				free_page_at_index(cm_index, owner_pid, pte->vpn);
+			}
 		}
 		tlb_null_entry(pte->vpn);
 		kfree(pte);
@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <vmtrace.h>
+
+/*
+ * This file contains the implementation of shared anonymous memory:
+ * the shm_segment struct, whose frames are shared between address
+ * spaces, and the shm_list of mappings kept by each addrspace.
+ */
+
+/*
+ *	shm_segment methods
+ */
+struct shm_segment *
+shm_segment_create(size_t npages)
+{
+	struct shm_segment *seg;
+
+	KASSERT(npages > 0);
+
+	seg = kmalloc(sizeof(*seg));
+	if(seg == NULL) {
+		return NULL;
+	}
+
+	seg->seg_frames = kmalloc(npages * sizeof(paddr_t));
+	if(seg->seg_frames == NULL) {
+		kfree(seg);
+		return NULL;
+	}
+	bzero(seg->seg_frames, npages * sizeof(paddr_t));
+
+	seg->seg_lock = lock_create("shm_segment");
+	if(seg->seg_lock == NULL) {
+		kfree(seg->seg_frames);
+		kfree(seg);
+		return NULL;
+	}
+
+	seg->seg_npages = npages;
+	seg->seg_refcount = 1;
+	return seg;
+}
+
+void
+shm_segment_incref(struct shm_segment *seg)
+{
+	lock_acquire(seg->seg_lock);
+	KASSERT(seg->seg_refcount > 0);
+	seg->seg_refcount++;
+	lock_release(seg->seg_lock);
+}
+
+void
+shm_segment_decref(struct shm_segment *seg)
+{
+	bool destroy;
+
+	lock_acquire(seg->seg_lock);
+	KASSERT(seg->seg_refcount > 0);
+	seg->seg_refcount--;
+	destroy = (seg->seg_refcount == 0);
+	lock_release(seg->seg_lock);
+
+	if(!destroy) {
+		return;
+	}
+
+	/*
+	 * Drop the segment's own reference to each frame. Frames that
+	 * are still mapped somewhere live on until those page table
+	 * entries go away.
+	 */
+	for(size_t i = 0; i < seg->seg_npages; i++) {
+		if(seg->seg_frames[i] != 0) {
+			page_decref(seg->seg_frames[i]);
+		}
+	}
+	lock_destroy(seg->seg_lock);
+	kfree(seg->seg_frames);
+	kfree(seg);
+}
+
+/*
+ * Return the frame backing page INDEX of the segment, allocating it
+ * on first use. The reference stays with the segment; callers that
+ * map the frame take their own.
+ */
+int
+shm_segment_getpage(struct shm_segment *seg, size_t index, paddr_t *ret)
+{
+	paddr_t ppn;
+
+	KASSERT(index < seg->seg_npages);
+
+	lock_acquire(seg->seg_lock);
+	ppn = seg->seg_frames[index];
+	if(ppn == 0) {
+		ppn = alloc_shared_page();
+		if(ppn == 0) {
+			lock_release(seg->seg_lock);
+			return ENOMEM;
+		}
+		VMTRACE(VMT_FRAME_ALLOC, ppn, 0);
+		seg->seg_frames[index] = ppn;
+	}
+	lock_release(seg->seg_lock);
+
+	*ret = ppn;
+	return 0;
+}
+
+/*
+ *	shm_list methods
+ */
+struct shm_list *
+shm_list_create(void)
+{
+	struct shm_list *list;
+
+	list = kmalloc(sizeof(*list));
+	if(list == NULL) {
+		return NULL;
+	}
+	list->head = NULL;
+	return list;
+}
+
+void
+shm_list_destroy(struct shm_list *list)
+{
+	struct shm_mapping *current, *next;
+
+	if(list == NULL) {
+		return;
+	}
+
+	current = list->head;
+	while(current != NULL) {
+		next = current->next;
+		shm_segment_decref(current->seg);
+		kfree(current);
+		current = next;
+	}
+	kfree(list);
+}
+
+/*
+ * Add a mapping of SEG at START. The list takes over the caller's
+ * reference to the segment.
+ */
+int
+shm_list_add(struct shm_list *list, vaddr_t start, struct shm_segment *seg)
+{
+	struct shm_mapping *map;
+
+	KASSERT(start % PAGE_SIZE == 0);
+
+	map = kmalloc(sizeof(*map));
+	if(map == NULL) {
+		return ENOMEM;
+	}
+	map->start = start;
+	map->npages = seg->seg_npages;
+	map->seg = seg;
+	map->next = list->head;
+	list->head = map;
+	return 0;
+}
+
+/*
+ * Give NEWLIST a mapping of each segment in OLD, at the same
+ * addresses. Used by fork.
+ */
+int
+shm_list_copy(struct shm_list *old, struct shm_list *newlist)
+{
+	struct shm_mapping *current;
+	int err;
+
+	for(current = old->head; current != NULL; current = current->next) {
+		shm_segment_incref(current->seg);
+		err = shm_list_add(newlist, current->start, current->seg);
+		if(err) {
+			shm_segment_decref(current->seg);
+			return err;
+		}
+	}
+	return 0;
+}
+
+struct shm_mapping *
+shm_lookup(struct shm_list *list, vaddr_t vaddr)
+{
+	struct shm_mapping *current;
+
+	if(list == NULL) {
+		return NULL;
+	}
+
+	for(current = list->head; current != NULL; current = current->next) {
+		if(vaddr >= current->start &&
+		   vaddr < current->start + current->npages * PAGE_SIZE) {
+			return current;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Unlink the mapping that starts at START and hand it back, or NULL
+ * if there isn't one. The caller drops the segment reference.
+ */
+struct shm_mapping *
+shm_list_remove(struct shm_list *list, vaddr_t start)
+{
+	struct shm_mapping *current, *prev = NULL;
+
+	for(current = list->head; current != NULL; current = current->next) {
+		if(current->start == start) {
+			if(prev == NULL) {
+				list->head = current->next;
+			} else {
+				prev->next = current->next;
+			}
+			current->next = NULL;
+			return current;
+		}
+		prev = current;
+	}
+	return NULL;
+}
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * VM tracepoints: per-cpu ring buffers and fault latency histograms.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <vmtrace.h>
+
+volatile bool vmtrace_enabled = false;
+
+static const char *const vmtrace_eventnames[VMT_NEVENTS] = {
+	"fault enter",
+	"region lookup",
+	"frame alloc",
+	"frame zero",
+	"tlb insert",
+	"fault exit",
+};
+
+static const char *const vmtrace_faultnames[VMT_NFAULTTYPES] = {
+	"read",
+	"write",
+	"readonly",
+};
+
+void
+vmtrace_cpu_init(struct vmtrace_cpu *vt)
+{
+	spinlock_init(&vt->vt_lock);
+	vt->vt_next = 0;
+	vt->vt_last = 0;
+	bzero(vt->vt_ring, sizeof(vt->vt_ring));
+	bzero(vt->vt_count, sizeof(vt->vt_count));
+	bzero(vt->vt_phase_ns, sizeof(vt->vt_phase_ns));
+	bzero(vt->vt_hist, sizeof(vt->vt_hist));
+}
+
+static
+unsigned
+vmtrace_bucket(uint64_t ns)
+{
+	unsigned b = 0;
+
+	while (ns > 1 && b < VMTRACE_NBUCKETS - 1) {
+		ns >>= 1;
+		b++;
+	}
+	return b;
+}
+
+/*
+ * Append a record to this cpu's ring. The time since the previous
+ * record is charged to EVENT, but only between fault entry and exit;
+ * frames allocated by fork and the like are counted and logged but
+ * not timed. If START is nonzero, this is a fault exit and the whole
+ * fault is added to the histogram for fault type ARG.
+ */
+static
+uint64_t
+vmtrace_log(unsigned event, vaddr_t addr, unsigned arg, uint64_t start,
+	    int faulttype)
+{
+	struct vmtrace_cpu *vt;
+	struct vmtrace_rec *rec;
+	uint64_t now;
+
+	KASSERT(event < VMT_NEVENTS);
+
+	now = clock_nsecs();
+
+	/*
+	 * If we migrate between reading curcpu and taking the lock we
+	 * log into the old cpu's ring. That's harmless.
+	 */
+	vt = &curcpu->c_vmtrace;
+	spinlock_acquire(&vt->vt_lock);
+
+	rec = &vt->vt_ring[vt->vt_next % VMTRACE_RINGSIZE];
+	rec->vr_time = now;
+	rec->vr_addr = addr;
+	rec->vr_event = event;
+	rec->vr_arg = arg;
+	vt->vt_next++;
+
+	vt->vt_count[event]++;
+	if (event == VMT_FAULT_ENTER) {
+		vt->vt_last = now;
+	}
+	else if (vt->vt_last != 0) {
+		if (now > vt->vt_last) {
+			vt->vt_phase_ns[event] += now - vt->vt_last;
+		}
+		vt->vt_last = (event == VMT_FAULT_EXIT) ? 0 : now;
+	}
+
+	if (start != 0 && faulttype >= 0 && faulttype < VMT_NFAULTTYPES) {
+		uint64_t lat = (now > start) ? now - start : 0;
+		vt->vt_hist[faulttype][vmtrace_bucket(lat)]++;
+	}
+
+	spinlock_release(&vt->vt_lock);
+	return now;
+}
+
+uint64_t
+vmtrace_record(unsigned event, vaddr_t addr, unsigned arg)
+{
+	return vmtrace_log(event, addr, arg, 0, -1);
+}
+
+void
+vmtrace_fault_done(int faulttype, vaddr_t addr, uint64_t start, int result)
+{
+	/* START is 0 if tracing was switched on in mid-fault. */
+	vmtrace_log(VMT_FAULT_EXIT, addr, result, start, faulttype);
+}
+
+////////////////////////////////////////////////////////////
+// menu interface
+
+void
+vmtrace_setenabled(bool on)
+{
+	vmtrace_enabled = on;
+}
+
+void
+vmtrace_reset(void)
+{
+	struct vmtrace_cpu *vt;
+	unsigned i;
+
+	for (i=0; i<num_cpus; i++) {
+		vt = &cpu_lookup(i)->c_vmtrace;
+		spinlock_acquire(&vt->vt_lock);
+		vt->vt_next = 0;
+		vt->vt_last = 0;
+		bzero(vt->vt_count, sizeof(vt->vt_count));
+		bzero(vt->vt_phase_ns, sizeof(vt->vt_phase_ns));
+		bzero(vt->vt_hist, sizeof(vt->vt_hist));
+		spinlock_release(&vt->vt_lock);
+	}
+}
+
+/*
+ * Print the tail end of one cpu's ring, oldest first, with each
+ * record's time relative to the one before it.
+ */
+static
+void
+vmtrace_dumpring(unsigned cpunum, const struct vmtrace_cpu *snap)
+{
+	const struct vmtrace_rec *rec;
+	unsigned n, i;
+	uint64_t prev = 0;
+
+	n = snap->vt_next < VMTRACE_RINGSIZE ? snap->vt_next : VMTRACE_RINGSIZE;
+	kprintf("cpu%u: last %u of %u records\n", cpunum, n, snap->vt_next);
+	for (i = snap->vt_next - n; i < snap->vt_next; i++) {
+		rec = &snap->vt_ring[i % VMTRACE_RINGSIZE];
+		kprintf("  %9lld ns  %-14s 0x%08x %u\n",
+			prev == 0 ? 0LL : (long long)(rec->vr_time - prev),
+			vmtrace_eventnames[rec->vr_event],
+			rec->vr_addr, rec->vr_arg);
+		prev = rec->vr_time;
+	}
+}
+
+void
+vmtrace_dump(bool showring)
+{
+	struct vmtrace_cpu *snap, *vt;
+	uint32_t count[VMT_NEVENTS];
+	uint64_t phase[VMT_NEVENTS];
+	uint32_t hist[VMT_NFAULTTYPES][VMTRACE_NBUCKETS];
+	unsigned i, j, k;
+
+	/*
+	 * Copy each cpu's state out under its lock and print from the
+	 * copy; we can't kprintf with a spinlock held.
+	 */
+	snap = kmalloc(sizeof(*snap));
+	if (snap == NULL) {
+		kprintf("vmtrace: Out of memory\n");
+		return;
+	}
+
+	bzero(count, sizeof(count));
+	bzero(phase, sizeof(phase));
+	bzero(hist, sizeof(hist));
+
+	kprintf("VM tracing is %s\n", vmtrace_enabled ? "on" : "off");
+	for (i=0; i<num_cpus; i++) {
+		vt = &cpu_lookup(i)->c_vmtrace;
+		spinlock_acquire(&vt->vt_lock);
+		memcpy(snap, vt, sizeof(*snap));
+		spinlock_release(&vt->vt_lock);
+
+		for (j=0; j<VMT_NEVENTS; j++) {
+			count[j] += snap->vt_count[j];
+			phase[j] += snap->vt_phase_ns[j];
+		}
+		for (j=0; j<VMT_NFAULTTYPES; j++) {
+			for (k=0; k<VMTRACE_NBUCKETS; k++) {
+				hist[j][k] += snap->vt_hist[j][k];
+			}
+		}
+		if (showring) {
+			vmtrace_dumpring(i, snap);
+		}
+	}
+	kfree(snap);
+
+	kprintf("%-14s %10s %14s %10s\n", "event", "count", "ns before", "avg ns");
+	for (j=0; j<VMT_NEVENTS; j++) {
+		kprintf("%-14s %10u %14llu %10llu\n", vmtrace_eventnames[j],
+			count[j], phase[j],
+			count[j] ? phase[j] / count[j] : 0ULL);
+	}
+
+	for (j=0; j<VMT_NFAULTTYPES; j++) {
+		kprintf("%s fault latency (ns):\n", vmtrace_faultnames[j]);
+		for (k=0; k<VMTRACE_NBUCKETS; k++) {
+			if (hist[j][k] == 0) {
+				continue;
+			}
+			kprintf("  %10u - %10u: %u\n",
+				k == 0 ? 0 : 1U << k,
+				(k == VMTRACE_NBUCKETS - 1) ?
+					0xffffffffU : (2U << k) - 1,
+				hist[j][k]);
+		}
+	}
+}
@@ -0,0 +1,16 @@
+---
+name: "One Hog per CPU (1 CPU)"
+description: >
+  Runs schedpong with 1 thinker and nothing else, so each cpu has a
+  single cpu-bound thread and nothing to switch to. The thinker's
+  utilization should be close to 100%, and the kernel counters before
+  and after should show next to no preempts or switches for the run.
+tags: [sched]
+depends: [not-dumbvm-vm]
+sys161:
+  cpus: 1
+  ram: 16M
+---
+counters
+p /testbin/schedpong -t 1 -g 0 -p 0 -c 1
+counters
@@ -0,0 +1,18 @@
+---
+name: "Scheduler Benchmark (1 CPU)"
+description: >
+  Runs schedpong's mixed load (cpu-bound thinkers, a memory-bound
+  grinder and two groups of semaphore pongers) on 1 cpu, and reports
+  wakeup-to-run latency percentiles, estimated handoff switches per
+  second and the thinkers' cpu utilization. The kernel counters before
+  and after give the kernel's view of the same run, including the real
+  context switch count.
+tags: [sched]
+depends: [not-dumbvm-vm]
+sys161:
+  cpus: 1
+  ram: 16M
+---
+counters
+p /testbin/schedpong -t 4 -g 1 -p 2 -s 4 -c 1
+counters
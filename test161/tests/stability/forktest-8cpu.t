@@ -0,0 +1,16 @@
+---
+name: "Fork Stability Test (8 CPUs)"
+description:
+  Runs forktest 5 times on 8 cpus, so forks, exits and waits race
+  each other through the process table.
+tags: [stability]
+depends: [shell]
+sys161:
+  cpus: 8
+  ram: 16M
+---
+$ /testbin/forktest
+$ /testbin/forktest
+$ /testbin/forktest
+$ /testbin/forktest
+$ /testbin/forktest
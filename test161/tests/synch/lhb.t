@@ -0,0 +1,13 @@
+---
+name: "Lock Handoff Benchmark"
+description:
+  Measures context switches per acquisition of a contended lock
+  with and without direct handoff on release.
+tags: [synch, locks, kleaks]
+depends: [boot, locks]
+sys161:
+  cpus: 4
+---
+khu
+lhb
+khu
@@ -0,0 +1,13 @@
+---
+name: "Lock Throughput Benchmark"
+description:
+  Measures contended lock throughput with and without adaptive
+  spinning.
+tags: [synch, locks, kleaks]
+depends: [boot, locks]
+sys161:
+  cpus: 4
+---
+khu
+lkb
+khu
@@ -0,0 +1,14 @@
+---
+name: "Lock Test 6"
+description:
+  Priority inversion. A high-priority thread waits for a lock held by
+  a low-priority thread while a middle-priority thread hogs the cpu;
+  it should get the lock about as soon as the low thread is done.
+tags: [synch, locks, kleaks]
+depends: [boot, semaphores]
+sys161:
+  cpus: 1
+---
+khu
+lt6
+khu
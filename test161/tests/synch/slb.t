@@ -0,0 +1,13 @@
+---
+name: "Spinlock Contention Benchmark"
+description:
+  Measures throughput and fairness of basic and queued spinlocks
+  under contention.
+tags: [synch, locks, kleaks]
+depends: [boot, locks]
+sys161:
+  cpus: 4
+---
+khu
+slb
+khu
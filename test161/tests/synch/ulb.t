@@ -0,0 +1,13 @@
+---
+name: "Uncontended Lock Benchmark"
+description:
+  Measures lock acquire/release and semaphore P/V round trips per
+  second when nobody else wants them.
+tags: [synch, locks, kleaks]
+depends: [boot, locks]
+sys161:
+  cpus: 1
+---
+khu
+ulb
+khu
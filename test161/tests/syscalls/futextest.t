@@ -0,0 +1,12 @@
+---
+name: "Futex Test"
+description: >
+  Test futex argument checking, and wait/wake between two processes
+  through a shared mapping.
+tags: [syscalls]
+depends: [not-dumbvm-vm]
+sys161:
+  cpus: 2
+  ram: 4M
+---
+p /testbin/futextest
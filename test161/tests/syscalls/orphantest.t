@@ -0,0 +1,13 @@
+---
+name: "Orphan Test"
+description: >
+  Test that children nobody waits for, whether their parent exits
+  before or after them, are cleaned up without leaking kernel memory.
+  Runs /testbin/orphantest twice from the kernel and fails if the
+  kernel heap grew over the second run.
+tags: [procsyscalls,syscalls]
+depends: [console, /syscalls/forktest.t]
+sys161:
+  ram: 8M
+---
+orpht
@@ -0,0 +1,11 @@
+---
+name: "Priority Test"
+description: >
+  Test that getpriority and setpriority work and that fork inherits
+  the priority.
+tags: [procsyscalls,syscalls]
+depends: [console]
+sys161:
+  ram: 4M
+---
+p /testbin/prioritytest
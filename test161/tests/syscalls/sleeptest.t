@@ -0,0 +1,11 @@
+---
+name: "Sleep Test"
+description: >
+  Test that nanosleep sleeps for the requested time with tick
+  resolution.
+tags: [syscalls]
+depends: [console]
+sys161:
+  ram: 4M
+---
+p /testbin/sleeptest
@@ -0,0 +1,13 @@
+---
+name: "User Thread Test"
+description: >
+  Runs threads in one user process over a shared array, checks
+  thread_join's errors, and checks _exit from any thread takes the
+  whole process down with the right status.
+tags: [syscalls]
+depends: [not-dumbvm-vm]
+sys161:
+  cpus: 4
+  ram: 4M
+---
+p /testbin/uthreadtest
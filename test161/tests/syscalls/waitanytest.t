@@ -0,0 +1,11 @@
+---
+name: "Wait Any Test"
+description: >
+  Test that waitpid can reap any child, with and without WNOHANG, and
+  that wait4 works.
+tags: [procsyscalls,syscalls]
+depends: [console]
+sys161:
+  ram: 4M
+---
+p /testbin/waitanytest
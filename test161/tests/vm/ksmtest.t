@@ -0,0 +1,13 @@
+---
+name: "Same-Page Merging"
+description: >
+  Test that same-page merging merges identical pages in two processes,
+  and that writing a merged page gives the writer a private copy.
+  Runs /testbin/ksmtest from the kernel with the scanner on and fails
+  if the pages weren't merged or either process saw the other's write.
+tags: [vm]
+depends: [not-dumbvm-vm, /syscalls/forktest.t]
+sys161:
+  ram: 8M
+---
+ksmt
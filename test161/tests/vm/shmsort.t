@@ -0,0 +1,11 @@
+---
+name: "Shared Memory Sort"
+description: >
+  Sorts an array in parallel using shared anonymous memory that is
+  inherited across fork.
+tags: [vm]
+depends: [not-dumbvm-vm]
+sys161:
+  ram: 2M
+---
+| p /testbin/shmsort
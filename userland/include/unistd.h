@@ -39,10 +39,13 @@
  * about the kern/ headers.
  */
 #include <kern/fcntl.h>
+#include <kern/futex.h>
 #include <kern/ioctl.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -147,7 +150,21 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 ssize_t __getcwd(char *buf, size_t buflen);
+/* Only MAP_SHARED|MAP_ANON with fd -1 is supported. */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+/* Only PRIO_PROCESS is supported. */
+int getpriority(int which, pid_t who);
+int setpriority(int which, pid_t who, int prio);
+/* The usage returned is all zeros; only WNOHANG is supported. */
+pid_t wait4(pid_t pid, int *returncode, int flags, struct rusage *ru);
+int futex(int *addr, int op, int val);
+int __thread_create(void (*start)(void (*)(void *), void *),
+		    void (*func)(void *), void *arg);
+__DEAD void thread_exit(void);
+int thread_join(int tid);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -158,5 +175,6 @@ ssize_t __getcwd(char *buf, size_t buflen);
 int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
+int thread_create(void (*func)(void *), void *arg); /* calls __thread_create */
 
 #endif /* _UNISTD_H_ */
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * futextest.c
+ *
+ * Checks futex() argument handling, then has a parent and child
+ * hand a turn back and forth through a futex in a shared mapping.
+ * Each handoff needs a FUTEX_WAKE to find a waiter in the other
+ * process, so a broken shared key hangs the test.
+ *
+ * Needs mmap(MAP_SHARED|MAP_ANON) that survives fork().
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define ROUNDS	1000
+
+static
+void
+check_args(void)
+{
+	int word = 5;
+
+	if (futex(&word, FUTEX_WAIT, 4) != -1 || errno != EAGAIN) {
+		errx(1, "FUTEX_WAIT on a changed value didn't fail with EAGAIN");
+	}
+	if (futex((int *)((char *)&word + 1), FUTEX_WAIT, 5) != -1 ||
+	    errno != EINVAL) {
+		errx(1, "futex accepted a misaligned address");
+	}
+	if (futex(&word, 42, 0) != -1 || errno != EINVAL) {
+		errx(1, "futex accepted a bad operation");
+	}
+	if (futex(NULL, FUTEX_WAIT, 0) != -1 || errno != EFAULT) {
+		errx(1, "FUTEX_WAIT on NULL didn't fail with EFAULT");
+	}
+	if (futex(&word, FUTEX_WAKE, 1) != 0) {
+		errx(1, "FUTEX_WAKE with no waiters woke something");
+	}
+}
+
+/*
+ * Wait until *turn is no longer VAL.
+ */
+static
+void
+await(volatile int *turn, int val)
+{
+	while (*turn == val) {
+		if (futex((int *)turn, FUTEX_WAIT, val) == -1 &&
+		    errno != EAGAIN) {
+			err(1, "FUTEX_WAIT");
+		}
+	}
+}
+
+static
+void
+pass(volatile int *turn, int val)
+{
+	*turn = val;
+	if (futex((int *)turn, FUTEX_WAKE, 1) == -1) {
+		err(1, "FUTEX_WAKE");
+	}
+}
+
+int
+main(void)
+{
+	volatile int *turn;
+	pid_t pid;
+	int i, status;
+
+	check_args();
+
+	turn = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANON, -1, 0);
+	if (turn == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	*turn = 0;
+
+	/* 0 means it's the parent's turn, 1 the child's. */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i = 0; i < ROUNDS; i++) {
+			await(turn, 0);
+			pass(turn, 0);
+		}
+		_exit(0);
+	}
+
+	for (i = 0; i < ROUNDS; i++) {
+		pass(turn, 1);
+		await(turn, 1);
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+	printf("futextest: %d handoffs\n", 2 * ROUNDS);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/futextest");
+	return 0;
+}
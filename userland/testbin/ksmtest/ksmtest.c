@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * ksmtest.c
+ *
+ * Fills some pages with the same contents in a parent and a child,
+ * then sleeps long enough for the same-page merging scanner to merge
+ * them. Then the child overwrites its copies, and both sides check
+ * they see only their own writes. The kernel's ksmt test turns the
+ * scanner on, runs this, and checks the pages were merged.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+
+#define PAGE_SIZE	4096
+#define NPAGES		8	/* the kernel test expects this many merges */
+#define WAIT_SECS	6	/* scanner passes are a second apart */
+
+#define WORDS		(PAGE_SIZE / sizeof(uint32_t))
+
+/* One extra page so the start can be rounded up to a page boundary. */
+static uint32_t buf[(NPAGES + 1) * WORDS];
+static uint32_t *pages;
+
+/*
+ * The pattern for word J of page I. Each page is different, so the
+ * pages only merge with their twins in the other process.
+ */
+static
+uint32_t
+pattern(unsigned i, unsigned j, uint32_t salt)
+{
+	return salt ^ (i << 24) ^ (j * 2654435761U);
+}
+
+static
+void
+fill(uint32_t salt)
+{
+	unsigned i, j;
+
+	for (i=0; i<NPAGES; i++) {
+		for (j=0; j<WORDS; j++) {
+			pages[i * WORDS + j] = pattern(i, j, salt);
+		}
+	}
+}
+
+/*
+ * Returns nonzero if any word isn't what fill(SALT) wrote.
+ */
+static
+int
+check(uint32_t salt, const char *who)
+{
+	unsigned i, j;
+
+	for (i=0; i<NPAGES; i++) {
+		for (j=0; j<WORDS; j++) {
+			if (pages[i * WORDS + j] != pattern(i, j, salt)) {
+				printf("ksmtest: %s: page %u word %u is "
+				       "0x%x, expected 0x%x\n", who, i, j,
+				       pages[i * WORDS + j],
+				       pattern(i, j, salt));
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static
+void
+wait_for_scanner(void)
+{
+	struct timespec req, rem;
+
+	req.tv_sec = WAIT_SECS;
+	req.tv_nsec = 0;
+	if (nanosleep(&req, &rem)) {
+		err(1, "nanosleep");
+	}
+}
+
+int
+main(void)
+{
+	pid_t pid;
+	int status;
+
+	pages = (uint32_t *)(((uintptr_t)buf + PAGE_SIZE - 1) &
+			     ~(uintptr_t)(PAGE_SIZE - 1));
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+
+	/*
+	 * Both sides write their own pages after the fork, so neither
+	 * is sharing a frame with the other until the scanner merges
+	 * them.
+	 */
+	fill(0x6b736d00);
+	wait_for_scanner();
+
+	if (pid == 0) {
+		/* This write has to break the sharing. */
+		fill(0x11111111);
+		_exit(check(0x11111111, "child"));
+	}
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+
+	/* The child's write must not have shown through here. */
+	if (check(0x6b736d00, "parent")) {
+		return 1;
+	}
+
+	/* And a write here keeps working with the child gone. */
+	fill(0x22222222);
+	if (check(0x22222222, "parent")) {
+		return 1;
+	}
+
+	printf("ksmtest: done\n");
+	return 0;
+}
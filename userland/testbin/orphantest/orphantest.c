@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * orphantest.c
+ *
+ * Forks thousands of children that nobody waits for. Each of a series
+ * of middle processes forks a batch of children and exits without
+ * waiting, so by the time it exits some of the children are zombies
+ * and some are still running; the kernel has to clean up both. The
+ * kernel's orpht test runs this and checks nothing was left behind.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NMIDDLE	100
+#define NBATCH	20
+
+/*
+ * Fork a batch of children that exit right away, and don't wait for
+ * them. Returns nonzero if a fork failed.
+ */
+static
+int
+batch(void)
+{
+	pid_t pid;
+	int i;
+
+	for (i=0; i<NBATCH; i++) {
+		pid = fork();
+		if (pid < 0) {
+			warn("fork");
+			return 1;
+		}
+		if (pid == 0) {
+			_exit(0);
+		}
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	pid_t pid;
+	int i, status;
+
+	for (i=0; i<NMIDDLE; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			_exit(batch());
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "middle process %d failed", i);
+		}
+		nprintf(".");
+	}
+	nprintf("\n");
+
+	/* The last batch is ours; they get reaped when we exit. */
+	if (batch()) {
+		errx(1, "last batch failed");
+	}
+
+	return 0;
+}
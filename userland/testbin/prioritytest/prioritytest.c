@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * prioritytest.c
+ *
+ * Checks getpriority/setpriority: the default value, setting and
+ * clamping, inheritance across fork, and the error cases, including
+ * a child trying to renice its parent.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+static
+void
+expect(int want)
+{
+	int prio;
+
+	prio = getpriority(PRIO_PROCESS, 0);
+	if (prio != want) {
+		errx(1, "getpriority returned %d, expected %d", prio, want);
+	}
+}
+
+static
+void
+expect_error(int result, int want, const char *what)
+{
+	if (result != -1) {
+		errx(1, "%s succeeded", what);
+	}
+	if (errno != want) {
+		err(1, "%s: wrong error", what);
+	}
+}
+
+int
+main(void)
+{
+	pid_t pid, parent;
+	int status;
+
+	expect(0);
+
+	if (setpriority(PRIO_PROCESS, 0, 10)) {
+		err(1, "setpriority");
+	}
+	expect(10);
+	if (getpriority(PRIO_PROCESS, getpid()) != 10) {
+		errx(1, "getpriority by pid disagrees");
+	}
+
+	/* Out of range values are clamped */
+	if (setpriority(PRIO_PROCESS, 0, PRIO_MAX + 100)) {
+		err(1, "setpriority");
+	}
+	expect(PRIO_MAX);
+	if (setpriority(PRIO_PROCESS, 0, PRIO_MIN - 100)) {
+		err(1, "setpriority");
+	}
+	expect(PRIO_MIN);
+
+	/* Children inherit the value, but can't change the parent's */
+	if (setpriority(PRIO_PROCESS, 0, 5)) {
+		err(1, "setpriority");
+	}
+	parent = getpid();
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		expect(5);
+		expect_error(setpriority(PRIO_PROCESS, parent, 0), EPERM,
+			     "setpriority of the parent");
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+
+	expect_error(setpriority(PRIO_USER, 0, 0), EINVAL,
+		     "setpriority(PRIO_USER)");
+	expect_error(getpriority(PRIO_PGRP, 0), EINVAL,
+		     "getpriority(PRIO_PGRP)");
+	expect_error(setpriority(PRIO_PROCESS, -5, 0), ESRCH,
+		     "setpriority of a bad pid");
+	expect_error(getpriority(PRIO_PROCESS, pid), ESRCH,
+		     "getpriority of a reaped child");
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/prioritytest");
+	return 0;
+}
@@ -36,10 +36,12 @@
 #include <string.h>
 #include <unistd.h>
 #include <err.h>
+#include <test161/test161.h>
 
 #include "usem.h"
 #include "tasks.h"
 #include "results.h"
+#include "stats.h"
 
 #define STARTSEM "sem:start"
 
@@ -182,10 +184,11 @@ waitall(pid_t *pids, unsigned numpids)
 }
 
 /*
- * Fetch, compute, and print the timing for one task group.
+ * Fetch, compute, and print the timing for one task group. Returns
+ * it in nanoseconds too.
  */
 static
-void
+uint64_t
 calcresult(unsigned groupid, time_t startsecs, unsigned long startnsecs,
 	   char *buf, size_t bufmax)
 {
@@ -202,6 +205,7 @@ calcresult(unsigned groupid, time_t startsecs, unsigned long startnsecs,
 	nsecs -= startnsecs;
 	secs -= startsecs;
 	snprintf(buf, bufmax, "%lld.%09lu", (long long)secs, nsecs);
+	return (uint64_t)secs * 1000000000ULL + nsecs;
 }
 
 /*
@@ -221,32 +225,38 @@ waitstart(void)
 static
 void
 runit(unsigned numthinkers, unsigned numgrinders,
-      unsigned numponggroups, unsigned ponggroupsize)
+      unsigned numponggroups, unsigned ponggroupsize, unsigned numcpus)
 {
-	pid_t pids[numponggroups + 2];
+	pid_t pids[numponggroups + FIRSTPONGGROUP];
 	time_t startsecs;
 	unsigned long startnsecs;
 	char buf[32];
 	unsigned i;
+	uint64_t thinkns = 0, pongns = 0, ns;
 
 	tprintf("Running with %u thinkers, %u grinders, and %u pong groups "
-	       "of size %u each.\n", numthinkers, numgrinders, numponggroups,
-	       ponggroupsize);
+	       "of size %u each on %u cpus.\n", numthinkers, numgrinders,
+	       numponggroups, ponggroupsize, numcpus);
+
+	if (numthinkers > MAXTHINKERS) {
+		errx(1, "Too many thinkers (max %u)", MAXTHINKERS);
+	}
+	stats_setup(numponggroups * ponggroupsize);
 
 	usem_init(&startsem, STARTSEM);
 	createresultsfile();
-	forkem(numthinkers, nop, think, nop, 0, &pids[0]);
-	forkem(numgrinders, nop, grind, nop, 1, &pids[1]);
+	forkem(numthinkers, nop, think, nop, THINKGROUP, &pids[THINKGROUP]);
+	forkem(numgrinders, nop, grind, nop, GRINDGROUP, &pids[GRINDGROUP]);
 	for (i=0; i<numponggroups; i++) {
-		forkem(ponggroupsize, pong_prep, pong, pong_cleanup, i+2,
-		       &pids[i+2]);
+		forkem(ponggroupsize, pong_prep, pong, pong_cleanup,
+		       i+FIRSTPONGGROUP, &pids[i+FIRSTPONGGROUP]);
 	}
 	usem_open(&startsem);
 	tprintf("Forking done; starting the workload.\n");
 	__time(&startsecs, &startnsecs);
 	Vn(&startsem, numthinkers + numgrinders +
 	   numponggroups * ponggroupsize);
-	waitall(pids, numponggroups + 2);
+	waitall(pids, numponggroups + FIRSTPONGGROUP);
 	usem_close(&startsem);
 	usem_cleanup(&startsem);
 
@@ -254,22 +264,29 @@ runit(unsigned numthinkers, unsigned numgrinders,
 
 	tprintf("--- Timings ---\n");
 	if (numthinkers > 0) {
-		calcresult(0, startsecs, startnsecs, buf, sizeof(buf));
+		thinkns = calcresult(THINKGROUP, startsecs, startnsecs,
+				     buf, sizeof(buf));
 		tprintf("Thinkers: %s\n", buf);
 	}
 
 	if (numgrinders > 0) {
-		calcresult(1, startsecs, startnsecs, buf, sizeof(buf));
+		calcresult(GRINDGROUP, startsecs, startnsecs, buf, sizeof(buf));
 		tprintf("Grinders: %s\n", buf);
 	}
 
 	for (i=0; i<numponggroups; i++) {
-		calcresult(i+2, startsecs, startnsecs, buf, sizeof(buf));
+		ns = calcresult(i+FIRSTPONGGROUP, startsecs, startnsecs,
+				buf, sizeof(buf));
 		tprintf("Pong group %u: %s\n", i, buf);
+		if (ns > pongns) {
+			pongns = ns;
+		}
 	}
 
 	closeresultsfile();
 	destroyresultsfile();
+
+	stats_print(numcpus, numthinkers, thinkns, pongns);
 }
 
 static
@@ -281,6 +298,8 @@ usage(const char *av0)
 	warnx("  [-g grinders]         set number of grinders (default 0)");
 	warnx("  [-p ponggroups]       set number of pong groups (default 1)");
 	warnx("  [-s ponggroupsize]    set pong group size (default 6)");
+	warnx("  [-c cpus]             cpus to figure utilization over "
+	      "(default 1)");
 	warnx("Thinkers are CPU bound; grinders are memory-bound;");
 	warnx("pong groups are I/O bound.");
 	exit(1);
@@ -293,6 +312,7 @@ main(int argc, char *argv[])
 	unsigned numgrinders = 0;
 	unsigned numponggroups = 1;
 	unsigned ponggroupsize = 6;
+	unsigned numcpus = 1;
 
 	int i;
 
@@ -309,11 +329,21 @@ main(int argc, char *argv[])
 		else if (!strcmp(argv[i], "-s")) {
 			ponggroupsize = atoi(argv[++i]);
 		}
+		else if (!strcmp(argv[i], "-c")) {
+			numcpus = atoi(argv[++i]);
+		}
 		else {
 			usage(argv[0]);
 		}
 	}
 
-	runit(numthinkers, numgrinders, numponggroups, ponggroupsize);
+	if (numcpus == 0) {
+		usage(argv[0]);
+	}
+
+	runit(numthinkers, numgrinders, numponggroups, ponggroupsize,
+	      numcpus);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/schedpong");
 	return 0;
 }
@@ -32,12 +32,14 @@
  * Semaphore pong.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <err.h>
 #include <assert.h>
 
 #include "usem.h"
 #include "tasks.h"
+#include "stats.h"
 
 #define MAXCOUNT 64
 #define PONGLOOPS 1000
@@ -45,6 +47,7 @@
 
 static struct usem sems[MAXCOUNT];
 static unsigned nsems;
+static unsigned firstslot;	/* our sems[0]'s slot in the stats */
 
 /*
  * Set up the semaphores. This happens in the task director process,
@@ -67,6 +70,7 @@ pong_prep(unsigned groupid, unsigned count)
 		usem_init(&sems[i], "sem:pong-%u-%u", groupid, i);
 	}
 	nsems = count;
+	firstslot = (groupid - FIRSTPONGGROUP) * count;
 }
 
 void
@@ -82,6 +86,29 @@ pong_cleanup(unsigned groupid, unsigned count)
 	}
 }
 
+/*
+ * Wait for our turn, and record how long it took to get going once
+ * we were woken.
+ */
+static
+void
+pong_wait(unsigned id)
+{
+	P(&sems[id]);
+	stats_woke(firstslot + id);
+}
+
+/*
+ * Hand the turn to ID.
+ */
+static
+void
+pong_pass(unsigned id)
+{
+	stats_wake(firstslot + id);
+	V(&sems[id]);
+}
+
 /*
  * Pong in order. Wait on our semaphore, then wake the next one.
  * If we're id 0, don't wait the first go so things start, but do
@@ -97,7 +124,7 @@ pong_cyclic(unsigned id)
 	nextid = (id + 1) % nsems;
 	for (i=0; i<PONGLOOPS; i++) {
 		if (i > 0 || id > 0) {
-			P(&sems[id]);
+			pong_wait(id);
 		}
 #ifdef VERBOSE_PONG
 		tprintf(" %u", id);
@@ -106,10 +133,10 @@ pong_cyclic(unsigned id)
 			putchar('.');
 		}
 #endif
-		V(&sems[nextid]);
+		pong_pass(nextid);
 	}
 	if (id == 0) {
-		P(&sems[id]);
+		pong_wait(id);
 	}
 #ifdef VERBOSE_PONG
 	putchar('\n');
@@ -148,7 +175,7 @@ pong_reciprocating(unsigned id)
 
 	for (i=0; i<n; i++) {
 		if (i > 0 || id > 0) {
-			P(&sems[id]);
+			pong_wait(id);
 		}
 #ifdef VERBOSE_PONG
 		tprintf(" %u", id);
@@ -158,16 +185,16 @@ pong_reciprocating(unsigned id)
 		}
 #endif
 		if (gofwd) {
-			V(&sems[nextfwd]);
+			pong_pass(nextfwd);
 			gofwd = 0;
 		}
 		else {
-			V(&sems[nextback]);
+			pong_pass(nextback);
 			gofwd = 1;
 		}
 	}
 	if (id == 0) {
-		P(&sems[id]);
+		pong_wait(id);
 	}
 #ifdef VERBOSE_PONG
 	putchar('\n');
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2015
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark statistics.
+ *
+ * Wakeup-to-run latency: a ponger notes the time just before it V's
+ * the next one's semaphore, and the next one takes the difference
+ * when its P returns. That covers the whole trip through the kernel:
+ * the V, the wakeup, waiting on a run queue, and getting back out to
+ * user mode. Each ponger keeps its own histogram, so there's nothing
+ * to lock; they're merged at the end.
+ *
+ * The histogram buckets are log-linear: four per power of two of
+ * microseconds, so a percentile read off it is within 25% or so.
+ *
+ * CPU utilization: thinkers do a fixed amount of pure computation.
+ * Timing a slice of the same loop alone once the run is over tells
+ * us how much cpu time that is; the thinkers' cpu time over the cpu
+ * time available while they ran is how well the scheduler kept the
+ * cpus busy with them.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "tasks.h"
+#include "stats.h"
+
+#define LAT_SUBBITS	2
+#define LAT_SUB		(1 << LAT_SUBBITS)
+#define LAT_NBUCKETS	(LAT_SUB * 25)	/* up to 2^25 us, about 30s */
+
+#define CALIBRATE_DIV	16		/* time 1/16 of a thinker alone */
+
+struct stats {
+	unsigned st_numpongers;
+	volatile uint64_t st_vtime[MAXPONGERS];	/* when last V'd */
+	unsigned st_wakeups[MAXPONGERS];
+	uint64_t st_maxlat[MAXPONGERS];
+	unsigned st_hist[MAXPONGERS][LAT_NBUCKETS];
+	uint64_t st_thinkns[MAXTHINKERS];
+};
+
+static struct stats *stats;
+
+/*
+ * Set up the shared area. Call before forking anything.
+ */
+void
+stats_setup(unsigned numpongers)
+{
+	if (numpongers > MAXPONGERS) {
+		errx(1, "Too many pongers (max %u)", MAXPONGERS);
+	}
+
+	stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANON, -1, 0);
+	if (stats == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	memset(stats, 0, sizeof(*stats));
+	stats->st_numpongers = numpongers;
+}
+
+uint64_t
+stats_now(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (uint64_t)secs * 1000000000ULL + nsecs;
+}
+
+////////////////////////////////////////////////////////////
+// latency
+
+static
+unsigned
+lat_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	unsigned bucket, lg;
+
+	if (us < LAT_SUB) {
+		return us;
+	}
+	for (lg = LAT_SUBBITS; (us >> (lg + 1)) != 0; lg++) {
+		/* nothing */
+	}
+	bucket = LAT_SUB * (lg - LAT_SUBBITS + 1) +
+		((us >> (lg - LAT_SUBBITS)) & (LAT_SUB - 1));
+	if (bucket >= LAT_NBUCKETS) {
+		bucket = LAT_NBUCKETS - 1;
+	}
+	return bucket;
+}
+
+/*
+ * The smallest latency in microseconds that lands in BUCKET.
+ */
+static
+uint64_t
+lat_bucketbase(unsigned bucket)
+{
+	unsigned lg;
+
+	if (bucket < LAT_SUB) {
+		return bucket;
+	}
+	lg = bucket / LAT_SUB + LAT_SUBBITS - 1;
+	return (uint64_t)(LAT_SUB + bucket % LAT_SUB) << (lg - LAT_SUBBITS);
+}
+
+/*
+ * About to wake the ponger in SLOT.
+ */
+void
+stats_wake(unsigned slot)
+{
+	stats->st_vtime[slot] = stats_now();
+}
+
+/*
+ * The ponger in SLOT is running again after being woken.
+ */
+void
+stats_woke(unsigned slot)
+{
+	uint64_t lat;
+
+	lat = stats_now() - stats->st_vtime[slot];
+	stats->st_hist[slot][lat_bucket(lat)]++;
+	stats->st_wakeups[slot]++;
+	if (lat > stats->st_maxlat[slot]) {
+		stats->st_maxlat[slot] = lat;
+	}
+}
+
+/*
+ * The upper end of the bucket the Pth percentile of HIST falls in,
+ * in microseconds.
+ */
+static
+uint64_t
+lat_percentile(const unsigned *hist, unsigned total, unsigned p)
+{
+	unsigned want, seen, i;
+
+	want = (total * (uint64_t)p + 99) / 100;
+	seen = 0;
+	for (i=0; i<LAT_NBUCKETS - 1; i++) {
+		seen += hist[i];
+		if (seen >= want) {
+			return lat_bucketbase(i + 1) - 1;
+		}
+	}
+	return lat_bucketbase(LAT_NBUCKETS - 1);
+}
+
+////////////////////////////////////////////////////////////
+// utilization
+
+void
+stats_thought(unsigned id, uint64_t ns)
+{
+	stats->st_thinkns[id] = ns;
+}
+
+/*
+ * How long a whole thinker takes with a cpu to itself, estimated
+ * from a slice of one. Run this with nothing else going on.
+ */
+uint64_t
+stats_calibrate(void)
+{
+	uint64_t start;
+
+	start = stats_now();
+	think_loop(THINKLOOPS / CALIBRATE_DIV);
+	return (stats_now() - start) * CALIBRATE_DIV;
+}
+
+////////////////////////////////////////////////////////////
+// report
+
+/*
+ * THINKNS is how long the thinkers took from the start of the
+ * workload, and PONGNS the same for the slowest pong group.
+ */
+void
+stats_print(unsigned numcpus, unsigned numthinkers, uint64_t thinkns,
+	    uint64_t pongns)
+{
+	static unsigned hist[LAT_NBUCKETS];
+	unsigned total, i, j;
+	uint64_t maxlat, ideal;
+
+	total = 0;
+	maxlat = 0;
+	for (i=0; i<stats->st_numpongers; i++) {
+		for (j=0; j<LAT_NBUCKETS; j++) {
+			hist[j] += stats->st_hist[i][j];
+		}
+		total += stats->st_wakeups[i];
+		if (stats->st_maxlat[i] > maxlat) {
+			maxlat = stats->st_maxlat[i];
+		}
+	}
+
+	tprintf("--- Scheduler ---\n");
+	if (total > 0) {
+		tprintf("Wakeup latency (us): p50 %llu, p99 %llu, max %llu "
+			"over %u wakeups\n",
+			(unsigned long long)lat_percentile(hist, total, 50),
+			(unsigned long long)lat_percentile(hist, total, 99),
+			(unsigned long long)(maxlat / 1000), total);
+	}
+	if (total > 0 && pongns > 0) {
+		/*
+		 * Each handoff is at least one block and one wakeup, so
+		 * this is an estimate from our side only; the kernel's
+		 * switch counter has the real figure.
+		 */
+		tprintf("Estimated handoff switches/sec: %llu\n",
+			(unsigned long long)(2ULL * total * 1000000000ULL /
+					     pongns));
+	}
+	if (numthinkers > 0 && thinkns > 0) {
+		ideal = stats_calibrate();
+		tprintf("Thinker cpu utilization: %llu%% of %u cpus "
+			"(alone: %llu ms each, all done in %llu ms)\n",
+			(unsigned long long)(ideal * numthinkers * 100 /
+					     (thinkns * numcpus)),
+			numcpus, (unsigned long long)(ideal / 1000000),
+			(unsigned long long)(thinkns / 1000000));
+		for (i=0; i<numthinkers; i++) {
+			tprintf("  thinker %u: %llu ms\n", i,
+				(unsigned long long)
+				(stats->st_thinkns[i] / 1000000));
+		}
+	}
+}
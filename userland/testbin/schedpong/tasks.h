@@ -28,8 +28,17 @@
  * SUCH DAMAGE.
  */
 
+/* Group ids: thinkers, grinders, then the pong groups. */
+#define THINKGROUP	0
+#define GRINDGROUP	1
+#define FIRSTPONGGROUP	2
+
+#define MAXTHINKERS	64
+#define THINKLOOPS	35000000
+
 void waitstart(void);
 
+void think_loop(unsigned loops);
 void think(unsigned groupid, unsigned id);
 void grind(unsigned groupid, unsigned id);
 
@@ -28,7 +28,26 @@
  * SUCH DAMAGE.
  */
 
+#include <stdint.h>
+
 #include "tasks.h"
+#include "stats.h"
+
+/*
+ * The computation. Also used to calibrate the utilization figure.
+ */
+void
+think_loop(unsigned loops)
+{
+	volatile unsigned long k, m;
+	volatile unsigned i;
+
+	k = 15;
+	m = 7;
+	for (i=0; i<loops; i++) {
+		k += k*m;
+	}
+}
 
 /*
  * think - cpu-bound task
@@ -38,18 +57,13 @@
 void
 think(unsigned groupid, unsigned id)
 {
-	volatile unsigned long k, m;
-	volatile unsigned i;
+	uint64_t start;
 
 	(void)groupid;
-	(void)id;
 
 	waitstart();
 
-	k = 15;
-	m = 7;
-#define LOOPCOUNT 35000000
-	for (i=0; i<LOOPCOUNT; i++) {
-		k += k*m;
-	}
+	start = stats_now();
+	think_loop(THINKLOOPS);
+	stats_thought(id, stats_now() - start);
 }
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * shmsort.c
+ *
+ * Parallel sort through shared memory. The parent fills a shared
+ * anonymous mapping with random keys and forks NPROCS children; each
+ * child sorts its own slice in place. The parent then merges the
+ * slices into a second shared buffer and checks the result. No data
+ * goes through the filesystem.
+ *
+ * Needs mmap(MAP_SHARED|MAP_ANON) that survives fork().
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NPROCS		4
+#define NKEYS		(32*1024)
+#define SLICE		(NKEYS / NPROCS)
+
+static
+int
+cmp_int(const void *a, const void *b)
+{
+	int x = *(const int *)a;
+	int y = *(const int *)b;
+
+	return (x > y) - (x < y);
+}
+
+static
+void
+sort_slice(int *keys, int slice)
+{
+	qsort(keys + slice * SLICE, SLICE, sizeof(int), cmp_int);
+	_exit(0);
+}
+
+/*
+ * NPROCS-way merge of the sorted slices of SRC into DST.
+ */
+static
+void
+merge(const int *src, int *dst)
+{
+	int pos[NPROCS];
+	int i, j, best;
+
+	for (j = 0; j < NPROCS; j++) {
+		pos[j] = 0;
+	}
+
+	for (i = 0; i < NKEYS; i++) {
+		best = -1;
+		for (j = 0; j < NPROCS; j++) {
+			if (pos[j] == SLICE) {
+				continue;
+			}
+			if (best < 0 || src[j*SLICE + pos[j]] <
+			    src[best*SLICE + pos[best]]) {
+				best = j;
+			}
+		}
+		dst[i] = src[best*SLICE + pos[best]];
+		pos[best]++;
+	}
+}
+
+int
+main(void)
+{
+	int *keys, *sorted;
+	pid_t pids[NPROCS];
+	int i, status;
+	unsigned long sum = 0, check = 0;
+
+	keys = mmap(NULL, NKEYS * sizeof(int), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANON, -1, 0);
+	if (keys == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	sorted = mmap(NULL, NKEYS * sizeof(int), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANON, -1, 0);
+	if (sorted == MAP_FAILED) {
+		err(1, "mmap");
+	}
+
+	srandom(1661);
+	for (i = 0; i < NKEYS; i++) {
+		keys[i] = random();
+		sum += keys[i];
+	}
+
+	for (i = 0; i < NPROCS; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			sort_slice(keys, i);
+		}
+	}
+
+	for (i = 0; i < NPROCS; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+			errx(1, "child %d failed", i);
+		}
+	}
+
+	/* The children's work must be visible here. */
+	for (i = 0; i < NKEYS; i++) {
+		if (i % SLICE != 0 && keys[i-1] > keys[i]) {
+			errx(1, "slice %d not sorted at %d", i / SLICE, i);
+		}
+	}
+
+	merge(keys, sorted);
+	for (i = 0; i < NKEYS; i++) {
+		if (i > 0 && sorted[i-1] > sorted[i]) {
+			errx(1, "output not sorted at %d", i);
+		}
+		check += sorted[i];
+	}
+	if (check != sum) {
+		errx(1, "keys lost in merge");
+	}
+
+	if (munmap(keys, NKEYS * sizeof(int)) ||
+	    munmap(sorted, NKEYS * sizeof(int))) {
+		err(1, "munmap");
+	}
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/shmsort");
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * sleeptest.c
+ *
+ * Checks that nanosleep sleeps at least as long as asked, with tick
+ * (not second) resolution, and rejects bad arguments.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+/* Slack allowed on top of the requested time, in ns. */
+#define SLACK	200000000
+
+static
+long long
+now_ns(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	if (__time(&secs, &nsecs)) {
+		err(1, "__time");
+	}
+	return (long long)secs * 1000000000LL + nsecs;
+}
+
+static
+void
+try_sleep(long msecs)
+{
+	struct timespec req, rem;
+	long long start, elapsed;
+
+	req.tv_sec = msecs / 1000;
+	req.tv_nsec = (msecs % 1000) * 1000000;
+
+	start = now_ns();
+	if (nanosleep(&req, &rem)) {
+		err(1, "nanosleep %ld ms", msecs);
+	}
+	elapsed = now_ns() - start;
+
+	if (elapsed < msecs * 1000000LL) {
+		errx(1, "asked for %ld ms, slept %lld ns", msecs, elapsed);
+	}
+	if (elapsed > msecs * 1000000LL + SLACK) {
+		errx(1, "asked for %ld ms, slept %lld ns", msecs, elapsed);
+	}
+	if (rem.tv_sec != 0 || rem.tv_nsec != 0) {
+		errx(1, "nonzero time remaining");
+	}
+	printf("nanosleep %ld ms: %lld us\n", msecs, elapsed / 1000);
+}
+
+int
+main(void)
+{
+	struct timespec req;
+
+	try_sleep(10);
+	try_sleep(50);
+	try_sleep(250);
+	try_sleep(1100);
+
+	/* Zero is fine; a NULL rem is fine */
+	req.tv_sec = 0;
+	req.tv_nsec = 0;
+	if (nanosleep(&req, NULL)) {
+		err(1, "nanosleep 0");
+	}
+
+	req.tv_nsec = 1000000000;
+	if (nanosleep(&req, NULL) != -1 || errno != EINVAL) {
+		errx(1, "nanosleep accepted tv_nsec of 1 second");
+	}
+	req.tv_sec = -1;
+	req.tv_nsec = 0;
+	if (nanosleep(&req, NULL) != -1 || errno != EINVAL) {
+		errx(1, "nanosleep accepted a negative time");
+	}
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/sleeptest");
+	return 0;
+}
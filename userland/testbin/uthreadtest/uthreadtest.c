@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * uthreadtest.c
+ *
+ * Exercises kernel-backed user threads:
+ *
+ *   - NTHREADS threads sum disjoint chunks of a shared array and are
+ *     joined; the partial sums must add up.
+ *   - thread_join rejects the caller's own id and ids that were
+ *     never handed out.
+ *   - A child whose main thread calls _exit while its other threads
+ *     spin must still exit with that status.
+ *   - A child whose non-main thread calls _exit while main is blocked
+ *     in thread_join must exit with that thread's status.
+ *
+ * Threads don't call malloc; libc's malloc isn't thread-safe.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NTHREADS	8
+#define CHUNK		4096
+
+static int data[NTHREADS * CHUNK];
+static unsigned long partial[NTHREADS];
+static volatile int spinning[3];
+
+static
+void
+sum_chunk(void *arg)
+{
+	unsigned n = (unsigned)arg;
+	unsigned long sum = 0;
+	unsigned i;
+
+	for (i = n * CHUNK; i < (n + 1) * CHUNK; i++) {
+		sum += data[i];
+	}
+	partial[n] = sum;
+}
+
+static
+void
+spin(void *arg)
+{
+	spinning[(unsigned)arg] = 1;
+	while (1) {
+		/* nothing */
+	}
+}
+
+static
+void
+exit_four(void *arg)
+{
+	(void)arg;
+
+	while (!spinning[0]) {
+		/* wait for the spinner to get going */
+	}
+	_exit(4);
+}
+
+static
+void
+parallel_sum(void)
+{
+	int tids[NTHREADS];
+	unsigned long expected = 0, total = 0;
+	unsigned i;
+
+	for (i = 0; i < NTHREADS * CHUNK; i++) {
+		data[i] = i % 97;
+		expected += data[i];
+	}
+
+	for (i = 0; i < NTHREADS; i++) {
+		tids[i] = thread_create(sum_chunk, (void *)i);
+		if (tids[i] < 0) {
+			err(1, "thread_create");
+		}
+	}
+	for (i = 0; i < NTHREADS; i++) {
+		if (thread_join(tids[i]) != 0) {
+			err(1, "thread_join %d", tids[i]);
+		}
+		total += partial[i];
+	}
+
+	if (total != expected) {
+		errx(1, "threads summed %lu, expected %lu", total, expected);
+	}
+	printf("uthreadtest: %d threads summed %lu\n", NTHREADS, total);
+}
+
+static
+void
+check_join(void)
+{
+	/* The main thread is always thread 0. */
+	if (thread_join(0) != -1 || errno != EINVAL) {
+		errx(1, "joining yourself didn't fail with EINVAL");
+	}
+	if (thread_join(-1) != -1 || errno != ESRCH) {
+		errx(1, "joining thread -1 didn't fail with ESRCH");
+	}
+	if (thread_join(1000) != -1 || errno != ESRCH) {
+		errx(1, "joining thread 1000 didn't fail with ESRCH");
+	}
+}
+
+/*
+ * Fork a child that runs CHILD and check it exits with STATUS.
+ */
+static
+void
+check_exit(void (*child)(void), int status, const char *what)
+{
+	pid_t pid;
+	int result;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		child();
+		_exit(1);
+	}
+	if (waitpid(pid, &result, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(result) || WEXITSTATUS(result) != status) {
+		errx(1, "%s: child didn't exit with status %d", what, status);
+	}
+}
+
+static
+void
+main_exits(void)
+{
+	unsigned i;
+
+	for (i = 0; i < 3; i++) {
+		if (thread_create(spin, (void *)i) < 0) {
+			err(1, "thread_create");
+		}
+	}
+	for (i = 0; i < 3; i++) {
+		while (!spinning[i]) {
+			/* nothing */
+		}
+	}
+	_exit(3);
+}
+
+static
+void
+other_exits(void)
+{
+	int tid;
+
+	tid = thread_create(spin, (void *)0);
+	if (tid < 0) {
+		err(1, "thread_create");
+	}
+	if (thread_create(exit_four, NULL) < 0) {
+		err(1, "thread_create");
+	}
+	thread_join(tid);
+}
+
+int
+main(void)
+{
+	parallel_sum();
+	check_join();
+	check_exit(main_exits, 3, "_exit from the main thread");
+	check_exit(other_exits, 4, "_exit from another thread");
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/uthreadtest");
+	return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * waitanytest.c
+ *
+ * Checks waitpid with WAIT_ANY and WNOHANG, and wait4: forks a batch
+ * of children and reaps them in whatever order they finish, then
+ * checks the error cases.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define NCHILDREN 32
+
+static pid_t pids[NCHILDREN];
+static int reaped[NCHILDREN];
+
+static
+void
+expect_error(int result, int want, const char *what)
+{
+	if (result != -1) {
+		errx(1, "%s succeeded", what);
+	}
+	if (errno != want) {
+		err(1, "%s: wrong error", what);
+	}
+}
+
+/*
+ * Record the reaping of PID with STATUS; each child exits with its
+ * index, so check that too.
+ */
+static
+void
+reap(pid_t pid, int status)
+{
+	int i;
+
+	for (i=0; i<NCHILDREN; i++) {
+		if (pids[i] == pid) {
+			break;
+		}
+	}
+	if (i == NCHILDREN) {
+		errx(1, "reaped %d, which isn't a child", pid);
+	}
+	if (reaped[i]) {
+		errx(1, "reaped child %d twice", i);
+	}
+	reaped[i] = 1;
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != i) {
+		errx(1, "child %d: bad status %d", i, status);
+	}
+}
+
+static
+void
+spawn(void)
+{
+	int i;
+	volatile int j;
+
+	for (i=0; i<NCHILDREN; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			/* The early ones finish last. */
+			for (j=0; j<(NCHILDREN - i) * 10000; j++) {
+				/* nothing */
+			}
+			_exit(i);
+		}
+		reaped[i] = 0;
+	}
+}
+
+int
+main(void)
+{
+	struct rusage ru;
+	pid_t pid;
+	int i, n, status;
+
+	/* Any child, blocking */
+	spawn();
+	for (i=0; i<NCHILDREN; i++) {
+		pid = waitpid(WAIT_ANY, &status, 0);
+		if (pid < 0) {
+			err(1, "waitpid");
+		}
+		reap(pid, status);
+	}
+	expect_error(waitpid(WAIT_ANY, &status, 0), ECHILD,
+		     "waitpid with no children");
+
+	/* Any child, polling */
+	spawn();
+	n = 0;
+	while (n < NCHILDREN) {
+		pid = waitpid(WAIT_ANY, &status, WNOHANG);
+		if (pid < 0) {
+			err(1, "waitpid");
+		}
+		if (pid > 0) {
+			reap(pid, status);
+			n++;
+		}
+	}
+	expect_error(waitpid(WAIT_ANY, &status, WNOHANG), ECHILD,
+		     "waitpid with WNOHANG and no children");
+
+	/* A specific child with WNOHANG, and wait4 */
+	spawn();
+	for (i=0; i<NCHILDREN; i++) {
+		do {
+			pid = waitpid(pids[i], &status, WNOHANG);
+		} while (pid == 0);
+		if (pid != pids[i]) {
+			err(1, "waitpid for child %d", i);
+		}
+		reap(pid, status);
+		i++;
+		if (i == NCHILDREN) {
+			break;
+		}
+		memset(&ru, 0xff, sizeof(ru));
+		pid = wait4(pids[i], &status, 0, &ru);
+		if (pid != pids[i]) {
+			err(1, "wait4 for child %d", i);
+		}
+		reap(pid, status);
+		if (ru.ru_utime.tv_sec != 0 || ru.ru_utime.tv_usec != 0) {
+			errx(1, "wait4 left the rusage unset");
+		}
+	}
+
+	expect_error(waitpid(WAIT_ANY, &status, 4), EINVAL,
+		     "waitpid with bad options");
+	expect_error(waitpid(-5, &status, 0), ECHILD,
+		     "waitpid for a process group");
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/waitanytest");
+	return 0;
+}